@@ -0,0 +1,307 @@
+/* dhcp_options.c - cross-check and benchmark of received option indexing
+ *
+ * Copyright (c) 2017 Nicholas J. Kain <njkain at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// index_dhcp_opts() is compared with the per-option scan that it replaced,
+// which is kept below.  Every option code of random packets must read back
+// the same from both.  Overload options are only put in the options field,
+// as the old scan also honoured them in file and sname.  Then the work done
+// for one received DHCPACK is timed both ways: the message type and client
+// id checks, the server id, lease time and router, and the ifchange_bind()
+// comparison of each configured option with the previous lease.
+//
+// Usage: bench-dhcp-options [iterations [seed]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dhcp.h"
+#include "options.h"
+
+static int old_do_overload_value(const uint8_t *buf, ssize_t blen,
+                                 int overload)
+{
+    ssize_t i = 0;
+    while (i < blen) {
+        if (buf[i] == DCODE_PADDING) {
+            ++i;
+            continue;
+        }
+        if (buf[i] == DCODE_END)
+            break;
+        if (i >= blen - 2)
+            break;
+        if (buf[i] == DCODE_OVERLOAD) {
+            if (buf[i+1] == 1) {
+                overload |= buf[i+2];
+                i += 3;
+                continue;
+            }
+        }
+        i += buf[i+1] + 2;
+    }
+    return overload;
+}
+
+static int old_overload_value(const struct dhcpmsg * const packet)
+{
+    int ol = old_do_overload_value(packet->options, sizeof packet->options, 0);
+    if (ol & 1 && ol & 2)
+        return ol;
+    if (ol & 1) {
+        ol |= old_do_overload_value(packet->file, sizeof packet->file, ol);
+        return ol;
+    }
+    if (ol & 2) {
+        ol |= old_do_overload_value(packet->sname, sizeof packet->sname, ol);
+        return ol;
+    }
+    return ol; // ol == 0
+}
+
+static void old_do_get_dhcp_opt(const uint8_t *sbuf, size_t slen,
+                                uint8_t code, uint8_t *dbuf, size_t dlen,
+                                size_t *didx)
+{
+    size_t i = 0;
+    while (i < slen) {
+        if (sbuf[i] == DCODE_PADDING) {
+            ++i;
+            continue;
+        }
+        if (sbuf[i] == DCODE_END)
+            break;
+        if (i >= slen - 2)
+            break;
+        size_t soptsiz = sbuf[i+1];
+        if (sbuf[i] == code) {
+            if (dlen < soptsiz + *didx)
+                return;
+            if (slen < soptsiz + i + 2)
+                return;
+            memcpy(dbuf + *didx, sbuf+i+2, soptsiz);
+            *didx += soptsiz;
+        }
+        i += soptsiz + 2;
+    }
+}
+
+static size_t old_get_dhcp_opt(const struct dhcpmsg * const packet,
+                               uint8_t code, uint8_t *dbuf, size_t dlen)
+{
+    int ol = old_overload_value(packet);
+    size_t didx = 0;
+    old_do_get_dhcp_opt(packet->options, sizeof packet->options, code,
+                        dbuf, dlen, &didx);
+    if (ol & 1)
+        old_do_get_dhcp_opt(packet->file, sizeof packet->file, code,
+                            dbuf, dlen, &didx);
+    if (ol & 2)
+        old_do_get_dhcp_opt(packet->sname, sizeof packet->sname, code,
+                            dbuf, dlen, &didx);
+    return didx;
+}
+
+static uint64_t rng_state;
+static uint32_t rng(void)
+{
+    // xorshift64*; reproducible for a given seed.
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 2685821657736338717ull) >> 32);
+}
+
+// Fills an option area with random options.  A few codes are used so that
+// repeated options are common.  The area may end with END, run out, or end
+// in a truncated option.
+static void random_area(uint8_t *buf, size_t blen, bool overload)
+{
+    static const uint8_t codes[] = {
+        DCODE_SUBNET, DCODE_ROUTER, DCODE_DNS, DCODE_HOSTNAME, DCODE_DOMAIN,
+        DCODE_MTU, DCODE_BROADCAST, DCODE_LEASET, DCODE_MSGTYPE,
+        DCODE_SERVER_ID, DCODE_CLIENT_ID, 0xe0,
+    };
+    memset(buf, 0, blen);
+    size_t i = 0;
+    if (overload && rng() % 2) {
+        buf[i++] = DCODE_OVERLOAD;
+        buf[i++] = 1;
+        buf[i++] = (uint8_t)(1 + rng() % 3);
+    }
+    while (i < blen) {
+        uint32_t r = rng() % 16;
+        if (r == 0) {
+            buf[i] = DCODE_END;
+            return;
+        }
+        if (r == 1) {
+            buf[i++] = DCODE_PADDING;
+            continue;
+        }
+        buf[i++] = codes[rng() % sizeof codes];
+        if (i == blen)
+            return;
+        size_t len = rng() % 12;
+        buf[i++] = (uint8_t)len;
+        for (size_t j = 0; j < len && i < blen; ++j)
+            buf[i++] = (uint8_t)rng();
+    }
+}
+
+static unsigned long cross_check(unsigned long iters)
+{
+    static struct dhcpmsg packet;
+    static struct dhcp_opts opts;
+    uint8_t buf[sizeof opts.data];
+    unsigned long bad = 0;
+    for (unsigned long i = 0; i < iters; ++i) {
+        random_area(packet.options, sizeof packet.options, true);
+        random_area(packet.file, sizeof packet.file, false);
+        random_area(packet.sname, sizeof packet.sname, false);
+        index_dhcp_opts(&opts, &packet);
+        for (unsigned code = 1; code < DCODE_END; ++code) {
+            size_t len;
+            const uint8_t *data = get_dhcp_opt(&opts, (uint8_t)code, &len);
+            size_t olen = old_get_dhcp_opt(&packet, (uint8_t)code, buf,
+                                           sizeof buf);
+            if (len != olen || memcmp(data, buf, len)) {
+                if (bad++ < 10)
+                    printf("mismatch: packet %lu code %u: len %zu, old %zu\n",
+                           i, code, len, olen);
+            }
+        }
+    }
+    return bad;
+}
+
+// The options of a typical DHCPACK.
+static void ack_packet(struct dhcpmsg packet[static 1])
+{
+    static const uint8_t ack[] = {
+        DCODE_MSGTYPE, 1, DHCPACK,
+        DCODE_SERVER_ID, 4, 192, 168, 1, 1,
+        DCODE_LEASET, 4, 0, 1, 0x51, 0x80,
+        DCODE_SUBNET, 4, 255, 255, 255, 0,
+        DCODE_ROUTER, 4, 192, 168, 1, 1,
+        DCODE_DNS, 8, 192, 168, 1, 1, 8, 8, 8, 8,
+        DCODE_DOMAIN, 9, 'l', 'o', 'c', 'a', 'l', 'd', 'o', 'm', 'n',
+        DCODE_BROADCAST, 4, 192, 168, 1, 255,
+        DCODE_CLIENT_ID, 7, 1, 0x02, 0x00, 0x00, 0x00, 0x00, 0x01,
+        DCODE_END,
+    };
+    memset(packet, 0, sizeof *packet);
+    memcpy(packet->options, ack, sizeof ack);
+}
+
+// Codes that ifchange_bind() compares with the previous lease.
+static const uint8_t bind_codes[] = {
+    DCODE_SUBNET, DCODE_BROADCAST, DCODE_ROUTER, DCODE_MTU, DCODE_DNS,
+    DCODE_HOSTNAME, DCODE_DOMAIN, DCODE_WINS,
+};
+// Codes that are read once from a received DHCPACK.
+static const uint8_t rx_codes[] = {
+    DCODE_MSGTYPE, DCODE_CLIENT_ID, DCODE_SERVER_ID, DCODE_LEASET,
+    DCODE_ROUTER,
+};
+
+static size_t old_rx(const struct dhcpmsg packet[static 1],
+                     const struct dhcpmsg cfg_packet[static 1])
+{
+    uint8_t buf[256], obuf[256];
+    size_t sum = (size_t)get_end_option_idx(packet);
+    for (size_t i = 0; i < sizeof rx_codes; ++i)
+        sum += old_get_dhcp_opt(packet, rx_codes[i], buf, sizeof buf);
+    for (size_t i = 0; i < sizeof bind_codes; ++i) {
+        size_t l = old_get_dhcp_opt(packet, bind_codes[i], buf, sizeof buf);
+        size_t ol = old_get_dhcp_opt(cfg_packet, bind_codes[i], obuf,
+                                     sizeof obuf);
+        sum += l == ol && !memcmp(buf, obuf, l);
+    }
+    return sum;
+}
+
+static size_t new_rx(struct dhcp_rx rx[static 1],
+                     const struct dhcp_rx cfg_rx[static 1])
+{
+    size_t sum = index_dhcp_opts(&rx->opts, &rx->msg);
+    for (size_t i = 0; i < sizeof rx_codes; ++i) {
+        size_t l;
+        get_dhcp_opt(&rx->opts, rx_codes[i], &l);
+        sum += l;
+    }
+    for (size_t i = 0; i < sizeof bind_codes; ++i) {
+        size_t l, ol;
+        const uint8_t *d = get_dhcp_opt(&rx->opts, bind_codes[i], &l);
+        const uint8_t *od = get_dhcp_opt(&cfg_rx->opts, bind_codes[i], &ol);
+        sum += l == ol && !memcmp(d, od, l);
+    }
+    return sum;
+}
+
+static long long nsnow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long iters = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    rng_state = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+    if (!iters || !rng_state) {
+        fprintf(stderr, "usage: %s [iterations [seed]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Each packet checks every code, so fewer are needed.
+    unsigned long checks = iters / 100 ? iters / 100 : 1;
+    unsigned long bad = cross_check(checks);
+    printf("cross-check: %lu packets, %lu option mismatches\n", checks, bad);
+
+    static struct dhcp_rx rx, cfg_rx;
+    ack_packet(&rx.msg);
+    ack_packet(&cfg_rx.msg);
+    index_dhcp_opts(&cfg_rx.opts, &cfg_rx.msg);
+    size_t sink = 0;
+    long long start = nsnow();
+    for (unsigned long i = 0; i < iters; ++i)
+        sink += old_rx(&rx.msg, &cfg_rx.msg);
+    long long mid = nsnow();
+    for (unsigned long i = 0; i < iters; ++i)
+        sink += new_rx(&rx, &cfg_rx);
+    long long end = nsnow();
+    // Keeps the loops from being optimized away.
+    if (sink == 1)
+        printf(" ");
+    printf("per-option scan: %.1f ns/packet\nindex: %.1f ns/packet\n",
+           (double)(mid - start) / (double)iters,
+           (double)(end - mid) / (double)iters);
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -35,9 +35,12 @@
 #include <linux/if_packet.h>
 #include <linux/filter.h>
 #include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include "nk/log.h"
 #include "nk/io.h"
 #include "arp.h"
+#include "timer.h"
 #include "state.h"
 #include "dhcp.h"
 #include "sys.h"
@@ -61,22 +64,23 @@ int arp_probe_max = 2000;          // maximum delay until repeated probe (ms)
 #define MAX_CONFLICTS 10           // max conflicts before rate-limiting
 #define RATE_LIMIT_INTERVAL 60000  // delay between successive attempts
 #define DEFEND_INTERVAL 10000      // minimum interval between defensive ARPs
+#define ARP_RECV_BATCH 16          // max frames read per ARP socket wakeup
+#define GW_FAST_DEFAULT 250        // first fast gw check retry if no RTT
+#define GW_FAST_MIN 100            // bounds of the first fast gw check retry
+#define GW_FAST_MAX 1000
 
-static struct arp_data garp = {
-    .wake_ts = { -1, -1, -1, -1, -1, -1, -1 },
-    .send_stats = {{0,0},{0,0},{0,0}},
-    .last_conflict_ts = 0,
-    .gw_check_initpings = 0,
-    .arp_check_start_ts = 0,
-    .total_conflicts = 0,
-    .probe_wait_time = 0,
-    .using_bpf = false,
-    .relentless_def = false,
-    .router_replied = false,
-    .server_replied = false,
-};
-
-void set_arp_relentless_def(bool v) { garp.relentless_def = v; }
+static struct arp_data garps[NDHC_MAX_IFACES]; // Indexed by cs->client_idx
+static bool arp_relentless_def; // Don't give up defense no matter what.
+static bool arp_optimistic; // Use the address while probing for conflicts.
+
+// Frames read from an ARP socket by arp_packet_get() and not yet handed to
+// the state machine.  Only one interface is serviced at a time, so a single
+// queue is shared; arp_rq_idx is the client_idx that owns it.
+static struct arpMsg arp_rq[ARP_RECV_BATCH];
+static size_t arp_rq_len, arp_rq_pos, arp_rq_idx;
+
+void set_arp_relentless_def(bool v) { arp_relentless_def = v; }
+void set_arp_optimistic(bool v) { arp_optimistic = v; }
 
 static void arp_min_close_fd(struct client_state_t cs[static 1])
 {
@@ -86,41 +90,76 @@ static void arp_min_close_fd(struct client_state_t cs[static 1])
     close(cs->arpFd);
     cs->arpFd = -1;
     cs->arp_is_defense = false;
+    // Queued frames were filtered for the socket that is going away.
+    if (arp_rq_idx == cs->client_idx)
+        arp_rq_len = arp_rq_pos = 0;
 }
 
 static void arp_close_fd(struct client_state_t cs[static 1])
 {
     arp_min_close_fd(cs);
     for (int i = 0; i < AS_MAX; ++i)
-        garp.wake_ts[i] = -1;
+        timer_set(cs, TMR_ARP + i, -1);
+}
+
+// Removes an address that was configured before the collision check
+// confirmed it.  An address that was never confirmed must not outlive the
+// check.
+void arp_drop_optimistic(struct client_state_t cs[static 1])
+{
+    struct arp_data *garp = &garps[cs->client_idx];
+    if (!garp->optimistic_bound)
+        return;
+    garp->optimistic_bound = false;
+    garp->optimistic_drops++;
+    log_line("%s: arp: Removing the optimistic address (%u of %u optimistic binds rolled back).",
+             client_config->interface, garp->optimistic_drops,
+             garp->optimistic_binds);
+    if (ifchange_deconfig(cs) < 0)
+        log_warning("%s: Failed to remove the optimistic address.",
+                    client_config->interface);
 }
 
 void arp_reset_state(struct client_state_t cs[static 1])
 {
+    struct arp_data *garp = &garps[cs->client_idx];
     arp_close_fd(cs);
-    memset(&garp.reply, 0, sizeof garp.reply);
-    garp.last_conflict_ts = 0;
-    garp.gw_check_initpings = 0;
-    garp.arp_check_start_ts = 0;
-    garp.total_conflicts = 0;
-    garp.probe_wait_time = 0;
-    garp.server_replied = false;
-    garp.router_replied = false;
+    memset(&garp->reply, 0, sizeof garp->reply);
+    garp->last_conflict_ts = 0;
+    garp->gw_check_initpings = 0;
+    garp->arp_check_start_ts = 0;
+    garp->total_conflicts = 0;
+    garp->probe_wait_time = 0;
+    garp->server_replied = false;
+    garp->router_replied = false;
+    garp->gw_known_count = 0;
+    garp->gw_rtt = 0;
+    garp->gw_check_delay = 0;
+    arp_drop_optimistic(cs);
     for (int i = 0; i < ASEND_MAX; ++i) {
-        garp.send_stats[i].ts = 0;
-        garp.send_stats[i].count = 0;
+        garp->send_stats[i].ts = 0;
+        garp->send_stats[i].count = 0;
     }
 }
 
 static int get_arp_basic_socket(struct client_state_t cs[static 1])
 {
+    struct arp_data *garp = &garps[cs->client_idx];
+    char buf[32];
+    size_t buflen = 0;
+    buf[0] = 'a';
+    buflen += 1;
+    memcpy(buf + buflen, garp->basic_ip, sizeof garp->basic_ip);
+    buflen += sizeof garp->basic_ip;
+    memcpy(buf + buflen, client_config->arp, 6);
+    buflen += 6;
     char resp;
-    int fd = request_sockd_fd("a", 1, &resp);
+    int fd = request_sockd_fd(buf, buflen, &resp);
     switch (resp) {
-        case 'A': garp.using_bpf = true; break;
-        case 'a': garp.using_bpf = false; break;
+        case 'A': garp->using_bpf = true; break;
+        case 'a': garp->using_bpf = false; break;
         default: suicide("%s: (%s) expected a or A sockd reply but got %c",
-                         client_config.interface, __func__, resp);
+                         client_config->interface, __func__, resp);
     }
     cs->arp_is_defense = false;
     return fd;
@@ -128,62 +167,85 @@ static int get_arp_basic_socket(struct client_state_t cs[static 1])
 
 static int get_arp_defense_socket(struct client_state_t cs[static 1])
 {
+    struct arp_data *garp = &garps[cs->client_idx];
     char buf[32];
     size_t buflen = 0;
     buf[0] = 'd';
     buflen += 1;
     memcpy(buf + buflen, &cs->clientAddr, sizeof cs->clientAddr);
     buflen += sizeof cs->clientAddr;
-    memcpy(buf + buflen, client_config.arp, 6);
+    memcpy(buf + buflen, client_config->arp, 6);
     buflen += 6;
     char resp;
     int fd = request_sockd_fd(buf, buflen, &resp);
     switch (resp) {
-        case 'D': garp.using_bpf = true; break;
-        case 'd': garp.using_bpf = false; break;
+        case 'D': garp->using_bpf = true; break;
+        case 'd': garp->using_bpf = false; break;
         default: suicide("%s: (%s) expected d or D sockd reply but got %c",
-                         client_config.interface, __func__, resp);
+                         client_config->interface, __func__, resp);
     }
     cs->arp_is_defense = true;
     return fd;
 }
 
-static int arp_open_fd(struct client_state_t cs[static 1], bool defense)
+static int arp_reopen_fd(struct client_state_t cs[static 1], bool defense)
 {
-    if (cs->arpFd >= 0 && defense == cs->arp_is_defense)
-        return 0;
-    arp_min_close_fd(cs);
     cs->arpFd = defense ? get_arp_defense_socket(cs)
                         : get_arp_basic_socket(cs);
     if (cs->arpFd < 0) {
         log_error("%s: (%s) Failed to create socket: %s",
-                  client_config.interface, __func__, strerror(errno));
+                  client_config->interface, __func__, strerror(errno));
         return -1;
     }
-    epoll_add(cs->epollFd, cs->arpFd);
+    epoll_add_tag(cs->epollFd, cs->arpFd, (uint32_t)cs->client_idx);
     return 0;
 }
 
+static int arp_open_fd(struct client_state_t cs[static 1], bool defense)
+{
+    if (cs->arpFd >= 0 && defense == cs->arp_is_defense)
+        return 0;
+    arp_min_close_fd(cs);
+    return arp_reopen_fd(cs, defense);
+}
+
+// The basic socket filter only passes packets that mention ip_a or ip_b,
+// so the socket is replaced if it was built for different addresses.
+static int arp_open_basic_fd(struct client_state_t cs[static 1],
+                             uint32_t ip_a, uint32_t ip_b)
+{
+    struct arp_data *garp = &garps[cs->client_idx];
+    if (!ip_b)
+        ip_b = ip_a;
+    if (cs->arpFd >= 0 && !cs->arp_is_defense &&
+        garp->basic_ip[0] == ip_a && garp->basic_ip[1] == ip_b)
+        return 0;
+    arp_min_close_fd(cs);
+    garp->basic_ip[0] = ip_a;
+    garp->basic_ip[1] = ip_b;
+    return arp_reopen_fd(cs, false);
+}
+
 static int arp_send(struct client_state_t cs[static 1],
                     struct arpMsg arp[static 1])
 {
     int ret = -1;
     struct sockaddr_ll addr = {
         .sll_family = AF_PACKET,
-        .sll_ifindex = client_config.ifindex,
+        .sll_ifindex = client_config->ifindex,
         .sll_halen = 6,
     };
-    memcpy(addr.sll_addr, client_config.arp, 6);
+    memcpy(addr.sll_addr, client_config->arp, 6);
 
     if (cs->arpFd < 0) {
         log_warning("%s: arp: Send attempted when no ARP fd is open.",
-                    client_config.interface);
+                    client_config->interface);
         return ret;
     }
 
-    if (!carrier_isup()) {
+    if (!carrier_isup(cs)) {
         log_error("%s: (%s) carrier down; sendto would fail",
-                  client_config.interface, __func__);
+                  client_config->interface, __func__);
         ret = -99;
         goto carrier_down;
     }
@@ -192,10 +254,10 @@ static int arp_send(struct client_state_t cs[static 1],
     if (ret < 0 || (size_t)ret != sizeof *arp) {
         if (ret < 0)
             log_error("%s: (%s) sendto failed: %s",
-                      client_config.interface, __func__, strerror(errno));
+                      client_config->interface, __func__, strerror(errno));
         else
             log_error("%s: (%s) sendto short write: %d < %zu",
-                      client_config.interface, __func__, ret, sizeof *arp);
+                      client_config->interface, __func__, ret, sizeof *arp);
 carrier_down:
         return ret;
     }
@@ -210,21 +272,29 @@ carrier_down:
         .operation = htons(ARPOP_REQUEST),                              \
         .smac = {0},                                                    \
     };                                                                  \
-    memcpy(arp.h_source, client_config.arp, 6);                         \
+    memcpy(arp.h_source, client_config->arp, 6);                         \
     memset(arp.h_dest, 0xff, 6);                                        \
-    memcpy(arp.smac, client_config.arp, 6)
+    memcpy(arp.smac, client_config->arp, 6)
 
 // Returns 0 on success, -1 on failure.
-static int arp_ping(struct client_state_t cs[static 1], uint32_t test_ip)
+static int arp_ping_from(struct client_state_t cs[static 1], uint32_t from_ip,
+                         uint32_t test_ip)
 {
     BASE_ARPMSG();
-    memcpy(arp.sip4, &cs->clientAddr, sizeof cs->clientAddr);
+    memcpy(arp.sip4, &from_ip, sizeof from_ip);
     memcpy(arp.dip4, &test_ip, sizeof test_ip);
-    int r = arp_send(cs, &arp);
+    return arp_send(cs, &arp);
+}
+
+// Returns 0 on success, -1 on failure.
+static int arp_ping(struct client_state_t cs[static 1], uint32_t test_ip)
+{
+    struct arp_data *garp = &garps[cs->client_idx];
+    int r = arp_ping_from(cs, cs->clientAddr, test_ip);
     if (r < 0)
         return r;
-    garp.send_stats[ASEND_GW_PING].count++;
-    garp.send_stats[ASEND_GW_PING].ts = curms();
+    garp->send_stats[ASEND_GW_PING].count++;
+    garp->send_stats[ASEND_GW_PING].ts = curms();
     return 0;
 }
 
@@ -232,81 +302,226 @@ static int arp_ping(struct client_state_t cs[static 1], uint32_t test_ip)
 static int arp_ip_anon_ping(struct client_state_t cs[static 1],
                             uint32_t test_ip)
 {
+    struct arp_data *garp = &garps[cs->client_idx];
     BASE_ARPMSG();
     memcpy(arp.dip4, &test_ip, sizeof test_ip);
     log_line("%s: arp: Probing for hosts that may conflict with our lease...",
-             client_config.interface);
+             client_config->interface);
     int r = arp_send(cs, &arp);
     if (r < 0)
         return r;
-    garp.send_stats[ASEND_COLLISION_CHECK].count++;
-    garp.send_stats[ASEND_COLLISION_CHECK].ts = curms();
+    garp->send_stats[ASEND_COLLISION_CHECK].count++;
+    garp->send_stats[ASEND_COLLISION_CHECK].ts = curms();
     return 0;
 }
 
 static int arp_announcement(struct client_state_t cs[static 1])
 {
+    struct arp_data *garp = &garps[cs->client_idx];
     BASE_ARPMSG();
     memcpy(arp.sip4, &cs->clientAddr, 4);
     memcpy(arp.dip4, &cs->clientAddr, 4);
     int r = arp_send(cs, &arp);
     if (r < 0)
         return r;
-    garp.send_stats[ASEND_ANNOUNCE].count++;
-    garp.send_stats[ASEND_ANNOUNCE].ts = curms();
+    garp->send_stats[ASEND_ANNOUNCE].count++;
+    garp->send_stats[ASEND_ANNOUNCE].ts = curms();
     return 0;
 }
 #undef BASE_ARPMSG
 
+// Logs the time from the start of the lease search until the address was
+// configured, so that the optimistic and probe-first modes can be compared.
+static void arp_log_usable(struct client_state_t cs[static 1])
+{
+    if (cs->acquire_ts < 0)
+        return;
+    log_line("%s: Address usable %lld ms after the lease search began.",
+             client_config->interface, curms() - cs->acquire_ts);
+    cs->acquire_ts = -1;
+}
+
 // Checks to see if there is another host that has our assigned IP.
 int arp_check(struct client_state_t cs[static 1],
-              struct dhcpmsg packet[static 1])
+              struct dhcp_rx packet[static 1])
 {
-    memcpy(&garp.dhcp_packet, packet, sizeof (struct dhcpmsg));
-    if (arp_open_fd(cs, false) < 0)
+    struct arp_data *garp = &garps[cs->client_idx];
+    memcpy(&garp->dhcp_packet, packet, sizeof (struct dhcp_rx));
+    if (arp_open_basic_fd(cs, garp->dhcp_packet.msg.yiaddr, 0) < 0)
         return -1;
-    if (arp_ip_anon_ping(cs, garp.dhcp_packet.yiaddr) < 0)
+    if (arp_ip_anon_ping(cs, garp->dhcp_packet.msg.yiaddr) < 0)
         return -1;
-    garp.arp_check_start_ts = garp.send_stats[ASEND_COLLISION_CHECK].ts;
-    garp.probe_wait_time = arp_probe_wait;
-    garp.wake_ts[AS_COLLISION_CHECK] = garp.arp_check_start_ts
-                                       + garp.probe_wait_time;
+    garp->arp_check_start_ts = garp->send_stats[ASEND_COLLISION_CHECK].ts;
+    garp->probe_wait_time = arp_probe_wait;
+    timer_set(cs, TMR_ARP + AS_COLLISION_CHECK,
+              garp->arp_check_start_ts + garp->probe_wait_time);
+    if (arp_optimistic) {
+        // Like IPv6 optimistic DAD: the address is configured now and is
+        // removed again if the probes find that it is in use.
+        char clibuf[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET,
+                  &(struct in_addr){.s_addr=garp->dhcp_packet.msg.yiaddr},
+                  clibuf, sizeof clibuf);
+        log_line("%s: arp: Optimistically using %s while probing for conflicts.",
+                 client_config->interface, clibuf);
+        if (ifchange_bind(cs, &garp->dhcp_packet) < 0) {
+            suicide("%s: Failed to set the interface IP address and properties!",
+                    client_config->interface);
+        }
+        garp->optimistic_bound = true;
+        garp->optimistic_binds++;
+        arp_log_usable(cs);
+    }
+    return 0;
+}
+
+// A known network is recognized by its gateway, or by its DHCP agent if
+// it has no gateway.
+static uint32_t known_gw_ip(const struct lease_record lr[static 1])
+{
+    return lr->router ? lr->router : lr->srcaddr;
+}
+
+static const uint8_t *known_gw_mac(const struct lease_record lr[static 1])
+{
+    return lr->router ? lr->router_mac : lr->server_mac;
+}
+
+// Pings the gateways of the known networks, each from the address of our
+// lease on that network as in RFC4436.  Gateways that share an address
+// with ours or with an earlier one were already pinged.  The replies to
+// these pings are unicast to our hardware address, so they pass the
+// basic socket filter.
+static int arp_ping_known(struct client_state_t cs[static 1])
+{
+    struct arp_data *garp = &garps[cs->client_idx];
+    for (size_t i = 0; i < garp->gw_known_count; ++i) {
+        uint32_t ip = known_gw_ip(&garp->gw_known[i]);
+        bool dup = ip == cs->routerAddr || ip == cs->srcAddr;
+        for (size_t j = 0; j < i && !dup; ++j)
+            dup = ip == known_gw_ip(&garp->gw_known[j]);
+        if (dup)
+            continue;
+        int r = arp_ping_from(cs, garp->gw_known[i].yiaddr, ip);
+        if (r < 0)
+            return r;
+    }
     return 0;
 }
 
-// Confirms that we're still on the fingerprinted network.
-int arp_gw_check(struct client_state_t cs[static 1])
+// Returns true if the ARP reply came from the gateway of a known network.
+static bool arp_is_known_gw(struct client_state_t cs[static 1])
 {
-    if (arp_open_fd(cs, false) < 0)
+    struct arp_data *garp = &garps[cs->client_idx];
+    for (size_t i = 0; i < garp->gw_known_count; ++i) {
+        const struct lease_record *lr = &garp->gw_known[i];
+        uint32_t ip = known_gw_ip(lr);
+        if (memcmp(garp->reply.sip4, &ip, 4) ||
+            memcmp(garp->reply.smac, known_gw_mac(lr), 6))
+            continue;
+        char ipbuf[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &ip, ipbuf, sizeof ipbuf);
+        log_line("%s: arp: Found the gateway %s of a known network.",
+                 client_config->interface, ipbuf);
+        garp->gw_known_match = i;
+        garp->gw_known_count = 0;
+        timer_set(cs, TMR_ARP + AS_GW_CHECK, -1);
+        return true;
+    }
+    return false;
+}
+
+const struct lease_record *arp_gw_known(struct client_state_t cs[static 1])
+{
+    struct arp_data *garp = &garps[cs->client_idx];
+    return &garp->gw_known[garp->gw_known_match];
+}
+
+// Updates the gateway round trip estimate from a reply to the last ping.
+static void arp_gw_rtt_sample(struct arp_data garp[static 1])
+{
+    long long rtt = curms() - garp->send_stats[ASEND_GW_PING].ts;
+    if (rtt < 0 || rtt > ARP_RETRANS_DELAY)
+        return;
+    garp->gw_rtt = garp->gw_rtt ? (3 * garp->gw_rtt + (int)rtt) / 4
+                                : (int)rtt;
+    if (!garp->gw_rtt)
+        garp->gw_rtt = 1;
+}
+
+// The first retry of a fast gateway check waits for a few gateway round
+// trips, and each later retry waits twice as long as the one before.
+static int arp_gw_fast_delay(struct arp_data garp[static 1])
+{
+    int d = garp->gw_rtt ? 4 * garp->gw_rtt : GW_FAST_DEFAULT;
+    if (d < GW_FAST_MIN)
+        d = GW_FAST_MIN;
+    else if (d > GW_FAST_MAX)
+        d = GW_FAST_MAX;
+    return d;
+}
+
+// Confirms that we're still on the fingerprinted network, or finds which
+// of the known networks we are on instead.  All gateways are pinged at
+// once.  A fast check retries on a sub-second schedule.
+int arp_gw_check(struct client_state_t cs[static 1],
+                 const struct lease_record known[], size_t known_count,
+                 bool fast)
+{
+    struct arp_data *garp = &garps[cs->client_idx];
+    if (arp_open_basic_fd(cs, cs->srcAddr, cs->routerAddr) < 0)
         return -1;
-    garp.gw_check_initpings = garp.send_stats[ASEND_GW_PING].count;
-    garp.server_replied = false;
+    garp->gw_check_initpings = garp->send_stats[ASEND_GW_PING].count;
+    garp->server_replied = false;
+    if (known_count > LEASE_CACHE_MAX)
+        known_count = LEASE_CACHE_MAX;
+    memcpy(garp->gw_known, known, known_count * sizeof known[0]);
+    garp->gw_known_count = known_count;
+    garp->gw_check_delay = fast ? arp_gw_fast_delay(garp) : 0;
     cs->check_fingerprint = true;
     int r;
     if ((r = arp_ping(cs, cs->srcAddr)) < 0)
         return r;
     if (cs->routerAddr) {
-        garp.router_replied = false;
+        garp->router_replied = false;
         if ((r = arp_ping(cs, cs->routerAddr)) < 0)
             return r;
     } else
-        garp.router_replied = true;
-    garp.wake_ts[AS_GW_CHECK] =
-        garp.send_stats[ASEND_GW_PING].ts + ARP_RETRANS_DELAY + 250;
+        garp->router_replied = true;
+    if ((r = arp_ping_known(cs)) < 0)
+        return r;
+    timer_set(cs, TMR_ARP + AS_GW_CHECK, garp->send_stats[ASEND_GW_PING].ts
+              + (garp->gw_check_delay ? garp->gw_check_delay
+                                      : ARP_RETRANS_DELAY + 250));
     return 0;
 }
 
+// Returns true if the gateway check is still looking for known networks.
+bool arp_gw_known_pending(struct client_state_t cs[static 1])
+{
+    return garps[cs->client_idx].gw_known_count > 0;
+}
+
+// Ends a gateway check that the DHCP server answered for first.
+void arp_gw_check_cancel(struct client_state_t cs[static 1])
+{
+    struct arp_data *garp = &garps[cs->client_idx];
+    garp->gw_known_count = 0;
+    timer_set(cs, TMR_ARP + AS_GW_CHECK, -1);
+}
+
 // Gathers the fingerprinting info for the associated network.
 static int arp_get_gw_hwaddr(struct client_state_t cs[static 1])
 {
-    if (arp_open_fd(cs, false) < 0)
+    struct arp_data *garp = &garps[cs->client_idx];
+    if (arp_open_basic_fd(cs, cs->srcAddr, cs->routerAddr) < 0)
         return -1;
     if (cs->routerAddr)
         log_line("%s: arp: Searching for dhcp server and gw addresses...",
-                 client_config.interface);
+                 client_config->interface);
     else
         log_line("%s: arp: Searching for dhcp server address...",
-                 client_config.interface);
+                 client_config->interface);
     cs->got_server_arp = false;
     if (arp_ping(cs, cs->srcAddr) < 0)
         return -1;
@@ -316,8 +531,8 @@ static int arp_get_gw_hwaddr(struct client_state_t cs[static 1])
             return -1;
     } else
         cs->got_router_arp = true;
-    garp.wake_ts[AS_GW_QUERY] =
-        garp.send_stats[ASEND_GW_PING].ts + ARP_RETRANS_DELAY + 250;
+    timer_set(cs, TMR_ARP + AS_GW_QUERY,
+              garp->send_stats[ASEND_GW_PING].ts + ARP_RETRANS_DELAY + 250);
     return 0;
 }
 
@@ -329,10 +544,10 @@ int arp_set_defense_mode(struct client_state_t cs[static 1])
 static int arp_gw_success(struct client_state_t cs[static 1])
 {
     log_line("%s: arp: Network seems unchanged.  Resuming normal operation.",
-             client_config.interface);
+             client_config->interface);
     if (arp_open_fd(cs, true) < 0)
         return ARPR_FAIL;
-    garp.wake_ts[AS_GW_CHECK] = -1;
+    timer_set(cs, TMR_ARP + AS_GW_CHECK, -1);
     if (arp_announcement(cs) < 0)
         return ARPR_FAIL;
     return ARPR_FREE;
@@ -344,27 +559,27 @@ static int arp_validate_bpf(struct arpMsg *am)
 {
     if (am->h_proto != htons(ETH_P_ARP)) {
         log_warning("%s: arp: IP header does not indicate ARP protocol",
-                    client_config.interface);
+                    client_config->interface);
         return 0;
     }
     if (am->htype != htons(ARPHRD_ETHER)) {
         log_warning("%s: arp: ARP hardware type field invalid",
-                    client_config.interface);
+                    client_config->interface);
         return 0;
     }
     if (am->ptype != htons(ETH_P_IP)) {
         log_warning("%s: arp: ARP protocol type field invalid",
-                    client_config.interface);
+                    client_config->interface);
         return 0;
     }
     if (am->hlen != 6) {
         log_warning("%s: arp: ARP hardware address length invalid",
-                    client_config.interface);
+                    client_config->interface);
         return 0;
     }
     if (am->plen != 4) {
         log_warning("%s: arp: ARP protocol address length invalid",
-                    client_config.interface);
+                    client_config->interface);
         return 0;
     }
     return 1;
@@ -377,7 +592,26 @@ static int arp_validate_bpf_defense(struct client_state_t cs[static 1],
 {
     if (memcmp(am->sip4, &cs->clientAddr, 4))
         return 0;
-    if (!memcmp(am->smac, client_config.arp, 6))
+    if (!memcmp(am->smac, client_config->arp, 6))
+        return 0;
+    return 1;
+}
+
+// ARP validation functions that will be performed by the BPF if it is
+// installed.
+static int arp_validate_bpf_basic(struct client_state_t cs[static 1],
+                                  struct arpMsg am[static 1])
+{
+    struct arp_data *garp = &garps[cs->client_idx];
+    for (size_t i = 0; i < sizeof garp->basic_ip / sizeof garp->basic_ip[0];
+         ++i) {
+        if (!memcmp(am->sip4, &garp->basic_ip[i], 4) ||
+            !memcmp(am->dip4, &garp->basic_ip[i], 4))
+            return 1;
+    }
+    if (am->operation != htons(ARPOP_REPLY))
+        return 0;
+    if (memcmp(am->dmac, client_config->arp, 6))
         return 0;
     return 1;
 }
@@ -386,9 +620,9 @@ static int arp_is_query_reply(struct arpMsg am[static 1])
 {
     if (am->operation != htons(ARPOP_REPLY))
         return 0;
-    if (memcmp(am->h_dest, client_config.arp, 6))
+    if (memcmp(am->h_dest, client_config->arp, 6))
         return 0;
-    if (memcmp(am->dmac, client_config.arp, 6))
+    if (memcmp(am->dmac, client_config->arp, 6))
         return 0;
     return 1;
 }
@@ -405,9 +639,9 @@ int arp_defense_timeout(struct client_state_t cs[static 1], long long nowts)
 {
     (void)nowts; // Suppress warning; parameter necessary but unused.
     int ret = 0;
-    if (garp.wake_ts[AS_DEFENSE] != -1) {
-        log_line("%s: arp: Defending our lease IP.", client_config.interface);
-        garp.wake_ts[AS_DEFENSE] = -1;
+    if (timer_get(cs, TMR_ARP + AS_DEFENSE) != -1) {
+        log_line("%s: arp: Defending our lease IP.", client_config->interface);
+        timer_set(cs, TMR_ARP + AS_DEFENSE, -1);
         ret = arp_announcement(cs);
     }
     return ret;
@@ -415,74 +649,89 @@ int arp_defense_timeout(struct client_state_t cs[static 1], long long nowts)
 
 int arp_gw_check_timeout(struct client_state_t cs[static 1], long long nowts)
 {
-    if (garp.send_stats[ASEND_GW_PING].count >= garp.gw_check_initpings + 6) {
-        if (garp.router_replied && !garp.server_replied)
+    struct arp_data *garp = &garps[cs->client_idx];
+    if (garp->send_stats[ASEND_GW_PING].count >= garp->gw_check_initpings + 6) {
+        if (garp->router_replied && !garp->server_replied)
             log_line("%s: arp: DHCP agent didn't reply.  Getting new lease.",
-                     client_config.interface);
-        else if (!garp.router_replied && garp.server_replied)
+                     client_config->interface);
+        else if (!garp->router_replied && garp->server_replied)
             log_line("%s: arp: Gateway didn't reply.  Getting new lease.",
-                     client_config.interface);
+                     client_config->interface);
         else
             log_line("%s: arp: DHCP agent and gateway didn't reply.  Getting new lease.",
-                     client_config.interface);
-        garp.wake_ts[AS_GW_CHECK] = -1;
+                     client_config->interface);
+        timer_set(cs, TMR_ARP + AS_GW_CHECK, -1);
         return ARPR_CONFLICT;
     }
-    long long rtts = garp.send_stats[ASEND_GW_PING].ts + ARP_RETRANS_DELAY;
+    int delay = garp->gw_check_delay ? garp->gw_check_delay
+                                     : ARP_RETRANS_DELAY;
+    long long rtts = garp->send_stats[ASEND_GW_PING].ts + delay;
     if (nowts < rtts) {
-        garp.wake_ts[AS_GW_CHECK] = rtts;
+        timer_set(cs, TMR_ARP + AS_GW_CHECK, rtts);
         return ARPR_OK;
     }
-    if (!garp.router_replied) {
+    if (!garp->router_replied) {
         log_line("%s: arp: Still waiting for gateway to reply to arp ping...",
-                 client_config.interface);
+                 client_config->interface);
         if (arp_ping(cs, cs->routerAddr) < 0) {
             log_warning("%s: arp: Failed to send ARP ping in retransmission.",
-                        client_config.interface);
+                        client_config->interface);
             return ARPR_FAIL;
         }
     }
-    if (!garp.server_replied) {
+    if (!garp->server_replied) {
         log_line("%s: arp: Still waiting for DHCP agent to reply to arp ping...",
-                 client_config.interface);
+                 client_config->interface);
         if (arp_ping(cs, cs->srcAddr) < 0) {
             log_warning("%s: arp: Failed to send ARP ping in retransmission.",
-                        client_config.interface);
+                        client_config->interface);
             return ARPR_FAIL;
         }
     }
-    garp.wake_ts[AS_GW_CHECK] =
-        garp.send_stats[ASEND_GW_PING].ts + ARP_RETRANS_DELAY;
+    if (arp_ping_known(cs) < 0) {
+        log_warning("%s: arp: Failed to send ARP ping in retransmission.",
+                    client_config->interface);
+        return ARPR_FAIL;
+    }
+    if (garp->gw_check_delay) {
+        delay = 2 * garp->gw_check_delay;
+        garp->gw_check_delay = delay < ARP_RETRANS_DELAY ? delay
+                                                         : ARP_RETRANS_DELAY;
+    }
+    timer_set(cs, TMR_ARP + AS_GW_CHECK, garp->send_stats[ASEND_GW_PING].ts
+              + (garp->gw_check_delay ? garp->gw_check_delay
+                                      : ARP_RETRANS_DELAY));
     return ARPR_OK;
 }
 
 int arp_gw_query_timeout(struct client_state_t cs[static 1], long long nowts)
 {
-    long long rtts = garp.send_stats[ASEND_GW_PING].ts + ARP_RETRANS_DELAY;
+    struct arp_data *garp = &garps[cs->client_idx];
+    long long rtts = garp->send_stats[ASEND_GW_PING].ts + ARP_RETRANS_DELAY;
     if (nowts < rtts) {
-        garp.wake_ts[AS_GW_QUERY] = rtts;
+        timer_set(cs, TMR_ARP + AS_GW_QUERY, rtts);
         return ARPR_OK;
     }
     if (!cs->got_router_arp) {
         log_line("%s: arp: Still looking for gateway hardware address...",
-                 client_config.interface);
+                 client_config->interface);
         if (arp_ping(cs, cs->routerAddr) < 0) {
             log_warning("%s: arp: Failed to send ARP ping in retransmission.",
-                        client_config.interface);
+                        client_config->interface);
             return ARPR_FAIL;
         }
     }
     if (!cs->got_server_arp) {
         log_line("%s: arp: Still looking for DHCP agent hardware address...",
-                 client_config.interface);
+                 client_config->interface);
         if (arp_ping(cs, cs->srcAddr) < 0) {
             log_warning("%s: arp: Failed to send ARP ping in retransmission.",
-                        client_config.interface);
+                        client_config->interface);
             return ARPR_FAIL;
         }
     }
-    garp.wake_ts[AS_GW_QUERY] =
-        garp.send_stats[ASEND_GW_PING].ts + ARP_RETRANS_DELAY;
+    timer_set(cs, TMR_ARP + AS_GW_QUERY,
+              garp->send_stats[ASEND_GW_PING].ts + ARP_RETRANS_DELAY);
     return ARPR_OK;
 }
 
@@ -493,12 +742,16 @@ int arp_gw_query_timeout(struct client_state_t cs[static 1], long long nowts)
 __attribute__((noreturn))
 static void quit_after_lease_handler(struct client_state_t cs[static 1])
 {
+    // ifch exits with us, so make sure it has applied the lease first.
+    if (ifchange_wait(cs) < 0)
+        suicide("%s: Failed to set the interface IP address and properties!",
+                client_config->interface);
     long long init_ts = curms();
     for (;;) {
         if (arp_announcement(cs) >= 0)
             exit(EXIT_SUCCESS);
         log_warning("%s: (%s) Failed to send ARP announcement: %s",
-                    client_config.interface, __func__, strerror(errno));
+                    client_config->interface, __func__, strerror(errno));
         if (curms() - init_ts > (60LL * 1000LL)) break;
     }
     exit(EXIT_FAILURE);
@@ -506,68 +759,75 @@ static void quit_after_lease_handler(struct client_state_t cs[static 1])
 
 int arp_collision_timeout(struct client_state_t cs[static 1], long long nowts)
 {
-    if (nowts >= garp.arp_check_start_ts + ANNOUNCE_WAIT ||
-        garp.send_stats[ASEND_COLLISION_CHECK].count >= arp_probe_num)
+    struct arp_data *garp = &garps[cs->client_idx];
+    if (nowts >= garp->arp_check_start_ts + ANNOUNCE_WAIT ||
+        garp->send_stats[ASEND_COLLISION_CHECK].count >= arp_probe_num)
     {
         char clibuf[INET_ADDRSTRLEN];
-        struct in_addr temp_addr = {.s_addr = garp.dhcp_packet.yiaddr};
+        struct in_addr temp_addr = {.s_addr = garp->dhcp_packet.msg.yiaddr};
         inet_ntop(AF_INET, &temp_addr, clibuf, sizeof clibuf);
         log_line("%s: Lease of %s obtained.  Lease time is %ld seconds.",
-                 client_config.interface, clibuf, cs->lease);
-        cs->clientAddr = garp.dhcp_packet.yiaddr;
+                 client_config->interface, clibuf, cs->lease);
+        cs->clientAddr = garp->dhcp_packet.msg.yiaddr;
         cs->program_init = false;
-        garp.last_conflict_ts = 0;
-        garp.wake_ts[AS_COLLISION_CHECK] = -1;
-        if (ifchange_bind(cs, &garp.dhcp_packet) < 0) {
+        garp->last_conflict_ts = 0;
+        timer_set(cs, TMR_ARP + AS_COLLISION_CHECK, -1);
+        if (!garp->optimistic_bound &&
+            ifchange_bind(cs, &garp->dhcp_packet) < 0) {
             suicide("%s: Failed to set the interface IP address and properties!",
-                    client_config.interface);
+                    client_config->interface);
         }
-        cs->routerAddr = get_option_router(&garp.dhcp_packet);
+        garp->optimistic_bound = false;
+        arp_log_usable(cs);
+        cs->routerAddr = get_option_router(&garp->dhcp_packet.opts);
         stop_dhcp_listen(cs);
         write_leasefile(temp_addr);
-        if (client_config.quit_after_lease)
+        save_lease_record(cs);
+        if (client_config->quit_after_lease)
             quit_after_lease_handler(cs);
         return ARPR_FREE;
     }
-    long long rtts = garp.send_stats[ASEND_COLLISION_CHECK].ts +
-        garp.probe_wait_time;
+    long long rtts = garp->send_stats[ASEND_COLLISION_CHECK].ts +
+        garp->probe_wait_time;
     if (nowts < rtts) {
-        garp.wake_ts[AS_COLLISION_CHECK] = rtts;
+        timer_set(cs, TMR_ARP + AS_COLLISION_CHECK, rtts);
         return ARPR_OK;
     }
-    if (arp_ip_anon_ping(cs, garp.dhcp_packet.yiaddr) < 0) {
+    if (arp_ip_anon_ping(cs, garp->dhcp_packet.msg.yiaddr) < 0) {
         log_warning("%s: arp: Failed to send ARP ping in retransmission.",
-                    client_config.interface);
+                    client_config->interface);
         return ARPR_FAIL;
     }
-    garp.probe_wait_time = arp_gen_probe_wait(cs);
-    garp.wake_ts[AS_COLLISION_CHECK] =
-        garp.send_stats[ASEND_COLLISION_CHECK].ts + garp.probe_wait_time;
+    garp->probe_wait_time = arp_gen_probe_wait(cs);
+    timer_set(cs, TMR_ARP + AS_COLLISION_CHECK,
+              garp->send_stats[ASEND_COLLISION_CHECK].ts
+              + garp->probe_wait_time);
     return ARPR_OK;
 }
 
 int arp_query_gateway(struct client_state_t cs[static 1])
 {
     if (cs->sent_gw_query) {
-        garp.wake_ts[AS_QUERY_GW_SEND] = -1;
+        timer_set(cs, TMR_ARP + AS_QUERY_GW_SEND, -1);
         return ARPR_OK;
     }
     if (arp_get_gw_hwaddr(cs) < 0) {
         log_warning("%s: (%s) Failed to send request to get gateway and agent hardware addresses: %s",
-                    client_config.interface, __func__, strerror(errno));
-        garp.wake_ts[AS_QUERY_GW_SEND] = curms() + ARP_RETRANS_DELAY;
+                    client_config->interface, __func__, strerror(errno));
+        timer_set(cs, TMR_ARP + AS_QUERY_GW_SEND,
+                  curms() + ARP_RETRANS_DELAY);
         return ARPR_FAIL;
     }
     cs->sent_gw_query = true;
     cs->init_fingerprint_inprogress = true;
-    garp.wake_ts[AS_QUERY_GW_SEND] = -1;
+    timer_set(cs, TMR_ARP + AS_QUERY_GW_SEND, -1);
     return ARPR_OK;
 }
 
 // 1 == not yet time, 0 == timed out, success, -1 == timed out, failure
 int arp_query_gateway_timeout(struct client_state_t cs[static 1], long long nowts)
 {
-    long long rtts = garp.wake_ts[AS_QUERY_GW_SEND];
+    long long rtts = timer_get(cs, TMR_ARP + AS_QUERY_GW_SEND);
     if (rtts == -1) return 0;
     if (nowts < rtts) return 1;
     return arp_query_gateway(cs) == ARPR_OK ? 0 : -1;
@@ -576,13 +836,13 @@ int arp_query_gateway_timeout(struct client_state_t cs[static 1], long long nowt
 int arp_announce(struct client_state_t cs[static 1])
 {
     if (cs->sent_first_announce && cs->sent_second_announce) {
-        garp.wake_ts[AS_ANNOUNCE] = -1;
+        timer_set(cs, TMR_ARP + AS_ANNOUNCE, -1);
         return ARPR_OK;
     }
     if (arp_announcement(cs) < 0) {
         log_warning("%s: (%s) Failed to send ARP announcement: %s",
-                    client_config.interface, __func__, strerror(errno));
-        garp.wake_ts[AS_ANNOUNCE] = curms() + ARP_RETRANS_DELAY ;
+                    client_config->interface, __func__, strerror(errno));
+        timer_set(cs, TMR_ARP + AS_ANNOUNCE, curms() + ARP_RETRANS_DELAY);
         return ARPR_FAIL;
     }
     if (!cs->sent_first_announce)
@@ -590,16 +850,16 @@ int arp_announce(struct client_state_t cs[static 1])
     else if (!cs->sent_second_announce)
         cs->sent_second_announce = true;
     if (!cs->sent_first_announce || !cs->sent_second_announce)
-        garp.wake_ts[AS_ANNOUNCE] = curms() + ARP_RETRANS_DELAY;
+        timer_set(cs, TMR_ARP + AS_ANNOUNCE, curms() + ARP_RETRANS_DELAY);
     else
-        garp.wake_ts[AS_ANNOUNCE] = -1;
+        timer_set(cs, TMR_ARP + AS_ANNOUNCE, -1);
     return ARPR_OK;
 }
 
 // 1 == not yet time, 0 == timed out, success, -1 == timed out, failure
 int arp_announce_timeout(struct client_state_t cs[static 1], long long nowts)
 {
-    long long rtts = garp.wake_ts[AS_ANNOUNCE];
+    long long rtts = timer_get(cs, TMR_ARP + AS_ANNOUNCE);
     if (rtts == -1) return 0;
     if (nowts < rtts) return 1;
     return arp_announce(cs) == ARPR_OK ? 0 : -1;
@@ -607,65 +867,68 @@ int arp_announce_timeout(struct client_state_t cs[static 1], long long nowts)
 
 int arp_do_defense(struct client_state_t cs[static 1])
 {
+    struct arp_data *garp = &garps[cs->client_idx];
     // Even though the BPF will usually catch this case, sometimes there are
     // packets still in the socket buffer that arrived before the defense
     // BPF was installed, so it's necessary to check here.
-    if (!arp_validate_bpf_defense(cs, &garp.reply))
+    if (!arp_validate_bpf_defense(cs, &garp->reply))
         return ARPR_OK;
 
-    log_warning("%s: arp: Detected a peer attempting to use our IP!", client_config.interface);
+    log_warning("%s: arp: Detected a peer attempting to use our IP!", client_config->interface);
     long long nowts = curms();
-    garp.wake_ts[AS_DEFENSE] = -1;
-    if (!garp.last_conflict_ts ||
-        nowts - garp.last_conflict_ts < DEFEND_INTERVAL) {
-        log_warning("%s: arp: Defending our lease IP.", client_config.interface);
+    timer_set(cs, TMR_ARP + AS_DEFENSE, -1);
+    if (!garp->last_conflict_ts ||
+        nowts - garp->last_conflict_ts < DEFEND_INTERVAL) {
+        log_warning("%s: arp: Defending our lease IP.", client_config->interface);
         if (arp_announcement(cs) < 0)
             return ARPR_FAIL;
-    } else if (!garp.relentless_def) {
+    } else if (!arp_relentless_def) {
         log_warning("%s: arp: Conflicting peer is persistent.  Requesting new lease.",
-                    client_config.interface);
+                    client_config->interface);
         send_release(cs);
         return ARPR_CONFLICT;
     } else {
-        garp.wake_ts[AS_DEFENSE] =
-            garp.send_stats[ASEND_ANNOUNCE].ts + DEFEND_INTERVAL;
+        timer_set(cs, TMR_ARP + AS_DEFENSE,
+                  garp->send_stats[ASEND_ANNOUNCE].ts + DEFEND_INTERVAL);
     }
-    garp.total_conflicts++;
-    garp.last_conflict_ts = nowts;
+    garp->total_conflicts++;
+    garp->last_conflict_ts = nowts;
     return ARPR_OK;
 }
 
 int arp_do_gw_query(struct client_state_t cs[static 1])
 {
-    if (!arp_is_query_reply(&garp.reply))
+    struct arp_data *garp = &garps[cs->client_idx];
+    if (!arp_is_query_reply(&garp->reply))
         return ARPR_OK;
-    if (!memcmp(garp.reply.sip4, &cs->routerAddr, 4)) {
-        memcpy(cs->routerArp, garp.reply.smac, 6);
+    if (!memcmp(garp->reply.sip4, &cs->routerAddr, 4)) {
+        arp_gw_rtt_sample(garp);
+        memcpy(cs->routerArp, garp->reply.smac, 6);
         log_line("%s: arp: Gateway hardware address %02x:%02x:%02x:%02x:%02x:%02x",
-                 client_config.interface, cs->routerArp[0], cs->routerArp[1],
+                 client_config->interface, cs->routerArp[0], cs->routerArp[1],
                  cs->routerArp[2], cs->routerArp[3],
                  cs->routerArp[4], cs->routerArp[5]);
         cs->got_router_arp = true;
         if (cs->routerAddr == cs->srcAddr)
             goto server_is_router;
         if (cs->got_server_arp) {
-            garp.wake_ts[AS_GW_QUERY] = -1;
+            timer_set(cs, TMR_ARP + AS_GW_QUERY, -1);
             if (arp_open_fd(cs, true) < 0)
                 return ARPR_FAIL;
             return ARPR_FREE;
         }
         return ARPR_OK;
     }
-    if (!memcmp(garp.reply.sip4, &cs->srcAddr, 4)) {
+    if (!memcmp(garp->reply.sip4, &cs->srcAddr, 4)) {
 server_is_router:
-        memcpy(cs->serverArp, garp.reply.smac, 6);
+        memcpy(cs->serverArp, garp->reply.smac, 6);
         log_line("%s: arp: DHCP agent hardware address %02x:%02x:%02x:%02x:%02x:%02x",
-                 client_config.interface, cs->serverArp[0], cs->serverArp[1],
+                 client_config->interface, cs->serverArp[0], cs->serverArp[1],
                  cs->serverArp[2], cs->serverArp[3],
                  cs->serverArp[4], cs->serverArp[5]);
         cs->got_server_arp = true;
         if (cs->got_router_arp) {
-            garp.wake_ts[AS_GW_QUERY] = -1;
+            timer_set(cs, TMR_ARP + AS_GW_QUERY, -1);
             if (arp_open_fd(cs, true) < 0)
                 return ARPR_FAIL;
             return ARPR_FREE;
@@ -675,26 +938,35 @@ server_is_router:
     return ARPR_OK;
 }
 
-int arp_do_collision_check(struct client_state_t cs[static 1])
+// On ARPR_CONFLICT, *declined is the address that was declined.  It is not
+// cs->clientAddr if we were renewing onto a new address.
+int arp_do_collision_check(struct client_state_t cs[static 1],
+                           uint32_t declined[static 1])
 {
-    if (!arp_is_query_reply(&garp.reply))
+    struct arp_data *garp = &garps[cs->client_idx];
+    if (!arp_is_query_reply(&garp->reply))
         return ARPR_OK;
     // If this packet was sent from our lease IP, and does not have a
     // MAC address matching our own (the latter check guards against stupid
     // hubs or repeaters), then it's a conflict and thus a failure.
-    if (!memcmp(garp.reply.sip4, &garp.dhcp_packet.yiaddr, 4) &&
-        !memcmp(client_config.arp, garp.reply.smac, 6))
+    if (!memcmp(garp->reply.sip4, &garp->dhcp_packet.msg.yiaddr, 4) &&
+        memcmp(client_config->arp, garp->reply.smac, 6))
     {
-        garp.total_conflicts++;
-        garp.wake_ts[AS_COLLISION_CHECK] = -1;
+        garp->total_conflicts++;
+        timer_set(cs, TMR_ARP + AS_COLLISION_CHECK, -1);
         log_line("%s: arp: Offered address is in use.  Declining.",
-                 client_config.interface);
-        int r = send_decline(cs, garp.dhcp_packet.yiaddr);
-        if (r < 0) {
+                 client_config->interface);
+        arp_drop_optimistic(cs);
+        int found;
+        uint32_t sid = get_option_serverid(&garp->dhcp_packet.opts, &found);
+        if (!found)
+            sid = cs->serverAddr;
+        // The address is still in use, so a lost DHCPDECLINE must not
+        // keep us from moving on.
+        if (send_decline(cs, garp->dhcp_packet.msg.yiaddr, sid) < 0)
             log_warning("%s: Failed to send a decline notice packet.",
-                        client_config.interface);
-            return ARPR_FAIL;
-        }
+                        client_config->interface);
+        *declined = garp->dhcp_packet.msg.yiaddr;
         return ARPR_CONFLICT;
     }
     return ARPR_OK;
@@ -702,87 +974,123 @@ int arp_do_collision_check(struct client_state_t cs[static 1])
 
 int arp_do_gw_check(struct client_state_t cs[static 1])
 {
-    if (!arp_is_query_reply(&garp.reply))
+    struct arp_data *garp = &garps[cs->client_idx];
+    if (!arp_is_query_reply(&garp->reply))
         return ARPR_OK;
-    if (!memcmp(garp.reply.sip4, &cs->routerAddr, 4)) {
+    if (!memcmp(garp->reply.sip4, &cs->routerAddr, 4)) {
         // Success only if the router/gw MAC matches stored value
-        if (!memcmp(cs->routerArp, garp.reply.smac, 6)) {
-            garp.router_replied = true;
+        if (!memcmp(cs->routerArp, garp->reply.smac, 6)) {
+            arp_gw_rtt_sample(garp);
+            garp->router_replied = true;
             if (cs->routerAddr == cs->srcAddr)
                 goto server_is_router;
-            if (garp.server_replied)
+            if (garp->server_replied)
                 return arp_gw_success(cs); // FREE or FAIL
             return ARPR_OK;
         }
+        if (arp_is_known_gw(cs))
+            return ARPR_KNOWN;
         log_line("%s: arp: Gateway is different.  Getting a new lease.",
-                 client_config.interface);
-        garp.wake_ts[AS_GW_CHECK] = -1;
+                 client_config->interface);
+        timer_set(cs, TMR_ARP + AS_GW_CHECK, -1);
         return ARPR_CONFLICT;
     }
-    if (!memcmp(garp.reply.sip4, &cs->srcAddr, 4)) {
+    if (!memcmp(garp->reply.sip4, &cs->srcAddr, 4)) {
 server_is_router:
         // Success only if the server MAC matches stored value
-        if (!memcmp(cs->serverArp, garp.reply.smac, 6)) {
-            garp.server_replied = true;
-            if (garp.router_replied)
+        if (!memcmp(cs->serverArp, garp->reply.smac, 6)) {
+            garp->server_replied = true;
+            if (garp->router_replied)
                 return arp_gw_success(cs); // FREE or FAIL
             return ARPR_OK;
         }
+        if (arp_is_known_gw(cs))
+            return ARPR_KNOWN;
         log_line("%s: arp: DHCP agent is different.  Getting a new lease.",
-                 client_config.interface);
-        garp.wake_ts[AS_GW_CHECK] = -1;
+                 client_config->interface);
+        timer_set(cs, TMR_ARP + AS_GW_CHECK, -1);
         return ARPR_CONFLICT;
     }
-    return ARPR_OK;
+    return arp_is_known_gw(cs) ? ARPR_KNOWN : ARPR_OK;
 }
 
+// Returns true if an equivalent frame is already waiting in arp_rq[].
+static bool arp_rq_has(struct arpMsg am[static 1])
+{
+    for (size_t i = arp_rq_pos; i < arp_rq_len; ++i) {
+        struct arpMsg *q = &arp_rq[i];
+        if (q->operation == am->operation &&
+            !memcmp(q->smac, am->smac, 6) &&
+            !memcmp(q->sip4, am->sip4, 4) &&
+            !memcmp(q->dip4, am->dip4, 4))
+            return true;
+    }
+    return false;
+}
+
+// Drains up to ARP_RECV_BATCH frames from the ARP socket with a single
+// recvmmsg().  Frames that repeat the opcode, sender and addresses of a
+// frame that is already queued are coalesced, so that a flood from one
+// peer is seen by the state machine once per wakeup rather than once per
+// frame.  Returns true if any frames were queued for arp_packet_next().
 bool arp_packet_get(struct client_state_t cs[static 1])
 {
-    struct arpMsg amsg;
-    ssize_t r = 0;
-    size_t bytes_read = 0;
-    if (bytes_read < sizeof amsg) {
-        r = safe_read(cs->arpFd, (char *)&amsg + bytes_read,
-                      sizeof amsg - bytes_read);
-        if (r == 0)
-            return false;
-        if (r < 0) {
-            log_error("%s: (%s) ARP response read failed: %s",
-                      client_config.interface, __func__, strerror(errno));
-            // Timeouts will trigger anyway without being forced.
-            arp_min_close_fd(cs);
-            if (arp_open_fd(cs, cs->arp_is_defense) < 0)
-                suicide("%s: (%s) Failed to reopen ARP fd: %s",
-                        client_config.interface, __func__, strerror(errno));
-            return false;
-        }
-        bytes_read += (size_t)r;
+    struct arp_data *garp = &garps[cs->client_idx];
+    static struct arpMsg rbuf[ARP_RECV_BATCH];
+    struct iovec iov[ARP_RECV_BATCH];
+    struct mmsghdr msgs[ARP_RECV_BATCH];
+    for (size_t i = 0; i < ARP_RECV_BATCH; ++i) {
+        iov[i] = (struct iovec){ .iov_base = &rbuf[i],
+                                 .iov_len = sizeof rbuf[i] };
+        msgs[i] = (struct mmsghdr){ .msg_hdr = { .msg_iov = &iov[i],
+                                                 .msg_iovlen = 1 } };
     }
+    arp_rq_idx = cs->client_idx;
+    arp_rq_len = arp_rq_pos = 0;
 
-    if (bytes_read < ARP_MSG_SIZE)
+    int r;
+    do {
+        r = recvmmsg(cs->arpFd, msgs, ARP_RECV_BATCH, MSG_DONTWAIT, NULL);
+    } while (r < 0 && errno == EINTR);
+    if (r < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return false;
+        log_error("%s: (%s) ARP response read failed: %s",
+                  client_config->interface, __func__, strerror(errno));
+        // Timeouts will trigger anyway without being forced.
+        arp_min_close_fd(cs);
+        if (arp_open_fd(cs, cs->arp_is_defense) < 0)
+            suicide("%s: (%s) Failed to reopen ARP fd: %s",
+                    client_config->interface, __func__, strerror(errno));
         return false;
+    }
 
-    // Emulate the BPF filters if they are not in use.
-    if (!garp.using_bpf &&
-        (!arp_validate_bpf(&amsg) ||
-         (cs->arp_is_defense &&
-          !arp_validate_bpf_defense(cs, &amsg)))) {
-        return false;
+    for (int i = 0; i < r; ++i) {
+        struct arpMsg *am = &rbuf[i];
+        if (msgs[i].msg_len < ARP_MSG_SIZE)
+            continue;
+        // Emulate the BPF filters if they are not in use.
+        if (!garp->using_bpf &&
+            (!arp_validate_bpf(am) ||
+             (cs->arp_is_defense ? !arp_validate_bpf_defense(cs, am)
+                                 : !arp_validate_bpf_basic(cs, am))))
+            continue;
+        if (arp_rq_has(am))
+            continue;
+        memcpy(&arp_rq[arp_rq_len++], am, sizeof *am);
     }
-    memcpy(&garp.reply, &amsg, sizeof garp.reply);
-    return true;
+    return arp_rq_len > 0;
 }
 
-// XXX: Move into client_state
-long long arp_get_wake_ts(void)
+// Moves the next frame queued by arp_packet_get() into garp->reply.
+// Returns false when none remain, or when the ARP socket that the frames
+// were read from has since been closed.
+bool arp_packet_next(struct client_state_t cs[static 1])
 {
-    long long mt = -1;
-    for (int i = 0; i < AS_MAX; ++i) {
-        if (garp.wake_ts[i] < 0)
-            continue;
-        if (mt < 0 || mt > garp.wake_ts[i])
-            mt = garp.wake_ts[i];
-    }
-    return mt;
+    struct arp_data *garp = &garps[cs->client_idx];
+    if (arp_rq_idx != cs->client_idx || arp_rq_pos >= arp_rq_len)
+        return false;
+    memcpy(&garp->reply, &arp_rq[arp_rq_pos++], sizeof garp->reply);
+    return true;
 }
 
@@ -33,6 +33,7 @@
 #include <net/if_arp.h>
 #include "ndhc.h"
 #include "dhcp.h"
+#include "leasefile.h"
 
 struct arpMsg {
     // Ethernet header
@@ -84,37 +85,58 @@ struct arp_stats {
 };
 
 struct arp_data {
-    struct dhcpmsg dhcp_packet;   // Used only for AS_COLLISION_CHECK
+    struct dhcp_rx dhcp_packet;   // Used only for AS_COLLISION_CHECK
     struct arpMsg reply;
     struct arp_stats send_stats[ASEND_MAX];
-    long long wake_ts[AS_MAX];
     long long last_conflict_ts;   // TS of the last conflicting ARP seen.
     long long arp_check_start_ts; // TS of when we started the
                                   // AS_COLLISION_CHECK state.
     unsigned int total_conflicts; // Total number of address conflicts on
                                   // the interface.  Never decreases.
+    unsigned int optimistic_binds; // Addresses configured before their
+                                  // AS_COLLISION_CHECK finished.
+    unsigned int optimistic_drops; // Of those, how many were removed again.
     int gw_check_initpings;       // Initial count of ASEND_GW_PING when
                                   // AS_GW_CHECK was entered.
+    uint32_t basic_ip[2];         // Addresses in the basic socket's BPF.
+    struct lease_record gw_known[LEASE_CACHE_MAX]; // Other networks that
+                                  // AS_GW_CHECK looks for.
+    size_t gw_known_count;
+    size_t gw_known_match;        // Index of the network that answered.
+    int gw_rtt;                   // Smoothed gateway ARP round trip in ms,
+                                  // or 0 if it has not been measured.
+    int gw_check_delay;           // Retry delay of a fast AS_GW_CHECK in ms,
+                                  // or 0 for the normal schedule.
     uint16_t probe_wait_time;     // Time to wait for a COLLISION_CHECK reply
                                   // (in ms?).
     bool using_bpf:1;             // Is a BPF installed on the ARP socket?
-    bool relentless_def:1;        // Don't give up defense no matter what.
     bool router_replied:1;
     bool server_replied:1;
+    bool optimistic_bound:1;      // Address configured before the
+                                  // AS_COLLISION_CHECK finished.
 };
 
 void arp_reset_state(struct client_state_t cs[static 1]);
+void arp_drop_optimistic(struct client_state_t cs[static 1]);
 
 bool arp_packet_get(struct client_state_t cs[static 1]);
+bool arp_packet_next(struct client_state_t cs[static 1]);
 
 void set_arp_relentless_def(bool v);
+void set_arp_optimistic(bool v);
 int arp_check(struct client_state_t cs[static 1],
-              struct dhcpmsg packet[static 1]);
-int arp_gw_check(struct client_state_t cs[static 1]);
+              struct dhcp_rx packet[static 1]);
+int arp_gw_check(struct client_state_t cs[static 1],
+                 const struct lease_record known[], size_t known_count,
+                 bool fast);
+void arp_gw_check_cancel(struct client_state_t cs[static 1]);
+bool arp_gw_known_pending(struct client_state_t cs[static 1]);
+const struct lease_record *arp_gw_known(struct client_state_t cs[static 1]);
 int arp_set_defense_mode(struct client_state_t cs[static 1]);
 int arp_gw_failed(struct client_state_t cs[static 1]);
 
-int arp_do_collision_check(struct client_state_t cs[static 1]);
+int arp_do_collision_check(struct client_state_t cs[static 1],
+                           uint32_t declined[static 1]);
 int arp_collision_timeout(struct client_state_t cs[static 1], long long nowts);
 
 int arp_query_gateway(struct client_state_t cs[static 1]);
@@ -138,8 +160,7 @@ int arp_gw_check_timeout(struct client_state_t cs[static 1], long long nowts);
 #define ARPR_CONFLICT -1
 // The operation couldn't complete because of an error such as rfkill.
 #define ARPR_FAIL -2
-
-
-long long arp_get_wake_ts(void);
+// We are on another network whose lease is returned by arp_gw_known().
+#define ARPR_KNOWN 2
 
 #endif /* ARP_H_ */
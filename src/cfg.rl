@@ -11,6 +11,8 @@
 #include "ndhc.h"
 #include "ifchd.h"
 #include "sockd.h"
+#include "retrans.h"
+#include "state.h"
 #include "nk/log.h"
 #include "nk/privilege.h"
 #include "nk/copy_cmdarg.h"
@@ -49,11 +51,11 @@ struct cfgparse {
     action background {
         switch (ccfg.ternary) {
         case 1:
-            client_config.background_if_no_lease = true;
+            client_config->background_if_no_lease = true;
             gflags_detach = 1;
             break;
         case -1:
-            client_config.background_if_no_lease = false;
+            client_config->background_if_no_lease = false;
             gflags_detach = 0;
         default:
             break;
@@ -64,29 +66,30 @@ struct cfgparse {
         copy_cmdarg(pidfile, ccfg.buf, sizeof pidfile, "pidfile");
     }
     action hostname {
-        copy_cmdarg(client_config.hostname, ccfg.buf,
-                    sizeof client_config.hostname, "hostname");
+        copy_cmdarg(client_config->hostname, ccfg.buf,
+                    sizeof client_config->hostname, "hostname");
     }
     action interface {
-        copy_cmdarg(client_config.interface, ccfg.buf,
-                    sizeof client_config.interface, "interface");
+        new_client_config();
+        copy_cmdarg(client_config->interface, ccfg.buf,
+                    sizeof client_config->interface, "interface");
     }
     action now {
         switch (ccfg.ternary) {
-        case 1: client_config.abort_if_no_lease = true; break;
-        case -1: client_config.abort_if_no_lease = false; default: break;
+        case 1: client_config->abort_if_no_lease = true; break;
+        case -1: client_config->abort_if_no_lease = false; default: break;
         }
     }
     action quit {
         switch (ccfg.ternary) {
-        case 1: client_config.quit_after_lease = true; break;
-        case -1: client_config.quit_after_lease = false; default: break;
+        case 1: client_config->quit_after_lease = true; break;
+        case -1: client_config->quit_after_lease = false; default: break;
         }
     }
     action request { set_client_addr(ccfg.buf); }
     action vendorid {
-        copy_cmdarg(client_config.vendor, ccfg.buf,
-                    sizeof client_config.vendor, "vendorid");
+        copy_cmdarg(client_config->vendor, ccfg.buf,
+                    sizeof client_config->vendor, "vendorid");
     }
     action user {
         if (nk_uidgidbyname(ccfg.buf, &ndhc_uid, &ndhc_gid))
@@ -116,6 +119,18 @@ struct cfgparse {
         case -1: set_arp_relentless_def(false); default: break;
         }
     }
+    action optimistic {
+        switch (ccfg.ternary) {
+        case 1: set_arp_optimistic(true); break;
+        case -1: set_arp_optimistic(false); default: break;
+        }
+    }
+    action fast_revalidate {
+        switch (ccfg.ternary) {
+        case 1: set_fast_revalidate(true); break;
+        case -1: set_fast_revalidate(false); default: break;
+        }
+    }
     action arp_probe_wait {
         int t = atoi(ccfg.buf);
         if (t >= 0)
@@ -153,7 +168,7 @@ struct cfgparse {
             suicide("gw-metric arg '%s' is too large", ccfg.buf);
         if (mt < 0)
             mt = 0;
-        client_config.metric = (int)mt;
+        client_config->metric = (int)mt;
     }
     action resolv_conf {
         copy_cmdarg(resolv_conf_d, ccfg.buf, sizeof resolv_conf_d,
@@ -165,10 +180,15 @@ struct cfgparse {
         case -1: allow_hostname = 0; default: break;
         }
     }
+    action retrans_profile { set_retrans_profile(ccfg.buf); }
+    action retrans_selecting { set_retrans_policy(RT_SELECTING, ccfg.buf); }
+    action retrans_requesting { set_retrans_policy(RT_REQUESTING, ccfg.buf); }
+    action retrans_renewing { set_retrans_policy(RT_RENEWING, ccfg.buf); }
+    action retrans_rebinding { set_retrans_policy(RT_REBINDING, ccfg.buf); }
     action rfkill_idx {
         uint32_t t = (uint32_t)atoi(ccfg.buf);
-        client_config.rfkillIdx = t;
-        client_config.enable_rfkill = true;
+        client_config->rfkillIdx = t;
+        client_config->enable_rfkill = true;
     }
     action version { print_version(); exit(EXIT_SUCCESS); }
     action help { show_usage(); exit(EXIT_SUCCESS); }
@@ -206,6 +226,8 @@ struct cfgparse {
     state_dir = 'state-dir' value @state_dir;
     seccomp_enforce = 'seccomp-enforce' boolval @seccomp_enforce;
     relentless_defense = 'relentless-defense' boolval @relentless_defense;
+    optimistic = 'optimistic' boolval @optimistic;
+    fast_revalidate = 'fast-revalidate' boolval @fast_revalidate;
     arp_probe_wait = 'arp-probe-wait' value @arp_probe_wait;
     arp_probe_num = 'arp-probe-num' value @arp_probe_num;
     arp_probe_min = 'arp-probe-min' value @arp_probe_min;
@@ -214,13 +236,21 @@ struct cfgparse {
     resolv_conf = 'resolv-conf' value @resolv_conf;
     dhcp_set_hostname = 'dhcp-set-hostname' boolval @dhcp_set_hostname;
     rfkill_idx = 'rfkill-idx' value @rfkill_idx;
+    retrans_profile = 'retrans-profile' value @retrans_profile;
+    retrans_selecting = 'retrans-selecting' value @retrans_selecting;
+    retrans_requesting = 'retrans-requesting' value @retrans_requesting;
+    retrans_renewing = 'retrans-renewing' value @retrans_renewing;
+    retrans_rebinding = 'retrans-rebinding' value @retrans_rebinding;
 
     main := blankline |
         clientid | background | pidfile | hostname | interface | now | quit |
         request | vendorid | user | ifch_user | sockd_user | chroot |
-        state_dir | seccomp_enforce | relentless_defense | arp_probe_wait |
-        arp_probe_num | arp_probe_min | arp_probe_max | gw_metric |
-        resolv_conf | dhcp_set_hostname | rfkill_idx
+        state_dir | seccomp_enforce | relentless_defense | optimistic |
+        fast_revalidate | arp_probe_wait | arp_probe_num | arp_probe_min |
+        arp_probe_max |
+        gw_metric | resolv_conf | dhcp_set_hostname | rfkill_idx |
+        retrans_profile | retrans_selecting | retrans_requesting |
+        retrans_renewing | retrans_rebinding
     ;
 }%%
 
@@ -311,6 +341,8 @@ static void parse_cfgfile(const char fname[static 1])
     state_dir = ('-s'|'--state-dir') argval @state_dir;
     seccomp_enforce = ('-S'|'--seccomp-enforce') tbv @seccomp_enforce;
     relentless_defense = ('-d'|'--relentless-defense') tbv @relentless_defense;
+    optimistic = ('-o'|'--optimistic') tbv @optimistic;
+    fast_revalidate = '--fast-revalidate' tbv @fast_revalidate;
     arp_probe_wait = ('-w'|'--arp-probe-wait') argval @arp_probe_wait;
     arp_probe_num = ('-W'|'--arp-probe-num') argval @arp_probe_num;
     arp_probe_min = ('-m'|'--arp-probe-min') argval @arp_probe_min;
@@ -319,6 +351,11 @@ static void parse_cfgfile(const char fname[static 1])
     resolv_conf = ('-R'|'--resolv-conf') argval @resolv_conf;
     dhcp_set_hostname = ('-H'|'--dhcp-set-hostname') tbv @dhcp_set_hostname;
     rfkill_idx = ('-K'|'--rfkill-idx') argval @rfkill_idx;
+    retrans_profile = '--retrans-profile' argval @retrans_profile;
+    retrans_selecting = '--retrans-selecting' argval @retrans_selecting;
+    retrans_requesting = '--retrans-requesting' argval @retrans_requesting;
+    retrans_renewing = '--retrans-renewing' argval @retrans_renewing;
+    retrans_rebinding = '--retrans-rebinding' argval @retrans_rebinding;
     version = ('-v'|'--version') 0 @version;
     help = ('-?'|'--help') 0 @help;
 
@@ -326,9 +363,11 @@ static void parse_cfgfile(const char fname[static 1])
         cfgfile | clientid | background | pidfile | hostname | interface |
         now | quit | request | vendorid | user | ifch_user | sockd_user |
         chroot | state_dir | seccomp_enforce | relentless_defense |
-        arp_probe_wait | arp_probe_num | arp_probe_min | arp_probe_max |
+        optimistic | fast_revalidate | arp_probe_wait | arp_probe_num |
+        arp_probe_min | arp_probe_max |
         gw_metric | resolv_conf | dhcp_set_hostname | rfkill_idx |
-        version | help
+        retrans_profile | retrans_selecting | retrans_requesting |
+        retrans_renewing | retrans_rebinding | version | help
     )*;
 }%%
 
@@ -50,84 +50,137 @@
 #include "options.h"
 #include "sockd.h"
 
+static void close_udp_unicast_socket(struct client_state_t cs[static 1])
+{
+    if (cs->unicastFd >= 0) {
+        epoll_del(cs->epollFd, cs->unicastFd);
+        close(cs->unicastFd);
+        cs->unicastFd = -1;
+    }
+}
+
+static void close_raw_broadcast_socket(struct client_state_t cs[static 1])
+{
+    if (cs->bcastFd >= 0) {
+        close(cs->bcastFd);
+        cs->bcastFd = -1;
+    }
+}
+
+// The transmit sockets are kept open until the link, our address, or the
+// server address changes, or a send on them fails.
+void close_dhcp_xmit(struct client_state_t cs[static 1])
+{
+    close_udp_unicast_socket(cs);
+    close_raw_broadcast_socket(cs);
+}
+
+// Returns a UDP socket that is bound to our address and connected to the
+// DHCP server.  Unicast replies to the requests sent on it are read from
+// it as well, so it is watched by epoll for as long as it is open.
 static int get_udp_unicast_socket(struct client_state_t cs[static 1])
 {
+    if (cs->unicastFd >= 0 && cs->unicastAddr == cs->clientAddr &&
+        cs->unicastServerAddr == cs->serverAddr)
+        return cs->unicastFd;
+    close_udp_unicast_socket(cs);
+
     char buf[32];
     buf[0] = 'u';
     memcpy(buf + 1, &cs->clientAddr, sizeof cs->clientAddr);
-    return request_sockd_fd(buf, 1 + sizeof cs->clientAddr, NULL);
+    int fd = request_sockd_fd(buf, 1 + sizeof cs->clientAddr, NULL);
+    if (fd < 0)
+        return -1;
+
+    struct sockaddr_in raddr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(DHCP_SERVER_PORT),
+        .sin_addr.s_addr = cs->serverAddr,
+    };
+    if (connect(fd, (struct sockaddr *)&raddr, sizeof(struct sockaddr)) < 0) {
+        log_error("%s: (%s) connect failed: %s", client_config->interface,
+                  __func__, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    cs->unicastFd = fd;
+    epoll_add_tag(cs->epollFd, fd, (uint32_t)cs->client_idx);
+    cs->unicastAddr = cs->clientAddr;
+    cs->unicastServerAddr = cs->serverAddr;
+    return fd;
 }
 
-static int get_raw_broadcast_socket(void)
+static int get_raw_broadcast_socket(struct client_state_t cs[static 1])
 {
-    return request_sockd_fd("s", 1, NULL);
+    if (cs->bcastFd < 0)
+        cs->bcastFd = request_sockd_fd("s", 1, NULL);
+    return cs->bcastFd;
 }
 
+// The sockd filter on this socket has the xid and chaddr built in.
 static int get_raw_listen_socket(struct client_state_t cs[static 1])
 {
+    char buf[32];
     char resp;
-    int fd = request_sockd_fd("L", 1, &resp);
+    buf[0] = 'L';
+    memcpy(buf + 1, &cs->xid, sizeof cs->xid);
+    memcpy(buf + 1 + sizeof cs->xid, client_config->arp, 6);
+    int fd = request_sockd_fd(buf, 1 + sizeof cs->xid + 6, &resp);
     switch (resp) {
     case 'L': cs->using_dhcp_bpf = true; break;
     case 'l': cs->using_dhcp_bpf = false; break;
     default: suicide("%s: (%s) expected l or L sockd reply but got %c",
-                     client_config.interface, __func__, resp);
+                     client_config->interface, __func__, resp);
     }
     return fd;
 }
 
-// Unicast a DHCP message using a UDP socket.
-static ssize_t send_dhcp_unicast(struct client_state_t cs[static 1],
-                                 struct dhcpmsg payload[static 1])
+// Write a DHCP message of a known length to the server's UDP socket.
+static ssize_t xmit_dhcp_unicast(struct client_state_t cs[static 1],
+                                 const struct dhcpmsg payload[static 1],
+                                 size_t payload_len)
 {
     ssize_t ret = -1;
     int fd = get_udp_unicast_socket(cs);
     if (fd < 0) {
         log_error("%s: (%s) get_udp_unicast_socket failed",
-                  client_config.interface, __func__);
-        goto out;
+                  client_config->interface, __func__);
+        return ret;
     }
-
-    struct sockaddr_in raddr = {
-        .sin_family = AF_INET,
-        .sin_port = htons(DHCP_SERVER_PORT),
-        .sin_addr.s_addr = cs->serverAddr,
-    };
-    if (connect(fd, (struct sockaddr *)&raddr, sizeof(struct sockaddr)) < 0) {
-        log_error("%s: (%s) connect failed: %s", client_config.interface,
-                  __func__, strerror(errno));
-        goto out_fd;
+    if (!carrier_isup(cs)) {
+        log_error("%s: (%s) carrier down; write would fail",
+                  client_config->interface, __func__);
+        return -99;
     }
+    ret = safe_write(fd, (const char *)payload, payload_len);
+    if (ret < 0 || (size_t)ret != payload_len) {
+        log_error("%s: (%s) write failed: %d", client_config->interface,
+                  __func__, ret);
+        close_udp_unicast_socket(cs);
+    }
+    return ret;
+}
 
+// Unicast a DHCP message using a UDP socket.
+static ssize_t send_dhcp_unicast(struct client_state_t cs[static 1],
+                                 struct dhcpmsg payload[static 1])
+{
     // Send packets that are as short as possible.
     ssize_t endloc = get_end_option_idx(payload);
     if (endloc < 0) {
         log_error("%s: (%s) No end marker.  Not sending.",
-                  client_config.interface, __func__);
-        goto out_fd;
+                  client_config->interface, __func__);
+        return -1;
     }
     const size_t el = (size_t)endloc + 1;
     if (el > sizeof payload->options) {
         log_error("%s: (%s) Invalid value of endloc.  Not sending.",
-                  client_config.interface, __func__);
-        goto out_fd;
+                  client_config->interface, __func__);
+        return -1;
     }
     size_t payload_len =
         sizeof *payload - (sizeof payload->options - el);
-    if (!carrier_isup()) {
-        log_error("%s: (%s) carrier down; write would fail",
-                  client_config.interface, __func__);
-        ret = -99;
-        goto out_fd;
-    }
-    ret = safe_write(fd, (const char *)payload, payload_len);
-    if (ret < 0 || (size_t)ret != payload_len)
-        log_error("%s: (%s) write failed: %d", client_config.interface,
-                  __func__, ret);
-  out_fd:
-    close(fd);
-  out:
-    return ret;
+    return xmit_dhcp_unicast(cs, payload, payload_len);
 }
 
 // Returns 1 if IP checksum is correct, otherwise 0.
@@ -157,28 +210,28 @@ static int udp_checksum(struct ip_udp_dhcp_packet packet[static 1])
 static int get_raw_packet_validate_bpf(struct ip_udp_dhcp_packet packet[static 1])
 {
     if (packet->ip.version != IPVERSION) {
-        log_warning("%s: IP version is not IPv4.", client_config.interface);
+        log_warning("%s: IP version is not IPv4.", client_config->interface);
         return 0;
     }
     if (packet->ip.ihl != sizeof packet->ip >> 2) {
         log_warning("%s: IP header length incorrect.",
-                    client_config.interface);
+                    client_config->interface);
         return 0;
     }
     if (packet->ip.protocol != IPPROTO_UDP) {
         log_warning("%s: IP header is not UDP: %d",
-                    client_config.interface, packet->ip.protocol);
+                    client_config->interface, packet->ip.protocol);
         return 0;
     }
     if (ntohs(packet->udp.dest) != DHCP_CLIENT_PORT) {
         log_warning("%s: UDP destination port incorrect: %d",
-                    client_config.interface, ntohs(packet->udp.dest));
+                    client_config->interface, ntohs(packet->udp.dest));
         return 0;
     }
     if (ntohs(packet->udp.len) !=
         ntohs(packet->ip.tot_len) - sizeof packet->ip) {
         log_warning("%s: UDP header length incorrect.",
-                    client_config.interface);
+                    client_config->interface);
         return 0;
     }
     return 1;
@@ -197,7 +250,7 @@ static ssize_t get_raw_packet(struct client_state_t cs[static 1],
     if (inc < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK)
             return -2;
-        log_warning("%s: (%s) read error %s", client_config.interface,
+        log_warning("%s: (%s) read error %s", client_config->interface,
                     __func__, strerror(errno));
         return -1;
     }
@@ -209,7 +262,7 @@ static ssize_t get_raw_packet(struct client_state_t cs[static 1],
 
     if (!ip_checksum(&packet)) {
         log_error("%s: IP header checksum incorrect.",
-                  client_config.interface);
+                  client_config->interface);
         return -2;
     }
     if (iphdrlen <= sizeof packet.ip + sizeof packet.udp) {
@@ -224,7 +277,7 @@ static ssize_t get_raw_packet(struct client_state_t cs[static 1],
     }
     if (packet.udp.check && !udp_checksum(&packet)) {
         log_error("%s: Packet with bad UDP checksum received.  Ignoring.",
-                  client_config.interface);
+                  client_config->interface);
         return -2;
     }
     if (srcaddr)
@@ -233,31 +286,62 @@ static ssize_t get_raw_packet(struct client_state_t cs[static 1],
     return (ssize_t)l;
 }
 
-// Broadcast a DHCP message using a raw socket.
-static ssize_t send_dhcp_raw(struct dhcpmsg payload[static 1])
+// Broadcast a fully built and checksummed DHCP message using a raw socket.
+static ssize_t xmit_dhcp_raw(struct client_state_t cs[static 1],
+                             const struct ip_udp_dhcp_packet iud[static 1],
+                             size_t iud_len)
 {
     ssize_t ret = -1;
-    int fd = get_raw_broadcast_socket();
+    int fd = get_raw_broadcast_socket(cs);
     if (fd < 0) {
         log_error("%s: (%s) get_raw_broadcast_socket failed",
-                  client_config.interface, __func__);
+                  client_config->interface, __func__);
         return ret;
     }
 
+    struct sockaddr_ll da = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(ETH_P_IP),
+        .sll_pkttype = PACKET_BROADCAST,
+        .sll_ifindex = client_config->ifindex,
+        .sll_halen = 6,
+    };
+    memcpy(da.sll_addr, "\xff\xff\xff\xff\xff\xff", 6);
+    if (!carrier_isup(cs)) {
+        log_error("%s: (%s) carrier down; sendto would fail",
+                  client_config->interface, __func__);
+        return -99;
+    }
+    ret = safe_sendto(fd, (const char *)iud, iud_len, 0,
+                      (struct sockaddr *)&da, sizeof da);
+    if (ret < 0 || (size_t)ret != iud_len) {
+        if (ret < 0)
+            log_error("%s: (%s) sendto failed: %s", client_config->interface,
+                      __func__, strerror(errno));
+        else
+            log_error("%s: (%s) sendto short write: %zd < %zu",
+                      client_config->interface, __func__, ret, iud_len);
+        close_raw_broadcast_socket(cs);
+    }
+    return ret;
+}
+
+// Broadcast a DHCP message using a raw socket.
+static ssize_t send_dhcp_raw(struct client_state_t cs[static 1],
+                             struct dhcpmsg payload[static 1])
+{
     // Send packets that are as short as possible.
     ssize_t endloc = get_end_option_idx(payload);
     if (endloc < 0) {
         log_error("%s: (%s) No end marker.  Not sending.",
-                  client_config.interface, __func__);
-        close(fd);
-        return ret;
+                  client_config->interface, __func__);
+        return -1;
     }
     const size_t el = (size_t)endloc + 1;
     if (el > sizeof payload->options) {
         log_error("%s: (%s) Invalid value of endloc.  Not sending.",
-                  client_config.interface, __func__);
-        close(fd);
-        return ret;
+                  client_config->interface, __func__);
+        return -1;
     }
     size_t padding = sizeof payload->options - el;
     size_t iud_len = sizeof(struct ip_udp_dhcp_packet) - padding;
@@ -289,45 +373,31 @@ static ssize_t send_dhcp_raw(struct dhcpmsg payload[static 1])
     uint16_t phcs = net_checksum161c(&ph, sizeof ph);
     iudmsg.udp.check = net_checksum161c_add(udpcs, phcs);
     iudmsg.ip.check = net_checksum161c(&iudmsg.ip, sizeof iudmsg.ip);
-
-    struct sockaddr_ll da = {
-        .sll_family = AF_PACKET,
-        .sll_protocol = htons(ETH_P_IP),
-        .sll_pkttype = PACKET_BROADCAST,
-        .sll_ifindex = client_config.ifindex,
-        .sll_halen = 6,
-    };
-    memcpy(da.sll_addr, "\xff\xff\xff\xff\xff\xff", 6);
-    if (!carrier_isup()) {
-        log_error("%s: (%s) carrier down; sendto would fail",
-                  client_config.interface, __func__);
-        ret = -99;
-        goto carrier_down;
-    }
-    ret = safe_sendto(fd, (const char *)&iudmsg, iud_len, 0,
-                      (struct sockaddr *)&da, sizeof da);
-    if (ret < 0 || (size_t)ret != iud_len) {
-        if (ret < 0)
-            log_error("%s: (%s) sendto failed: %s", client_config.interface,
-                      __func__, strerror(errno));
-        else
-            log_error("%s: (%s) sendto short write: %z < %zu",
-                      client_config.interface, __func__, ret, iud_len);
-    }
-carrier_down:
-    close(fd);
-    return ret;
+    return xmit_dhcp_raw(cs, &iudmsg, iud_len);
 }
 
 void start_dhcp_listen(struct client_state_t cs[static 1])
 {
-    if (cs->listenFd >= 0)
-        return;
+    if (cs->listenFd >= 0) {
+        if (cs->listenXid == cs->xid)
+            return;
+        // The socket filter is locked, so a new xid needs a new socket.
+        stop_dhcp_listen(cs);
+    }
     cs->listenFd = get_raw_listen_socket(cs);
     if (cs->listenFd < 0)
         suicide("%s: FATAL: Couldn't listen on socket: %s",
-                client_config.interface, strerror(errno));
-    epoll_add(cs->epollFd, cs->listenFd);
+                client_config->interface, strerror(errno));
+    cs->listenXid = cs->xid;
+    epoll_add_tag(cs->epollFd, cs->listenFd, (uint32_t)cs->client_idx);
+}
+
+// Called before sending a request that expects a reply so that the listen
+// filter matches the xid the reply will carry.
+static void sync_dhcp_listen(struct client_state_t cs[static 1])
+{
+    if (cs->listenFd >= 0 && cs->listenXid != cs->xid)
+        start_dhcp_listen(cs);
 }
 
 void stop_dhcp_listen(struct client_state_t cs[static 1])
@@ -340,71 +410,75 @@ void stop_dhcp_listen(struct client_state_t cs[static 1])
 }
 
 static int validate_dhcp_packet(struct client_state_t cs[static 1],
-                                size_t len, struct dhcpmsg packet[static 1],
+                                size_t len, struct dhcp_rx packet[static 1],
                                 uint8_t msgtype[static 1])
 {
     if (len < offsetof(struct dhcpmsg, options)) {
         log_warning("%s: Packet is too short to contain magic cookie.  Ignoring.",
-                    client_config.interface);
+                    client_config->interface);
         return 0;
     }
-    if (ntohl(packet->cookie) != DHCP_MAGIC) {
+    if (ntohl(packet->msg.cookie) != DHCP_MAGIC) {
         log_warning("%s: Packet with bad magic number. Ignoring.",
-                    client_config.interface);
+                    client_config->interface);
         return 0;
     }
-    if (packet->xid != cs->xid) {
+    if (packet->msg.xid != cs->xid) {
         log_warning("%s: Packet XID %lx does not equal our XID %lx.  Ignoring.",
-                    client_config.interface, packet->xid, cs->xid);
+                    client_config->interface, packet->msg.xid, cs->xid);
         return 0;
     }
-    if (memcmp(packet->chaddr, client_config.arp, sizeof client_config.arp)) {
+    if (memcmp(packet->msg.chaddr, client_config->arp,
+               sizeof client_config->arp)) {
         log_warning("%s: Packet client MAC %2.2x:%2.2x:%2.2x:%2.2x:%2.2x:%2.2x does not equal our MAC %2.2x:%2.2x:%2.2x:%2.2x:%2.2x:%2.2x.  Ignoring it.",
-                    client_config.interface,
-                    packet->chaddr[0], packet->chaddr[1], packet->chaddr[2],
-                    packet->chaddr[3], packet->chaddr[4], packet->chaddr[5],
-                    client_config.arp[0], client_config.arp[1],
-                    client_config.arp[2], client_config.arp[3],
-                    client_config.arp[4], client_config.arp[5]);
+                    client_config->interface,
+                    packet->msg.chaddr[0], packet->msg.chaddr[1],
+                    packet->msg.chaddr[2], packet->msg.chaddr[3],
+                    packet->msg.chaddr[4], packet->msg.chaddr[5],
+                    client_config->arp[0], client_config->arp[1],
+                    client_config->arp[2], client_config->arp[3],
+                    client_config->arp[4], client_config->arp[5]);
         return 0;
     }
-    ssize_t endloc = get_end_option_idx(packet);
-    if (endloc < 0) {
-        log_warning("%s: Packet does not have an end option.  Ignoring.");
+    // The options are only indexed once the packet is known to be ours.
+    if (!index_dhcp_opts(&packet->opts, &packet->msg)) {
+        log_warning("%s: Packet does not have an end option.  Ignoring.",
+                    client_config->interface);
         return 0;
     }
-    *msgtype = get_option_msgtype(packet);
+    *msgtype = get_option_msgtype(&packet->opts);
     if (!*msgtype) {
         log_warning("%s: Packet does not specify a DHCP message type.  Ignoring.",
-                    client_config.interface);
+                    client_config->interface);
         return 0;
     }
-    char clientid[MAX_DOPT_SIZE];
-    size_t cidlen = get_option_clientid(packet, clientid, MAX_DOPT_SIZE);
+    size_t cidlen;
+    const uint8_t *clientid = get_dhcp_opt(&packet->opts, DCODE_CLIENT_ID,
+                                           &cidlen);
     if (cidlen == 0)
         return 1;
-    if (memcmp(client_config.clientid, clientid,
-               min_size_t(cidlen, client_config.clientid_len))) {
+    if (memcmp(client_config->clientid, clientid,
+               min_size_t(cidlen, client_config->clientid_len))) {
         log_warning("%s: Packet clientid does not match our clientid.  Ignoring.",
-                    client_config.interface);
+                    client_config->interface);
         return 0;
     }
     return 1;
 }
 
 bool dhcp_packet_get(struct client_state_t cs[static 1],
-                     struct dhcpmsg packet[static 1],
+                     struct dhcp_rx packet[static 1],
                      uint8_t msgtype[static 1],
                      uint32_t srcaddr[static 1])
 {
     if (cs->listenFd < 0)
         return false;
-    ssize_t r = get_raw_packet(cs, packet, srcaddr);
+    ssize_t r = get_raw_packet(cs, &packet->msg, srcaddr);
     if (r < 0) {
         // Not a transient issue handled by packet collection functions.
         if (r != -2) {
             log_error("%s: Error reading from listening socket: %s.  Reopening.",
-                      client_config.interface, strerror(errno));
+                      client_config->interface, strerror(errno));
             stop_dhcp_listen(cs);
             start_dhcp_listen(cs);
         }
@@ -415,15 +489,43 @@ bool dhcp_packet_get(struct client_state_t cs[static 1],
     return true;
 }
 
+// The socket that a renewal is unicast from also receives the reply, so
+// the kernel has already verified the checksums and the sender.
+bool dhcp_unicast_packet_get(struct client_state_t cs[static 1],
+                             struct dhcp_rx packet[static 1],
+                             uint8_t msgtype[static 1],
+                             uint32_t srcaddr[static 1])
+{
+    if (cs->unicastFd < 0)
+        return false;
+    memset(&packet->msg, 0, sizeof packet->msg);
+    ssize_t r = safe_recv(cs->unicastFd, (char *)&packet->msg,
+                          sizeof packet->msg, MSG_DONTWAIT);
+    if (r < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return false;
+        // Includes ICMP errors for earlier sends; the socket is
+        // recreated by the next unicast send.
+        log_error("%s: Error reading from unicast socket: %s.  Closing it.",
+                  client_config->interface, strerror(errno));
+        close_udp_unicast_socket(cs);
+        return false;
+    }
+    *srcaddr = cs->unicastServerAddr;
+    if (!validate_dhcp_packet(cs, (size_t)r, packet, msgtype))
+        return false;
+    return true;
+}
+
 static void add_options_vendor_hostname(struct dhcpmsg packet[static 1])
 {
-    size_t vlen = strlen(client_config.vendor);
-    size_t hlen = strlen(client_config.hostname);
+    size_t vlen = strlen(client_config->vendor);
+    size_t hlen = strlen(client_config->hostname);
     if (vlen)
-        add_option_vendor(packet, client_config.vendor, vlen);
+        add_option_vendor(packet, client_config->vendor, vlen);
     else
         add_option_vendor(packet, "ndhc", sizeof "ndhc" - 1);
-    add_option_hostname(packet, client_config.hostname, hlen);
+    add_option_hostname(packet, client_config->hostname, hlen);
 }
 
 // Initialize a DHCP client packet that will be sent to a server
@@ -435,74 +537,201 @@ static void init_packet(struct dhcpmsg packet[static 1], uint8_t type)
     packet->cookie = htonl(DHCP_MAGIC);
     packet->options[0] = DCODE_END;
     add_option_msgtype(packet, type);
-    memcpy(packet->chaddr, client_config.arp, 6);
-    add_option_clientid(packet, client_config.clientid,
-                        client_config.clientid_len);
+    memcpy(packet->chaddr, client_config->arp, 6);
+    add_option_clientid(packet, client_config->clientid,
+                        client_config->clientid_len);
+}
+
+// DISCOVER and REQUEST messages differ from each other only in their type,
+// xid, ciaddr, and requested IP and server id options, so they are built
+// from a per-interface template.  The variable options live in fixed slots
+// at the front of the options field and are left as padding when unused;
+// the options that never change follow them.  Every variable field starts
+// at an even offset, so the UDP checksum of a message is the checksum of
+// the template combined with that of the variable fields alone.
+#define TPL_MSGTYPE 0    // Message type option followed by one pad byte.
+#define TPL_REQIP 4      // Requested IP option or padding.
+#define TPL_SERVERID 10  // Server id option or padding.
+#define TPL_FIXED 16     // Options that are the same in every message.
+
+struct dhcp_template {
+    struct ip_udp_dhcp_packet iud; // All variable fields are zero.
+    size_t iud_len;
+    size_t payload_len;
+    uint16_t udp_cs;               // Includes the UDP pseudo-header.
+    bool valid;
+};
+static struct dhcp_template dhcp_templates[NDHC_MAX_IFACES];
+
+static const struct dhcp_template *
+get_dhcp_template(struct client_state_t cs[static 1])
+{
+    struct dhcp_template *t = &dhcp_templates[cs->client_idx];
+    if (t->valid)
+        return t;
+
+    struct dhcpmsg fixed = {0};
+    fixed.options[0] = DCODE_END;
+    add_option_clientid(&fixed, client_config->clientid,
+                        client_config->clientid_len);
+    add_option_maxsize(&fixed);
+    add_option_request_list(&fixed);
+    add_options_vendor_hostname(&fixed);
+    ssize_t endloc = get_end_option_idx(&fixed);
+    if (endloc < 0 ||
+        TPL_FIXED + (size_t)endloc + 1 > sizeof fixed.options)
+        suicide("%s: (%s) DHCP options do not fit in a packet",
+                client_config->interface, __func__);
+    const size_t el = TPL_FIXED + (size_t)endloc + 1;
+    size_t padding = sizeof fixed.options - el;
+    size_t ud_len = sizeof(struct udp_dhcp_packet) - padding;
+    t->iud_len = sizeof(struct ip_udp_dhcp_packet) - padding;
+    t->payload_len = sizeof(struct dhcpmsg) - padding;
+
+    memset(&t->iud, 0, sizeof t->iud);
+    struct dhcpmsg *p = &t->iud.data;
+    p->op = 1; // BOOTREQUEST (client)
+    p->htype = 1; // ETH_10MB
+    p->hlen = 6; // ETH_10MB_LEN
+    p->cookie = htonl(DHCP_MAGIC);
+    memcpy(p->chaddr, client_config->arp, 6);
+    p->options[TPL_MSGTYPE] = DCODE_MSGTYPE;
+    p->options[TPL_MSGTYPE + 1] = 1;
+    memcpy(p->options + TPL_FIXED, fixed.options, (size_t)endloc + 1);
+
+    t->iud.ip.saddr = INADDR_ANY;
+    t->iud.ip.daddr = INADDR_BROADCAST;
+    t->iud.ip.protocol = IPPROTO_UDP;
+    t->iud.ip.tot_len = htons(t->iud_len);
+    t->iud.ip.ihl = sizeof t->iud.ip >> 2;
+    t->iud.ip.version = IPVERSION;
+    t->iud.ip.ttl = IPDEFTTL;
+    t->iud.ip.check = net_checksum161c(&t->iud.ip, sizeof t->iud.ip);
+    t->iud.udp.source = htons(DHCP_CLIENT_PORT);
+    t->iud.udp.dest = htons(DHCP_SERVER_PORT);
+    t->iud.udp.len = htons(ud_len);
+
+    struct iphdr ph = {
+        .saddr = INADDR_ANY,
+        .daddr = INADDR_BROADCAST,
+        .protocol = IPPROTO_UDP,
+        .tot_len = htons(ud_len),
+    };
+    uint16_t udpcs = net_checksum161c(&t->iud.udp, ud_len);
+    uint16_t phcs = net_checksum161c(&ph, sizeof ph);
+    t->udp_cs = net_checksum161c_add(udpcs, phcs);
+    t->valid = true;
+    return t;
+}
+
+// Copy the template into iud and fill in the variable fields.  Zero values
+// for reqip or serverid leave the option out.
+static const struct dhcp_template *
+fill_dhcp_template(struct client_state_t cs[static 1],
+                   struct ip_udp_dhcp_packet iud[static 1], uint8_t type,
+                   uint32_t ciaddr, uint32_t reqip, uint32_t serverid)
+{
+    const struct dhcp_template *t = get_dhcp_template(cs);
+    memcpy(iud, &t->iud, t->iud_len);
+    uint8_t *opts = iud->data.options;
+    iud->data.xid = cs->xid;
+    iud->data.ciaddr = ciaddr;
+    opts[TPL_MSGTYPE + 2] = type;
+    if (reqip) {
+        opts[TPL_REQIP] = DCODE_REQIP;
+        opts[TPL_REQIP + 1] = sizeof reqip;
+        memcpy(opts + TPL_REQIP + 2, &reqip, sizeof reqip);
+    }
+    if (serverid) {
+        opts[TPL_SERVERID] = DCODE_SERVER_ID;
+        opts[TPL_SERVERID + 1] = sizeof serverid;
+        memcpy(opts + TPL_SERVERID + 2, &serverid, sizeof serverid);
+    }
+
+    // The slots run from the message type value up to TPL_FIXED.
+    uint8_t v[sizeof cs->xid + sizeof ciaddr + TPL_FIXED - TPL_MSGTYPE - 2];
+    memcpy(v, &iud->data.xid, sizeof cs->xid);
+    memcpy(v + sizeof cs->xid, &iud->data.ciaddr, sizeof ciaddr);
+    memcpy(v + sizeof cs->xid + sizeof ciaddr, opts + TPL_MSGTYPE + 2,
+           TPL_FIXED - TPL_MSGTYPE - 2);
+    iud->udp.check = net_checksum161c_add(t->udp_cs,
+                                          net_checksum161c(v, sizeof v));
+    return t;
 }
 
 ssize_t send_discover(struct client_state_t cs[static 1])
 {
-    struct dhcpmsg packet = {.xid = cs->xid};
-    init_packet(&packet, DHCPDISCOVER);
-    if (cs->clientAddr)
-        add_option_reqip(&packet, cs->clientAddr);
-    add_option_maxsize(&packet);
-    add_option_request_list(&packet);
-    add_options_vendor_hostname(&packet);
-    log_line("%s: Discovering DHCP servers...", client_config.interface);
-    return send_dhcp_raw(&packet);
+    sync_dhcp_listen(cs);
+    struct ip_udp_dhcp_packet iud;
+    const struct dhcp_template *t =
+        fill_dhcp_template(cs, &iud, DHCPDISCOVER, 0, cs->clientAddr, 0);
+    log_line("%s: Discovering DHCP servers...", client_config->interface);
+    return xmit_dhcp_raw(cs, &iud, t->iud_len);
 }
 
 ssize_t send_selecting(struct client_state_t cs[static 1])
 {
+    sync_dhcp_listen(cs);
     char clibuf[INET_ADDRSTRLEN];
-    struct dhcpmsg packet = {.xid = cs->xid};
-    init_packet(&packet, DHCPREQUEST);
-    add_option_reqip(&packet, cs->clientAddr);
-    add_option_serverid(&packet, cs->serverAddr);
-    add_option_maxsize(&packet);
-    add_option_request_list(&packet);
-    add_options_vendor_hostname(&packet);
+    struct ip_udp_dhcp_packet iud;
+    const struct dhcp_template *t =
+        fill_dhcp_template(cs, &iud, DHCPREQUEST, 0, cs->clientAddr,
+                           cs->serverAddr);
     inet_ntop(AF_INET, &(struct in_addr){.s_addr = cs->clientAddr},
               clibuf, sizeof clibuf);
     log_line("%s: Sending a selection request for %s...",
-             client_config.interface, clibuf);
-    return send_dhcp_raw(&packet);
+             client_config->interface, clibuf);
+    return xmit_dhcp_raw(cs, &iud, t->iud_len);
 }
 
+// RFC2131 4.3.2: an INIT-REBOOT request carries the address that we want
+// to keep, but neither a server id nor ciaddr.
+ssize_t send_init_reboot(struct client_state_t cs[static 1])
+{
+    sync_dhcp_listen(cs);
+    char clibuf[INET_ADDRSTRLEN];
+    struct ip_udp_dhcp_packet iud;
+    const struct dhcp_template *t =
+        fill_dhcp_template(cs, &iud, DHCPREQUEST, 0, cs->clientAddr, 0);
+    inet_ntop(AF_INET, &(struct in_addr){.s_addr = cs->clientAddr},
+              clibuf, sizeof clibuf);
+    log_line("%s: Requesting our previous lease of %s...",
+             client_config->interface, clibuf);
+    return xmit_dhcp_raw(cs, &iud, t->iud_len);
+}
+
+// The ACK is read from the unicast socket; see dhcp_unicast_packet_get().
 ssize_t send_renew(struct client_state_t cs[static 1])
 {
-    struct dhcpmsg packet = {.xid = cs->xid};
-    init_packet(&packet, DHCPREQUEST);
-    packet.ciaddr = cs->clientAddr;
-    add_option_maxsize(&packet);
-    add_option_request_list(&packet);
-    add_options_vendor_hostname(&packet);
-    log_line("%s: Sending a renew request...", client_config.interface);
-    return send_dhcp_unicast(cs, &packet);
+    struct ip_udp_dhcp_packet iud;
+    const struct dhcp_template *t =
+        fill_dhcp_template(cs, &iud, DHCPREQUEST, cs->clientAddr, 0, 0);
+    log_line("%s: Sending a renew request...", client_config->interface);
+    return xmit_dhcp_unicast(cs, &iud.data, t->payload_len);
 }
 
 ssize_t send_rebind(struct client_state_t cs[static 1])
 {
-    struct dhcpmsg packet = {.xid = cs->xid};
-    init_packet(&packet, DHCPREQUEST);
-    packet.ciaddr = cs->clientAddr;
-    add_option_reqip(&packet, cs->clientAddr);
-    add_option_maxsize(&packet);
-    add_option_request_list(&packet);
-    add_options_vendor_hostname(&packet);
-    log_line("%s: Sending a rebind request...", client_config.interface);
-    return send_dhcp_raw(&packet);
+    sync_dhcp_listen(cs);
+    struct ip_udp_dhcp_packet iud;
+    const struct dhcp_template *t =
+        fill_dhcp_template(cs, &iud, DHCPREQUEST, cs->clientAddr,
+                           cs->clientAddr, 0);
+    log_line("%s: Sending a rebind request...", client_config->interface);
+    return xmit_dhcp_raw(cs, &iud, t->iud_len);
 }
 
-ssize_t send_decline(struct client_state_t cs[static 1], uint32_t server)
+// RFC2131 4.4.1: the declined address goes in the requested IP option and
+// the server id must be that of the server which acked it.
+ssize_t send_decline(struct client_state_t cs[static 1], uint32_t yiaddr,
+                     uint32_t server)
 {
     struct dhcpmsg packet = {.xid = cs->xid};
     init_packet(&packet, DHCPDECLINE);
-    add_option_reqip(&packet, cs->clientAddr);
+    add_option_reqip(&packet, yiaddr);
     add_option_serverid(&packet, server);
-    log_line("%s: Sending a decline message...", client_config.interface);
-    return send_dhcp_raw(&packet);
+    log_line("%s: Sending a decline message...", client_config->interface);
+    return send_dhcp_raw(cs, &packet);
 }
 
 ssize_t send_release(struct client_state_t cs[static 1])
@@ -512,7 +741,7 @@ ssize_t send_release(struct client_state_t cs[static 1])
     packet.ciaddr = cs->clientAddr;
     add_option_reqip(&packet, cs->clientAddr);
     add_option_serverid(&packet, cs->serverAddr);
-    log_line("%s: Sending a release message...", client_config.interface);
+    log_line("%s: Sending a release message...", client_config->interface);
     return send_dhcp_unicast(cs, &packet);
 }
 
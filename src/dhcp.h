@@ -70,6 +70,24 @@ struct dhcpmsg {
     uint8_t options[308]; // DHCP options field (#1)
 };
 
+// The options of a received message, gathered in a single pass.  The data
+// of each option code is the concatenation of every instance of it in the
+// options field and in the file and sname fields when they are overloaded
+// (RFC3396); len[code] is zero if the option is absent.
+struct dhcp_opts {
+    uint16_t off[256];
+    uint16_t len[256];
+    uint8_t data[sizeof ((struct dhcpmsg *)0)->options +
+                 sizeof ((struct dhcpmsg *)0)->file +
+                 sizeof ((struct dhcpmsg *)0)->sname];
+};
+
+// A received message and the index of its options.
+struct dhcp_rx {
+    struct dhcpmsg msg;
+    struct dhcp_opts opts;
+};
+
 struct ip_udp_dhcp_packet {
     struct iphdr ip;
     struct udphdr udp;
@@ -83,15 +101,22 @@ struct udp_dhcp_packet {
 
 void start_dhcp_listen(struct client_state_t cs[static 1]);
 void stop_dhcp_listen(struct client_state_t cs[static 1]);
+void close_dhcp_xmit(struct client_state_t cs[static 1]);
 bool dhcp_packet_get(struct client_state_t cs[static 1],
-                     struct dhcpmsg packet[static 1],
+                     struct dhcp_rx packet[static 1],
                      uint8_t msgtype[static 1],
                      uint32_t srcaddr[static 1]);
+bool dhcp_unicast_packet_get(struct client_state_t cs[static 1],
+                             struct dhcp_rx packet[static 1],
+                             uint8_t msgtype[static 1],
+                             uint32_t srcaddr[static 1]);
 ssize_t send_discover(struct client_state_t cs[static 1]);
 ssize_t send_selecting(struct client_state_t cs[static 1]);
+ssize_t send_init_reboot(struct client_state_t cs[static 1]);
 ssize_t send_renew(struct client_state_t cs[static 1]);
 ssize_t send_rebind(struct client_state_t cs[static 1]);
-ssize_t send_decline(struct client_state_t cs[static 1], uint32_t server);
+ssize_t send_decline(struct client_state_t cs[static 1], uint32_t yiaddr,
+                     uint32_t server);
 ssize_t send_release(struct client_state_t cs[static 1]);
 
 #endif
@@ -43,218 +43,257 @@
 #include "dhcp.h"
 #include "options.h"
 #include "arp.h"
+#include "netlink.h"
+#include "ifchd.h"
 #include "ifchange.h"
 
-static struct dhcpmsg cfg_packet; // Copy of the current configuration packet.
+// Copy of the current configuration packet for each interface.
+static struct dhcp_rx cfg_packets[NDHC_MAX_IFACES];
+// Set if the interface has already been deconfigured.
+static bool if_deconfigured[NDHC_MAX_IFACES];
 
-static int ifcmd_raw(char buf[static 1], size_t buflen,
-                     const char optname[static 1],
-                     char *optdata, size_t optlen)
-{
-    if (!optdata) {
-        log_warning("%s: (%s) '%s' option has no data",
-                    client_config.interface, __func__, optname);
-        return -1;
-    }
-    if (optlen > INT_MAX) {
-        log_warning("%s: (%s) '%s' option optlen out of bounds",
-                    client_config.interface, __func__, optname);
-        return -1;
-    }
-    if (buflen < strlen(optname) + optlen + 3) {
-        log_warning("%s: (%s) '%s' option buf too short",
-                    client_config.interface, __func__, optname);
-        return -1;
-    }
-    int ioptlen = (int)optlen;
-    ssize_t olen = snprintf(buf, buflen, "%s:%.*s;",
-                            optname, ioptlen, optdata);
-    if (olen < 0 || (size_t)olen >= buflen) {
-        log_warning("%s: (%s) '%s' option would truncate, so it was dropped.",
-                    client_config.interface, __func__, optname);
-        memset(buf, 0, buflen);
-        return -1;
-    }
-    return olen;
-}
+// Requests to ifch are pipelined.  ifch_seq is the sequence number of
+// the last request sent and ifch_seq_done that of the last reply seen.
+static uint32_t ifch_seq;
+static uint32_t ifch_seq_done;
 
-static int ifcmd_bytes(char buf[static 1], size_t buflen,
-                       const char optname[static 1],
-                       uint8_t *optdata, size_t optlen)
+// Appends a TLV to buf.  Returns the number of bytes written, or 0 if
+// the TLV would not fit.
+static size_t ifcmd_tlv(uint8_t buf[static 1], size_t buflen,
+                        enum ifch_cmd type, const void *arg, size_t arglen)
 {
-    return ifcmd_raw(buf, buflen, optname, (char *)optdata, optlen);
-}
-
-static int ifcmd_u8(char buf[static 1], size_t buflen,
-                    const char optname[static 1],
-                    uint8_t *optdata, size_t optlen)
-{
-    if (!optdata || optlen < 1)
-        return -1;
-    char numbuf[16];
-    uint8_t c = optdata[0];
-    ssize_t olen = snprintf(numbuf, sizeof numbuf, "%c", c);
-    if (olen < 0 || (size_t)olen >= sizeof numbuf)
-        return -1;
-    return ifcmd_raw(buf, buflen, optname, numbuf, strlen(numbuf));
+    struct ifch_tlv tlv = { .type = type, .len = (uint16_t)arglen };
+    if (arglen > UINT16_MAX || buflen < sizeof tlv + arglen) {
+        log_warning("%s: (%s) command %u would truncate, so it was dropped.",
+                    client_config->interface, __func__, type);
+        return 0;
+    }
+    memcpy(buf, &tlv, sizeof tlv);
+    if (arglen)
+        memcpy(buf + sizeof tlv, arg, arglen);
+    return sizeof tlv + arglen;
 }
 
-static int ifcmd_u16(char buf[static 1], size_t buflen,
-                     const char optname[static 1],
-                     uint8_t *optdata, size_t optlen)
+// Validates DHCP option data and encodes it as the matching ifch command.
+static size_t ifchd_cmd(uint8_t b[static 1], size_t bl, const uint8_t *od,
+                        size_t ol, uint8_t code)
 {
-    if (!optdata || optlen < 2)
-        return -1;
-    char numbuf[16];
-    uint16_t v;
-    memcpy(&v, optdata, 2);
-    v = ntohs(v);
-    ssize_t olen = snprintf(numbuf, sizeof numbuf, "%hu", v);
-    if (olen < 0 || (size_t)olen >= sizeof numbuf)
-        return -1;
-    return ifcmd_raw(buf, buflen, optname, numbuf, strlen(numbuf));
+    enum ifch_cmd type;
+    size_t minlen = 1;
+    size_t fixlen = 0; // Size of a fixed-size argument, or 0.
+    bool iplist = false;
+    switch (code) {
+    case DCODE_ROUTER: type = IFCMD_ROUTER; fixlen = 4; break;
+    case DCODE_DNS: type = IFCMD_DNS; iplist = true; break;
+    case DCODE_LPRSVR: type = IFCMD_LPRSVR; iplist = true; break;
+    case DCODE_NTPSVR: type = IFCMD_NTPSVR; iplist = true; break;
+    case DCODE_WINS: type = IFCMD_WINS; iplist = true; break;
+    case DCODE_HOSTNAME: type = IFCMD_HOSTNAME; break;
+    case DCODE_DOMAIN: type = IFCMD_DOMAIN; break;
+    case DCODE_TIMEZONE: type = IFCMD_TIMEZONE; fixlen = 4; break;
+    case DCODE_MTU: type = IFCMD_MTU; fixlen = 2; break;
+    case DCODE_IPTTL: type = IFCMD_IPTTL; fixlen = 1; break;
+    default:
+        log_warning("%s: Invalid option code (%c) for ifchd cmd.",
+                    client_config->interface, code);
+        return 0;
+    }
+    if (fixlen)
+        minlen = fixlen;
+    if (iplist) {
+        // Trailing partial addresses are ignored.
+        minlen = 4;
+        ol -= ol % 4;
+    }
+    if (!od || ol < minlen) {
+        log_warning("%s: (%s) option %u is too short",
+                    client_config->interface, __func__, code);
+        return 0;
+    }
+    // Extra bytes after a fixed-size argument are ignored.
+    if (fixlen)
+        ol = fixlen;
+    return ifcmd_tlv(b, bl, type, od, ol);
 }
 
-static int ifcmd_s32(char buf[static 1], size_t buflen,
-                     const char optname[static 1],
-                     uint8_t *optdata, size_t optlen)
+// Queues a request for ifch without waiting for it to be performed; the
+// result arrives later and is handled by ifchange_get().
+static int ifchwrite(enum ifch_op op, const uint8_t buf[static 1],
+                     size_t count)
 {
-    if (!optdata || optlen < 4)
+    uint8_t req[IFCH_REQ_MAX];
+    struct ifch_hdr hdr = {
+        .seq = ifch_seq + 1,
+        .idx = client_config_idx(),
+        .op = (uint8_t)op,
+    };
+    if (count > sizeof req - sizeof hdr) {
+        log_error("%s: (%s) request is too long: %zu",
+                  client_config->interface, __func__, count);
         return -1;
-    char numbuf[16];
-    uint32_t v;
-    memcpy(&v, optdata, 4);
-    v = ntohl(v);
-    ssize_t olen = snprintf(numbuf, sizeof numbuf, "%d", v);
-    if (olen < 0 || (size_t)olen >= sizeof numbuf)
+    }
+    memcpy(req, &hdr, sizeof hdr);
+    memcpy(req + sizeof hdr, buf, count);
+    count += sizeof hdr;
+    ssize_t r = safe_write(ifchSock[0], (const char *)req, count);
+    if (r < 0 || (size_t)r != count) {
+        log_error("%s: (%s) write failed: %d", client_config->interface, __func__, r);
         return -1;
-    return ifcmd_raw(buf, buflen, optname, numbuf, strlen(numbuf));
+    }
+    ++ifch_seq;
+    return 0;
 }
 
-static int ifcmd_ip(char buf[static 1], size_t buflen,
-                    const char optname[static 1],
-                    uint8_t *optdata, size_t optlen)
+// Returns false if ifch failed to apply a bind for the interface.
+static bool ifch_complete(const struct ifch_hdr hdr[static 1])
 {
-    if (!optdata || optlen < 4)
-        return -1;
-    char ipbuf[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, optdata, ipbuf, sizeof ipbuf);
-    return ifcmd_raw(buf, buflen, optname, ipbuf, strlen(ipbuf));
+    if (hdr->idx >= client_count)
+        suicide("%s: reply for unknown interface %u", __func__, hdr->idx);
+    client_config = &client_configs[hdr->idx];
+    if (hdr->seq != ifch_seq_done + 1)
+        log_warning("%s: (%s) ifch reply %u is out of order; expected %u",
+                    client_config->interface, __func__, hdr->seq,
+                    ifch_seq_done + 1);
+    ifch_seq_done = hdr->seq;
+    if (hdr->result == '+')
+        return true;
+    switch (hdr->op) {
+    case IFCH_OP_BIND:
+        // Only this interface is affected; its state machine starts over.
+        log_error("%s: Failed to set the interface IP address and properties!",
+                  client_config->interface);
+        return false;
+    case IFCH_OP_DECONFIG:
+        // Allow the next ifchange_deconfig() to try again.
+        log_warning("%s: Failed to reset the IP configuration.",
+                    client_config->interface);
+        if_deconfigured[hdr->idx] = false;
+        return true;
+    default:
+        suicide("%s: (%s) unknown ifch reply op %u",
+                client_config->interface, __func__, hdr->op);
+    }
 }
 
-static int ifcmd_iplist(char out[static 1], size_t outlen,
-                        const char optname[static 1],
-                        uint8_t *optdata, size_t optlen)
+// Returns 1 if a reply was read into hdr, 0 if none were available with
+// MSG_DONTWAIT, and exits if ifch has gone away.
+static int ifch_read_reply(int flags, struct ifch_hdr hdr[static 1])
 {
-    char buf[2048];
-    char ipbuf[INET_ADDRSTRLEN];
-    size_t bufoff = 0;
-    size_t optoff = 0;
-
-    if (!optdata || optlen < 4)
-        return -1;
-
-    inet_ntop(AF_INET, optdata + optoff, ipbuf, sizeof ipbuf);
-    ssize_t wc = snprintf(buf + bufoff, sizeof buf, "%s", ipbuf);
-    if (wc < 0 || (size_t)wc >= sizeof buf)
-        return -1;
-    optoff += 4;
-    bufoff += (size_t)wc;
-    while (optlen >= 4 + optoff) {
-        inet_ntop(AF_INET, optdata + optoff, ipbuf, sizeof ipbuf);
-        wc = snprintf(buf + bufoff, sizeof buf, ",%s", ipbuf);
-        if (wc < 0 || (size_t)wc >= sizeof buf)
-            return -1;
-        optoff += 4;
-        bufoff += (size_t)wc;
+    ssize_t r = safe_recv(ifchSock[0], (char *)hdr, sizeof *hdr, flags);
+    if (r == 0) {
+        // Remote end hung up.
+        exit(EXIT_SUCCESS);
+    } else if (r < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        suicide("%s: (%s) recv failed: %s", client_config->interface,
+                __func__, strerror(errno));
     }
-    return ifcmd_raw(out, outlen, optname, buf, strlen(buf));
+    if ((size_t)r != sizeof *hdr)
+        suicide("%s: (%s) received a truncated reply",
+                client_config->interface, __func__);
+    return 1;
 }
 
-static int ifchd_cmd(char b[static 1], size_t bl, uint8_t *od,
-                     size_t ol, uint8_t code)
+// Handles every ifch reply that is waiting on ifchSock.  A failed bind is
+// stored in the bind_failed member of the client_state_t of its interface;
+// the caller must clear it after handling it.
+void ifchange_get(struct client_state_t clients[static 1])
 {
-    switch (code) {
-    case DCODE_ROUTER: return ifcmd_ip(b, bl, "routr", od, ol);
-    case DCODE_DNS: return ifcmd_iplist(b, bl, "dns", od, ol);
-    case DCODE_LPRSVR: return ifcmd_iplist(b, bl, "lpr", od, ol);
-    case DCODE_NTPSVR: return ifcmd_iplist(b, bl, "ntp", od, ol);
-    case DCODE_WINS: return ifcmd_iplist(b, bl, "wins", od, ol);
-    case DCODE_HOSTNAME: return ifcmd_bytes(b, bl, "host", od, ol);
-    case DCODE_DOMAIN: return ifcmd_bytes(b, bl, "dom", od, ol);
-    case DCODE_TIMEZONE: return ifcmd_s32(b, bl, "tzone", od, ol);
-    case DCODE_MTU: return ifcmd_u16(b, bl, "mtu", od, ol);
-    case DCODE_IPTTL: return ifcmd_u8(b, bl, "ipttl", od, ol);
-    default: break;
+    struct ifch_hdr hdr;
+    while (ifch_read_reply(MSG_DONTWAIT, &hdr)) {
+        if (!ifch_complete(&hdr))
+            clients[hdr.idx].bind_failed = true;
     }
-    log_warning("%s: Invalid option code (%c) for ifchd cmd.",
-                client_config.interface, code);
-    return -1;
 }
 
-static int ifchwrite(const char buf[static 1], size_t count)
+// Blocks until ifch has finished every request that has been sent.
+// Returns -1 if a bind for cs failed.
+int ifchange_wait(struct client_state_t cs[static 1])
 {
-    ssize_t r = safe_write(ifchSock[0], buf, count);
-    if (r < 0 || (size_t)r != count) {
-        log_error("%s: (%s) write failed: %d", client_config.interface, __func__, r);
-        return -1;
-    }
-    char data[256], control[256];
-    struct iovec iov = {
-        .iov_base = data,
-        .iov_len = sizeof data - 1,
-    };
-    struct msghdr msg = {
-        .msg_iov = &iov,
-        .msg_iovlen = 1,
-        .msg_control = control,
-        .msg_controllen = sizeof control
-    };
-    r = safe_recvmsg(ifchSock[0], &msg, 0);
-    if (r == 0) {
-        // Remote end hung up.
-        exit(EXIT_SUCCESS);
-    } else if (r < 0) {
-        suicide("%s: (%s) recvmsg failed: %s", client_config.interface,
-                __func__, strerror(errno));
+    struct ifch_hdr hdr;
+    int ret = 0;
+    while (ifch_seq_done != ifch_seq) {
+        if (ifch_read_reply(0, &hdr) && !ifch_complete(&hdr) &&
+            hdr.idx == cs->client_idx)
+            ret = -1;
     }
-    data[iov.iov_len] = '\0';
-    if (r == 1 && data[0] == '+')
-        return 0;
-    return -1;
+    return ret;
 }
 
-bool carrier_isup(void)
+// The link state is kept current by netlink events, so the kernel only
+// needs to be asked when we might have missed some of them.
+bool carrier_isup(struct client_state_t cs[static 1])
 {
-    char buf[256];
-    snprintf(buf, sizeof buf, "carrier:;");
-    return ifchwrite(buf, strlen(buf)) == 0;
+    if (cs->link_state == IFS_NONE) {
+        int state = nl_getlinkstate();
+        cs->link_state = state != IFS_NONE ? state : IFS_DOWN;
+    }
+    return cs->link_state == IFS_UP;
 }
 
 int ifchange_deconfig(struct client_state_t cs[static 1])
 {
-    char buf[256];
+    static const uint8_t ip4_none[8] = { 0, 0, 0, 0, 255, 255, 255, 255 };
+    uint8_t buf[sizeof(struct ifch_tlv) + sizeof ip4_none];
     int ret = -1;
 
-    if (cs->ifDeconfig)
+    if (if_deconfigured[cs->client_idx])
         return 0;
 
-    snprintf(buf, sizeof buf, "ip4:0.0.0.0,255.255.255.255;");
-    log_line("%s: Resetting IP configuration.", client_config.interface);
-    ret = ifchwrite(buf, strlen(buf));
+    size_t bo = ifcmd_tlv(buf, sizeof buf, IFCMD_IP4SET,
+                          ip4_none, sizeof ip4_none);
+    log_line("%s: Resetting IP configuration.", client_config->interface);
+    ret = ifchwrite(IFCH_OP_DECONFIG, buf, bo);
 
     if (ret >= 0) {
-        cs->ifDeconfig = 1;
-        memset(&cfg_packet, 0, sizeof cfg_packet);
+        if_deconfigured[cs->client_idx] = true;
+        memset(&cfg_packets[cs->client_idx], 0, sizeof cfg_packets[0]);
     }
     return ret;
 }
 
-static size_t send_client_ip(char out[static 1], size_t olen,
-                             struct dhcpmsg packet[static 1])
+// Called at startup with the lease of the previous run.  If the kernel
+// still has the address and default route that ifch installed for it,
+// they are adopted as they are: cfg_packet is filled in from what the
+// kernel has, so that a later bind only changes what differs.  The DNS
+// and hostname settings can't be read back and are left alone.
+bool ifchange_adopt(struct client_state_t cs[static 1])
+{
+    struct dhcp_rx *cfg_packet = &cfg_packets[cs->client_idx];
+    struct nl_ifconfig ifc;
+
+    if (nl_getifconfig(cs->clientAddr, &ifc) < 0 || !ifc.have_ipaddr)
+        return false;
+    if (ifc.router != cs->routerAddr)
+        return false;
+
+    memset(cfg_packet, 0, sizeof *cfg_packet);
+    cfg_packet->msg.yiaddr = cs->clientAddr;
+    cfg_packet->msg.options[0] = DCODE_END;
+    add_u32_option(&cfg_packet->msg, DCODE_SUBNET, ifc.prefixlen ?
+                   htonl(UINT32_MAX << (32 - ifc.prefixlen)) : 0);
+    if (ifc.bcast)
+        add_u32_option(&cfg_packet->msg, DCODE_BROADCAST, ifc.bcast);
+    if (ifc.router)
+        add_u32_option(&cfg_packet->msg, DCODE_ROUTER, ifc.router);
+    if (ifc.mtu && ifc.mtu <= UINT16_MAX) {
+        uint16_t mtu = htons((uint16_t)ifc.mtu);
+        add_option_string(&cfg_packet->msg, DCODE_MTU,
+                          (const char *)&mtu, sizeof mtu);
+    }
+    index_dhcp_opts(&cfg_packet->opts, &cfg_packet->msg);
+    if_deconfigured[cs->client_idx] = false;
+    return true;
+}
+
+static size_t send_client_ip(uint8_t out[static 1], size_t olen,
+                             struct dhcp_rx cfg_packet[static 1],
+                             struct dhcp_rx packet[static 1])
 {
-    uint8_t optdata[MAX_DOPT_SIZE], olddata[MAX_DOPT_SIZE];
-    char ip[INET_ADDRSTRLEN], sn[INET_ADDRSTRLEN], bc[INET_ADDRSTRLEN];
+    const uint8_t *optdata, *olddata;
+    // ip[4] subnet[4] (broadcast[4])
+    uint8_t arg[12];
     size_t optlen, oldlen;
     bool change_ipaddr = false;
     bool have_subnet = false;
@@ -262,26 +301,25 @@ static size_t send_client_ip(char out[static 1], size_t olen,
     bool have_bcast = false;
     bool change_bcast = false;
 
-    if (memcmp(&packet->yiaddr, &cfg_packet.yiaddr, sizeof packet->yiaddr))
+    if (memcmp(&packet->msg.yiaddr, &cfg_packet->msg.yiaddr,
+               sizeof packet->msg.yiaddr))
         change_ipaddr = true;
-    inet_ntop(AF_INET, &packet->yiaddr, ip, sizeof ip);
+    memcpy(arg, &packet->msg.yiaddr, 4);
 
-    optlen = get_dhcp_opt(packet, DCODE_SUBNET, optdata, sizeof optdata);
+    optdata = get_dhcp_opt(&packet->opts, DCODE_SUBNET, &optlen);
     if (optlen >= 4) {
         have_subnet = true;
-        inet_ntop(AF_INET, optdata, sn, sizeof sn);
-        oldlen = get_dhcp_opt(&cfg_packet, DCODE_SUBNET, olddata,
-                              sizeof olddata);
+        memcpy(arg + 4, optdata, 4);
+        olddata = get_dhcp_opt(&cfg_packet->opts, DCODE_SUBNET, &oldlen);
         if (oldlen != optlen || memcmp(optdata, olddata, optlen))
             change_subnet = true;
     }
 
-    optlen = get_dhcp_opt(packet, DCODE_BROADCAST, optdata, sizeof optdata);
+    optdata = get_dhcp_opt(&packet->opts, DCODE_BROADCAST, &optlen);
     if (optlen >= 4) {
         have_bcast = true;
-        inet_ntop(AF_INET, optdata, bc, sizeof bc);
-        oldlen = get_dhcp_opt(&cfg_packet, DCODE_BROADCAST, olddata,
-                              sizeof olddata);
+        memcpy(arg + 8, optdata, 4);
+        olddata = get_dhcp_opt(&cfg_packet->opts, DCODE_BROADCAST, &oldlen);
         if (oldlen != optlen || memcmp(optdata, olddata, optlen))
             change_bcast = true;
     }
@@ -291,67 +329,60 @@ static size_t send_client_ip(char out[static 1], size_t olen,
         return 0;
 
     if (!have_subnet) {
-        static char snClassC[] = "255.255.255.0";
+        static const uint8_t snClassC[] = { 255, 255, 255, 0 };
         log_line("%s: Server did not send a subnet mask.  Assuming 255.255.255.0.",
-                 client_config.interface);
-        memcpy(sn, snClassC, sizeof snClassC);
+                 client_config->interface);
+        memcpy(arg + 4, snClassC, sizeof snClassC);
     }
 
-    int snlen;
-    if (have_bcast) {
-        snlen = snprintf(out, olen, "ip4:%s,%s,%s;", ip, sn, bc);
-    } else {
-        snlen = snprintf(out, olen, "ip4:%s,%s;", ip, sn);
-    }
-    if (snlen < 0 || (size_t)snlen >= olen) {
-        log_warning("%s: (%s) ip4 command would truncate so it was dropped.",
-                    client_config.interface, __func__);
-        memset(out, 0, olen);
-        return 0;
-    }
-    return (size_t)snlen;
+    return ifcmd_tlv(out, olen, IFCMD_IP4SET, arg, have_bcast ? 12 : 8);
 }
 
-static size_t send_cmd(char out[static 1], size_t olen,
-                       struct dhcpmsg packet[static 1], uint8_t code)
+static size_t send_cmd(uint8_t out[static 1], size_t olen,
+                       struct dhcp_rx cfg_packet[static 1],
+                       struct dhcp_rx packet[static 1], uint8_t code)
 {
-    uint8_t optdata[MAX_DOPT_SIZE], olddata[MAX_DOPT_SIZE];
+    const uint8_t *optdata, *olddata;
     size_t optlen, oldlen;
 
-    optlen = get_dhcp_opt(packet, code, optdata, sizeof optdata);
+    optdata = get_dhcp_opt(&packet->opts, code, &optlen);
     if (!optlen)
         return 0;
-    oldlen = get_dhcp_opt(&cfg_packet, code, olddata, sizeof olddata);
+    olddata = get_dhcp_opt(&cfg_packet->opts, code, &oldlen);
     if (oldlen == optlen && !memcmp(optdata, olddata, optlen))
         return 0;
-    int r = ifchd_cmd(out, olen, optdata, optlen, code);
-    return r > 0 ? (size_t)r : 0;
+    return ifchd_cmd(out, olen, optdata, optlen, code);
 }
 
+// The address, route and MTU are sent as one request and the slower
+// resolv.conf and hostname updates as a second, so that ifch applies
+// the former first and the master hears about it as soon as possible.
 int ifchange_bind(struct client_state_t cs[static 1],
-                   struct dhcpmsg packet[static 1])
+                   struct dhcp_rx packet[static 1])
 {
-    char buf[2048];
+    struct dhcp_rx *cfg_packet = &cfg_packets[cs->client_idx];
+    uint8_t buf[IFCH_REQ_MAX - sizeof(struct ifch_hdr)];
     size_t bo;
-    int ret = -1;
 
-    memset(buf, 0, sizeof buf);
-    bo = send_client_ip(buf, sizeof buf, packet);
-    bo += send_cmd(buf + bo, sizeof buf - bo, packet, DCODE_ROUTER);
-    bo += send_cmd(buf + bo, sizeof buf - bo, packet, DCODE_DNS);
-    bo += send_cmd(buf + bo, sizeof buf - bo, packet, DCODE_HOSTNAME);
-    bo += send_cmd(buf + bo, sizeof buf - bo, packet, DCODE_DOMAIN);
-    bo += send_cmd(buf + bo, sizeof buf - bo, packet, DCODE_MTU);
-    bo += send_cmd(buf + bo, sizeof buf - bo, packet, DCODE_WINS);
-    if (bo) {
-        log_line("%s: bind command: '%s'", client_config.interface, buf);
-        ret = ifchwrite(buf, bo);
-    }
+    bo = send_client_ip(buf, sizeof buf, cfg_packet, packet);
+    bo += send_cmd(buf + bo, sizeof buf - bo, cfg_packet, packet,
+                   DCODE_ROUTER);
+    bo += send_cmd(buf + bo, sizeof buf - bo, cfg_packet, packet,
+                   DCODE_MTU);
+    if (bo && ifchwrite(IFCH_OP_BIND, buf, bo) < 0)
+        return -1;
 
-    if (ret >= 0) {
-        cs->ifDeconfig = 0;
-        memcpy(&cfg_packet, packet, sizeof cfg_packet);
-    }
-    return ret;
-}
+    bo = send_cmd(buf, sizeof buf, cfg_packet, packet, DCODE_DNS);
+    bo += send_cmd(buf + bo, sizeof buf - bo, cfg_packet, packet,
+                   DCODE_HOSTNAME);
+    bo += send_cmd(buf + bo, sizeof buf - bo, cfg_packet, packet,
+                   DCODE_DOMAIN);
+    bo += send_cmd(buf + bo, sizeof buf - bo, cfg_packet, packet,
+                   DCODE_WINS);
+    if (bo && ifchwrite(IFCH_OP_BIND, buf, bo) < 0)
+        return -1;
 
+    if_deconfigured[cs->client_idx] = false;
+    memcpy(cfg_packet, packet, sizeof *cfg_packet);
+    return 0;
+}
@@ -31,9 +31,12 @@
 
 #include <stdbool.h>
 
-bool carrier_isup(void);
+bool carrier_isup(struct client_state_t cs[static 1]);
 int ifchange_bind(struct client_state_t cs[static 1],
-                  struct dhcpmsg packet[static 1]);
+                  struct dhcp_rx packet[static 1]);
 int ifchange_deconfig(struct client_state_t cs[static 1]);
+bool ifchange_adopt(struct client_state_t cs[static 1]);
+void ifchange_get(struct client_state_t clients[static 1]);
+int ifchange_wait(struct client_state_t cs[static 1]);
 
 #endif
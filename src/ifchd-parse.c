@@ -0,0 +1,178 @@
+/* ifchd-parse.c - interface change daemon parser
+ *
+ * Copyright (c) 2004-2017 Nicholas J. Kain <njkain at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "nk/log.h"
+
+#include "ifchd-parse.h"
+#include "ifchd.h"
+#include "ifset.h"
+#include "ndhc.h"
+
+// Address lists must hold at least one whole address.
+static bool valid_iplist(size_t len)
+{
+    return len >= 4 && len % 4 == 0;
+}
+
+// Same restrictions as the old text protocol: non-empty, and no
+// embedded NUL or ';'.
+static bool valid_str(const uint8_t arg[static 1], size_t len)
+{
+    if (!len)
+        return false;
+    for (size_t i = 0; i < len; ++i) {
+        if (arg[i] == '\0' || arg[i] == ';')
+            return false;
+    }
+    return true;
+}
+
+static int perform_ip4set(const uint8_t arg[static 1], size_t len)
+{
+    uint32_t ipaddr, subnet, bcast;
+    if (len != 8 && len != 12) {
+        log_line("%s: received invalid arguments", __func__);
+        return -99;
+    }
+    memcpy(&ipaddr, arg, 4);
+    memcpy(&subnet, arg + 4, 4);
+    if (len == 12) {
+        memcpy(&bcast, arg + 8, 4);
+        return perform_ip_subnet_bcast(ipaddr, subnet, &bcast);
+    }
+    return perform_ip_subnet_bcast(ipaddr, subnet, NULL);
+}
+
+static int dispatch(uint16_t type, const uint8_t arg[static 1], size_t len)
+{
+    switch (type) {
+    case IFCMD_IP4SET: return perform_ip4set(arg, len);
+    case IFCMD_TIMEZONE: {
+        if (len != 4)
+            break;
+        uint32_t v;
+        memcpy(&v, arg, 4);
+        return perform_timezone((int32_t)ntohl(v));
+    }
+    case IFCMD_ROUTER: {
+        if (len != 4)
+            break;
+        uint32_t router;
+        memcpy(&router, arg, 4);
+        return perform_router(router);
+    }
+    case IFCMD_DNS:
+        if (!valid_iplist(len))
+            break;
+        return perform_dns(arg, len);
+    case IFCMD_LPRSVR:
+        if (!valid_iplist(len))
+            break;
+        return perform_lprsvr(arg, len);
+    case IFCMD_HOSTNAME:
+        if (!valid_str(arg, len))
+            break;
+        return perform_hostname((const char *)arg, len);
+    case IFCMD_DOMAIN:
+        if (!valid_str(arg, len))
+            break;
+        return perform_domain((const char *)arg, len);
+    case IFCMD_IPTTL:
+        if (len != 1)
+            break;
+        return perform_ipttl(arg[0]);
+    case IFCMD_MTU: {
+        if (len != 2)
+            break;
+        uint16_t mtu;
+        memcpy(&mtu, arg, 2);
+        return perform_mtu(ntohs(mtu));
+    }
+    case IFCMD_NTPSVR:
+        if (!valid_iplist(len))
+            break;
+        return perform_ntpsrv(arg, len);
+    case IFCMD_WINS:
+        if (!valid_iplist(len))
+            break;
+        return perform_wins(arg, len);
+    default:
+        log_line("%s: unknown command %u", __func__, type);
+        return -99;
+    }
+    log_line("%s: command %u has an invalid argument length %zu",
+             __func__, type, len);
+    return -99;
+}
+
+/*
+ * Returns -99 on fatal error; that leads to peer connection being closed.
+ * Returns -1 if one of the commands failed.
+ * Returns 0 on success.
+ */
+int execute_buffer(const uint8_t buf[static 1], size_t buflen)
+{
+    int cmdf = 0;
+    size_t off = 0;
+
+    if (!buflen) {
+        log_error("%s: ifch received an empty request",
+                  client_config->interface);
+        return -99;
+    }
+    while (off < buflen) {
+        struct ifch_tlv tlv;
+        if (buflen - off < sizeof tlv) {
+            log_error("%s: ifch received a truncated command header",
+                      client_config->interface);
+            return -99;
+        }
+        memcpy(&tlv, buf + off, sizeof tlv);
+        off += sizeof tlv;
+        if (tlv.len > buflen - off) {
+            log_error("%s: ifch received a truncated command argument",
+                      client_config->interface);
+            return -99;
+        }
+        int pr = dispatch(tlv.type, buf + off, tlv.len);
+        off += tlv.len;
+        if (pr == -99) {
+            log_error("%s: ifch received invalid commands",
+                      client_config->interface);
+            return -99;
+        }
+        cmdf |= pr;
+    }
+    return !cmdf ? 0 : -1;
+}
+
@@ -29,6 +29,9 @@
 #ifndef _NJK_NDHC_IFCHD_PARSE_H_
 #define _NJK_NDHC_IFCHD_PARSE_H_
 
-int execute_buffer(const char newbuf[static 1]);
+#include <stddef.h>
+#include <stdint.h>
+
+int execute_buffer(const uint8_t buf[static 1], size_t buflen);
 
 #endif /* _NJK_NDHC_IFCHD_PARSE_H_ */
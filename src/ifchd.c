@@ -38,6 +38,7 @@
 #include <sys/prctl.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <arpa/inet.h>
 #include <signal.h>
 #include <errno.h>
 #include "nk/log.h"
@@ -72,7 +73,7 @@ static void writeordie(int fd, const char buf[static 1], size_t len)
 {
     ssize_t r = safe_write(fd, buf, len);
     if (r < 0 || (size_t)r != len)
-        suicide("%s: (%s) write failed: %d", client_config.interface,
+        suicide("%s: (%s) write failed: %d", client_config->interface,
                 __func__, r);
 }
 
@@ -84,12 +85,12 @@ static int write_append_fd(int to_fd, int from_fd, const char descr[static 1])
     const off_t lse = lseek(from_fd, 0, SEEK_END);
     if (lse < 0) {
         log_warning("%s: (%s) lseek(SEEK_END) failed %s",
-                    client_config.interface, __func__, descr);
+                    client_config->interface, __func__, descr);
         return -2;
     }
     if (lseek(from_fd, 0, SEEK_SET) < 0) {
         log_warning("%s: (%s) lseek(SEEK_SET) failed %s",
-                    client_config.interface, __func__, descr);
+                    client_config->interface, __func__, descr);
         return -2;
     }
 
@@ -99,10 +100,10 @@ static int write_append_fd(int to_fd, int from_fd, const char descr[static 1])
         const size_t to_read = from_fd_len <= sizeof buf ? from_fd_len : sizeof buf;
         ssize_t r = safe_read(from_fd, buf, to_read);
         if (r < 0 || (size_t)r != to_read)
-            suicide("%s: (%s) read failed %s", client_config.interface, __func__, descr);
+            suicide("%s: (%s) read failed %s", client_config->interface, __func__, descr);
         r = safe_write(to_fd, buf, to_read);
         if (r < 0 || (size_t)r != to_read)
-            suicide("%s: (%s) write failed %s", client_config.interface, __func__, descr);
+            suicide("%s: (%s) write failed %s", client_config->interface, __func__, descr);
         from_fd_len -= to_read;
     }
     return 0;
@@ -119,7 +120,7 @@ static int write_resolve_conf(void)
 
     if (resolv_conf_fd < 0)
         return 0;
-    if (strlen(cl.namesvrs) == 0)
+    if (cl.namesvrs_len == 0)
         return -1;
 
     if (lseek(resolv_conf_fd, 0, SEEK_SET) < 0)
@@ -127,27 +128,18 @@ static int write_resolve_conf(void)
 
     write_append_fd(resolv_conf_fd, resolv_conf_head_fd, "prepending resolv_conf head");
 
-    char *p = cl.namesvrs;
-    while (p && (*p != '\0')) {
-        char *q = strchr(p, ',');
-        if (!q)
-            q = strchr(p, '\0');
-        else
-            *q++ = '\0';
-        ssize_t sl = snprintf(buf, sizeof buf, "%s", p);
-        if (sl < 0 || (size_t)sl >= sizeof buf) {
-            log_warning("%s: (%s) snprintf failed appending nameservers",
-                        client_config.interface, __func__);
+    for (size_t i = 0; i + 4 <= cl.namesvrs_len; i += 4) {
+        if (!inet_ntop(AF_INET, cl.namesvrs + i, buf, sizeof buf)) {
+            log_warning("%s: (%s) inet_ntop failed appending nameservers",
+                        client_config->interface, __func__);
+            continue;
         }
-
         writeordie(resolv_conf_fd, ns_str, strlen(ns_str));
         writeordie(resolv_conf_fd, buf, strlen(buf));
         writeordie(resolv_conf_fd, "\n", 1);
-
-        p = q;
     }
 
-    p = cl.domains;
+    char *p = cl.domains;
     int numdoms = 0;
     while (p && (*p != '\0')) {
         char *q = strchr(p, ',');
@@ -158,7 +150,7 @@ static int write_resolve_conf(void)
         ssize_t sl = snprintf(buf, sizeof buf, "%s", p);
         if (sl < 0 || (size_t)sl >= sizeof buf) {
             log_warning("%s: (%s) snprintf failed appending domains",
-                        client_config.interface, __func__);
+                        client_config->interface, __func__);
         }
 
         if (numdoms == 0) {
@@ -207,39 +199,36 @@ static int write_resolve_conf(void)
 }
 
 /* XXX: addme */
-int perform_timezone(const char str[static 1], size_t len)
+int perform_timezone(int32_t tzoff)
 {
-    (void)len;
-    log_line("Timezone setting NYI: '%s'", str);
+    log_line("Timezone setting NYI: '%d'", tzoff);
     return 0;
 }
 
 /* Add a dns server to the /etc/resolv.conf -- we already have a fd. */
-int perform_dns(const char str[static 1], size_t len)
+int perform_dns(const uint8_t addrs[static 1], size_t len)
 {
     if (resolv_conf_fd < 0)
         return 0;
     int ret = -1;
     if (len > sizeof cl.namesvrs) {
-        log_line("DNS server list is too long: %zu > %zu", len, cl.namesvrs);
+        log_line("DNS server list is too long: %zu > %zu", len,
+                 sizeof cl.namesvrs);
         return ret;
     }
-    ssize_t sl = snprintf(cl.namesvrs, sizeof cl.namesvrs, "%s", str);
-    if (sl < 0 || (size_t)sl >= sizeof cl.namesvrs) {
-        log_warning("%s: (%s) snprintf failed",
-                    client_config.interface, __func__);
-    }
+    memcpy(cl.namesvrs, addrs, len);
+    cl.namesvrs_len = len;
     ret = write_resolve_conf();
     if (ret >= 0)
-        log_line("Added DNS server: '%s'", str);
+        log_line("Added %zu DNS servers.", len / 4);
     return ret;
 }
 
 /* Updates for print daemons are too non-standard to be useful. */
-int perform_lprsvr(const char str[static 1], size_t len)
+int perform_lprsvr(const uint8_t addrs[static 1], size_t len)
 {
-    (void)len;
-    log_line("Line printer server setting NYI: '%s'", str);
+    (void)addrs;
+    log_line("Line printer server setting NYI: %zu servers", len / 4);
     return 0;
 }
 
@@ -252,7 +241,7 @@ int perform_hostname(const char str[static 1], size_t len)
         log_line("sethostname returned %s", strerror(errno));
         return -1;
     }
-    log_line("Set hostname: '%s'", str);
+    log_line("Set hostname: '%.*s'", (int)len, str);
     return 0;
 }
 
@@ -262,63 +251,61 @@ int perform_domain(const char str[static 1], size_t len)
     if (resolv_conf_fd < 0)
         return 0;
     int ret = -1;
-    if (len > sizeof cl.domains) {
-        log_line("DNS domain list is too long: %zu > %zu", len, cl.namesvrs);
+    if (len >= sizeof cl.domains) {
+        log_line("DNS domain list is too long: %zu >= %zu", len,
+                 sizeof cl.domains);
         return ret;
     }
-    ssize_t sl = snprintf(cl.domains, sizeof cl.domains, "%s", str);
-    if (sl < 0 || (size_t)sl >= sizeof cl.domains) {
-        log_warning("%s: (%s) snprintf failed",
-                    client_config.interface, __func__);
-    }
+    memcpy(cl.domains, str, len);
+    cl.domains[len] = '\0';
     ret = write_resolve_conf();
     if (ret <= 0)
-        log_line("Added DNS domain: '%s'", str);
+        log_line("Added DNS domain: '%.*s'", (int)len, str);
     return ret;
 }
 
 /* I don't think this can be done without a netfilter extension
  * that isn't in the mainline kernels. */
-int perform_ipttl(const char str[static 1], size_t len)
+int perform_ipttl(uint8_t ttl)
 {
-    (void)len;
-    log_line("TTL setting NYI: '%s'", str);
+    log_line("TTL setting NYI: '%u'", ttl);
     return 0;
 }
 
 /* XXX: addme */
-int perform_ntpsrv(const char str[static 1], size_t len)
+int perform_ntpsrv(const uint8_t addrs[static 1], size_t len)
 {
-    (void)len;
-    log_line("NTP server setting NYI: '%s'", str);
+    (void)addrs;
+    log_line("NTP server setting NYI: %zu servers", len / 4);
     return 0;
 }
 
 /* Maybe Samba cares about this feature?  I don't know. */
-int perform_wins(const char str[static 1], size_t len)
+int perform_wins(const uint8_t addrs[static 1], size_t len)
 {
-    (void)str;
+    (void)addrs;
     (void)len;
     return 0;
 }
 
-static void inform_execute(char c)
+static void inform_execute(struct ifch_hdr hdr, char c)
 {
-    ssize_t r = safe_write(ifchSock[1], &c, sizeof c);
+    hdr.result = (uint8_t)c;
+    ssize_t r = safe_write(ifchSock[1], (const char *)&hdr, sizeof hdr);
     if (r == 0) {
         // Remote end hung up.
         exit(EXIT_SUCCESS);
     } else if (r < 0)
         suicide("%s: (%s) error writing to ifch -> ndhc socket: %s",
-                client_config.interface, __func__, strerror(errno));
+                client_config->interface, __func__, strerror(errno));
 }
 
 static void process_client_socket(void)
 {
-    char buf[MAX_BUF];
+    uint8_t buf[IFCH_REQ_MAX];
 
-    memset(buf, '\0', sizeof buf);
-    ssize_t r = safe_recv(ifchSock[1], buf, sizeof buf - 1, MSG_DONTWAIT);
+    ssize_t r = safe_recv(ifchSock[1], (char *)buf, sizeof buf,
+                          MSG_DONTWAIT | MSG_TRUNC);
     if (r == 0) {
         // Remote end hung up.
         exit(EXIT_SUCCESS);
@@ -326,17 +313,40 @@ static void process_client_socket(void)
         if (errno == EAGAIN || errno == EWOULDBLOCK)
             return;
         suicide("%s: (%s) error reading from ndhc -> ifch socket: %s",
-                client_config.interface, __func__, strerror(errno));
+                client_config->interface, __func__, strerror(errno));
     }
-
-    int ebr = execute_buffer(buf);
+    if ((size_t)r > sizeof buf)
+        suicide("%s: (%s) received oversized request: %zd",
+                client_config->interface, __func__, r);
+
+    // Every request starts with a header that names the interface it
+    // applies to and that is echoed back in the reply.
+    struct ifch_hdr hdr;
+    if ((size_t)r < sizeof hdr)
+        suicide("%s: (%s) received truncated request",
+                client_config->interface, __func__);
+    memcpy(&hdr, buf, sizeof hdr);
+    if (hdr.idx >= client_count)
+        suicide("%s: (%s) received request for unknown interface %u",
+                client_config->interface, __func__, hdr.idx);
+    client_config = &client_configs[hdr.idx];
+
+    // A buffer that fails to parse is discarded before its route or MTU
+    // requests are sent.  The address is applied as soon as it is parsed,
+    // so that a route or MTU is never set without it; if the kernel
+    // rejects the route or MTU, the address stays and the bind fails.
+    int ebr = execute_buffer(buf + sizeof hdr, (size_t)r - sizeof hdr);
+    if (ebr < 0)
+        perform_discard();
+    else if (perform_flush() < 0)
+        ebr = -1;
     if (ebr < 0) {
-        inform_execute('-');
+        inform_execute(hdr, '-');
         if (ebr == -99)
-            suicide("%s: (%s) received invalid commands: '%s'",
-                    client_config.interface, __func__, buf);
+            suicide("%s: (%s) received invalid commands",
+                    client_config->interface, __func__);
     } else
-        inform_execute('+');
+        inform_execute(hdr, '+');
 }
 
 static void do_ifch_work(void)
@@ -345,9 +355,8 @@ static void do_ifch_work(void)
     if (epollfd < 0)
         suicide("epoll_create1 failed");
 
-    cl.state = STATE_NOTHING;
-    memset(cl.ibuf, 0, sizeof cl.ibuf);
     memset(cl.namesvrs, 0, sizeof cl.namesvrs);
+    cl.namesvrs_len = 0;
     memset(cl.domains, 0, sizeof cl.domains);
 
     epoll_add(epollfd, ifchSock[1]);
@@ -2,32 +2,60 @@
 #define NJK_IFCHD_H_
 
 #include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <net/if.h>
 #include "ndhc-defines.h"
 
-enum ifchd_states {
-    STATE_NOTHING,
-    STATE_IP4SET,
-    STATE_TIMEZONE,
-    STATE_ROUTER,
-    STATE_DNS,
-    STATE_LPRSVR,
-    STATE_HOSTNAME,
-    STATE_DOMAIN,
-    STATE_IPTTL,
-    STATE_MTU,
-    STATE_NTPSVR,
-    STATE_WINS,
-    STATE_CARRIER,
+// Requests from the master to ifch are a struct ifch_hdr followed by a
+// sequence of TLVs.  Each TLV is a struct ifch_tlv header (host byte
+// order) and then len bytes of argument.  Addresses and the other numeric
+// arguments are carried exactly as they appear in the DHCP option, ie, in
+// network byte order.
+//
+// Requests are pipelined: the master does not wait for each to complete.
+// ifch handles them in order and answers each with a copy of its
+// ifch_hdr in which result is set to '+' or '-'.
+enum ifch_cmd {
+    IFCMD_NONE = 0,
+    IFCMD_IP4SET,   // ip[4] subnet[4] (broadcast[4])
+    IFCMD_TIMEZONE, // s32
+    IFCMD_ROUTER,   // ip[4]
+    IFCMD_DNS,      // ip[4] * n
+    IFCMD_LPRSVR,   // ip[4] * n
+    IFCMD_HOSTNAME, // string
+    IFCMD_DOMAIN,   // string
+    IFCMD_IPTTL,    // u8
+    IFCMD_MTU,      // u16
+    IFCMD_NTPSVR,   // ip[4] * n
+    IFCMD_WINS,     // ip[4] * n
 };
 
-#include <net/if.h>
+enum ifch_op {
+    IFCH_OP_BIND = 1,
+    IFCH_OP_DECONFIG,
+};
+
+struct ifch_hdr {
+    uint32_t seq;    // Increments by one with each request.
+    uint16_t idx;    // Index of the interface in client_configs.
+    uint8_t op;      // enum ifch_op; only interpreted by the master.
+    uint8_t result;  // Zero in requests; '+' or '-' in replies.
+};
+
+struct ifch_tlv {
+    uint16_t type;
+    uint16_t len;
+};
+
+// Large enough for every command of a bind with maximally sized options.
+#define IFCH_REQ_MAX 4096
+
 struct ifchd_client {
-    /* Socket fd, current state, and idle time for connection. */
-    int state;
-    /* Per-connection buffer. */
-    char ibuf[MAX_BUF];
-    /* ' '-delimited buffers of nameservers and domains */
-    char namesvrs[MAX_BUF];
+    // Raw IPv4 addresses of the nameservers.
+    uint8_t namesvrs[MAX_BUF];
+    size_t namesvrs_len;
+    // ','-delimited list of domains.
     char domains[MAX_BUF];
 };
 
@@ -37,14 +65,14 @@ extern int allow_hostname;
 extern uid_t ifch_uid;
 extern gid_t ifch_gid;
 
-int perform_timezone(const char str[static 1], size_t len);
-int perform_dns(const char str[static 1], size_t len);
-int perform_lprsvr(const char str[static 1], size_t len);
+int perform_timezone(int32_t tzoff);
+int perform_dns(const uint8_t addrs[static 1], size_t len);
+int perform_lprsvr(const uint8_t addrs[static 1], size_t len);
 int perform_hostname(const char str[static 1], size_t len);
 int perform_domain(const char str[static 1], size_t len);
-int perform_ipttl(const char str[static 1], size_t len);
-int perform_ntpsrv(const char str[static 1], size_t len);
-int perform_wins(const char str[static 1], size_t len);
+int perform_ipttl(uint8_t ttl);
+int perform_ntpsrv(const uint8_t addrs[static 1], size_t len);
+int perform_wins(const uint8_t addrs[static 1], size_t len);
 
 void ifch_main(void);
 
@@ -73,83 +73,152 @@ static inline int subnet4_to_prefixlen(uint32_t sn)
 }
 
 struct ipbcpfx {
-    int fd;
     uint32_t ipaddr;
     uint32_t bcast;
     uint8_t prefixlen;
     bool already_ok;
 };
 
-static ssize_t rtnl_do_send(int fd, const uint8_t *sbuf, size_t slen,
-                            const char *fnname)
+// All of the rtnetlink requests needed for one ifch command buffer are
+// queued into nl_batch and handed to the kernel by a single sendmsg() in
+// rtnl_flush().  The kernel processes the messages in order and ACKs each
+// one; the ACKs are matched back to their requests by sequence number.
+// A rejected message does not stop the kernel from applying the ones
+// after it, so requests that depend on an earlier one are not put in the
+// same batch with it.
+#define NL_BATCH_MAX 16
+static uint8_t nl_batch[4096];
+static size_t nl_batch_len;
+static size_t nl_batch_count;
+static uint32_t nl_batch_seq[NL_BATCH_MAX];
+static const char *nl_batch_fn[NL_BATCH_MAX];
+// Set when the address could not be applied; the route and MTU that
+// depend on it are then not queued for the rest of the command buffer.
+static bool nl_batch_failed;
+
+// Kept open for the life of ifch rather than opened for each command.
+static int ifset_nlfd = -1;
+
+static int ifset_nl_fd(void)
 {
-    uint8_t response[NLMSG_ALIGN(sizeof(struct nlmsghdr)) + 64];
-    struct sockaddr_nl nl_addr;
-
-    memset(&nl_addr, 0, sizeof nl_addr);
-    nl_addr.nl_family = AF_NETLINK;
-
-    ssize_t r = safe_sendto(fd, (const char *)sbuf, slen, 0,
-                            (struct sockaddr *)&nl_addr, sizeof nl_addr);
-    if (r < 0 || (size_t)r != slen) {
-        if (r < 0)
-            log_error("%s: (%s) netlink sendto failed: %s",
-                      client_config.interface, fnname, strerror(errno));
-        else
-            log_error("%s: (%s) netlink sendto short write: %z < %zu",
-                      client_config.interface, fnname, r, slen);
-        return -1;
-    }
-    struct iovec iov = {
-        .iov_base = response,
-        .iov_len = sizeof response,
-    };
-    struct msghdr msg = {
-        .msg_name = &nl_addr,
-        .msg_namelen = sizeof nl_addr,
-        .msg_iov = &iov,
-        .msg_iovlen = 1,
-    };
-    r = safe_recvmsg(fd, &msg, 0);
-    if (r < 0) {
-        log_error("%s: (%s) netlink recvmsg failed: %s",
-                  client_config.interface, fnname, strerror(errno));
+    if (ifset_nlfd >= 0)
+        return ifset_nlfd;
+    ifset_nlfd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        NETLINK_ROUTE);
+    if (ifset_nlfd < 0) {
+        log_error("%s: (%s) netlink socket open failed: %s",
+                  client_config->interface, __func__, strerror(errno));
         return -1;
     }
-    if (msg.msg_flags & MSG_TRUNC) {
-        log_error("%s: (%s) Buffer not long enough for message.",
-                  client_config.interface, fnname);
+    // Kernels that lack strict checking dump every address on the host;
+    // ipbcpfx_clear_others_do() still filters by ifindex for them.
+    nl_set_strict_check(ifset_nlfd);
+    return ifset_nlfd;
+}
+
+static ssize_t rtnl_queue(const uint8_t *sbuf, size_t slen,
+                          const char *fnname)
+{
+    const struct nlmsghdr *nlh = (const struct nlmsghdr *)sbuf;
+    if (nl_batch_failed) {
+        log_error("%s: (%s) skipped because the address was not set",
+                  client_config->interface, fnname);
         return -1;
     }
-    if ((size_t)r < sizeof(struct nlmsghdr)) {
-        log_line("%s: (%s) netlink recvmsg returned a headerless response",
-                 client_config.interface, fnname);
+    if (nl_batch_count >= NL_BATCH_MAX ||
+        nl_batch_len + NLMSG_ALIGN(slen) > sizeof nl_batch) {
+        log_error("%s: (%s) netlink request batch is full",
+                  client_config->interface, fnname);
         return -1;
     }
-    const struct nlmsghdr *nlh = (const struct nlmsghdr *)response;
-    if (nlh->nlmsg_type == NLMSG_ERROR) {
-        int nlerr = nlmsg_get_error(nlh);
-        if (nlerr == 0)
-            return 0;
-        else {
+    memcpy(nl_batch + nl_batch_len, sbuf, slen);
+    memset(nl_batch + nl_batch_len + slen, 0, NLMSG_ALIGN(slen) - slen);
+    nl_batch_len += NLMSG_ALIGN(slen);
+    nl_batch_seq[nl_batch_count] = nlh->nlmsg_seq;
+    nl_batch_fn[nl_batch_count] = fnname;
+    ++nl_batch_count;
+    return 0;
+}
+
+static void rtnl_discard(void)
+{
+    nl_batch_len = 0;
+    nl_batch_count = 0;
+}
+
+// Return  0 if every queued request was ACKed without error.
+// Return -1 on error.
+// Return -3 if RFKILL is set and the interface cannot be changed.
+static int rtnl_flush(int fd)
+{
+    uint8_t response[8192];
+    bool acked[NL_BATCH_MAX] = {0};
+    size_t pending = nl_batch_count;
+    int ret = 0;
+
+    if (!pending)
+        return 0;
+
+    struct sockaddr_nl nl_addr = { .nl_family = AF_NETLINK };
+    ssize_t r = safe_sendto(fd, (const char *)nl_batch, nl_batch_len, 0,
+                            (struct sockaddr *)&nl_addr, sizeof nl_addr);
+    if (r < 0 || (size_t)r != nl_batch_len) {
+        if (r < 0)
+            log_error("%s: (%s) netlink sendto failed: %s",
+                      client_config->interface, __func__, strerror(errno));
+        else
+            log_error("%s: (%s) netlink sendto short write: %zd < %zu",
+                      client_config->interface, __func__, r, nl_batch_len);
+        ret = -1;
+        goto out;
+    }
+    // rtnetlink requests are processed synchronously within sendto(), so
+    // every ACK is already queued on the socket when it returns.
+    while (pending) {
+        r = nl_recv_buf(fd, (char *)response, sizeof response);
+        if (r <= 0) {
+            log_error("%s: (%s) netlink is missing %zu ACKs",
+                      client_config->interface, __func__, pending);
+            ret = -1;
+            goto out;
+        }
+        size_t rlen = (size_t)r;
+        for (const struct nlmsghdr *nlh = (const struct nlmsghdr *)response;
+             NLMSG_OK(nlh, rlen); nlh = NLMSG_NEXT(nlh, rlen)) {
+            if (nlh->nlmsg_type != NLMSG_ERROR)
+                continue;
+            size_t i = 0;
+            for (; i < nl_batch_count; ++i) {
+                if (nl_batch_seq[i] == nlh->nlmsg_seq)
+                    break;
+            }
+            // Stale replies to an earlier, abandoned request are ignored.
+            if (i == nl_batch_count || acked[i])
+                continue;
+            acked[i] = true;
+            --pending;
+            int nlerr = nlmsg_get_error(nlh);
+            if (nlerr == 0)
+                continue;
             if (nlerr == 132) {
                 log_line("%s: (%s) RF-kill is set (%d).  Cannot change interface.",
-                         client_config.interface, fnname, nlerr);
-                return -3;
+                         client_config->interface, nl_batch_fn[i], nlerr);
+                if (!ret)
+                    ret = -3;
+                continue;
             }
             log_error("%s: (%s) netlink sendto returned NLMSG_ERROR: %s",
-                      client_config.interface, fnname, strerror(nlerr));
-            return -1;
+                      client_config->interface, nl_batch_fn[i],
+                      strerror(nlerr));
+            ret = -1;
         }
     }
-    if (nlh->nlmsg_type == NLMSG_DONE)
-        return -2;
-    log_error("%s: (%s) netlink sendto returned an error.",
-              client_config.interface, __func__);
-    return -1;
+  out:
+    rtnl_discard();
+    return ret;
 }
 
-static ssize_t rtnl_if_flags_send(int fd, int type, unsigned ifi_flags)
+static ssize_t rtnl_if_flags_queue(unsigned ifi_flags, unsigned ifi_change)
 {
     uint8_t request[NLMSG_ALIGN(sizeof(struct nlmsghdr)) +
                     NLMSG_ALIGN(sizeof(struct ifinfomsg))];
@@ -159,19 +228,19 @@ static ssize_t rtnl_if_flags_send(int fd, int type, unsigned ifi_flags)
     memset(&request, 0, sizeof request);
     header = (struct nlmsghdr *)request;
     header->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-    header->nlmsg_type = type;
+    header->nlmsg_type = RTM_SETLINK;
     header->nlmsg_flags = NLM_F_ACK | NLM_F_REQUEST;
     header->nlmsg_seq = ifset_nl_seq++;
 
     ifinfomsg = NLMSG_DATA(header);
     ifinfomsg->ifi_flags = ifi_flags;
-    ifinfomsg->ifi_index = client_config.ifindex;
-    ifinfomsg->ifi_change = 0xffffffff;
+    ifinfomsg->ifi_index = client_config->ifindex;
+    ifinfomsg->ifi_change = ifi_change;
 
-    return rtnl_do_send(fd, request, header->nlmsg_len, __func__);
+    return rtnl_queue(request, header->nlmsg_len, __func__);
 }
 
-static ssize_t rtnl_addr_broadcast_send(int fd, int type, int ifa_flags,
+static ssize_t rtnl_addr_broadcast_queue(int type, int ifa_flags,
                                         int ifa_scope, uint32_t *ipaddr,
                                         uint32_t *bcast, uint8_t prefixlen)
 {
@@ -183,7 +252,7 @@ static ssize_t rtnl_addr_broadcast_send(int fd, int type, int ifa_flags,
 
     if (!ipaddr && !bcast) {
         log_warning("%s: (%s) no ipaddr or bcast!",
-                    client_config.interface, __func__);
+                    client_config->interface, __func__);
         return -1;
     }
 
@@ -200,13 +269,13 @@ static ssize_t rtnl_addr_broadcast_send(int fd, int type, int ifa_flags,
     ifaddrmsg->ifa_flags = ifa_flags;
     ifaddrmsg->ifa_scope = ifa_scope;
     // Linux is inconsistent about the type of ifindex.
-    ifaddrmsg->ifa_index = (uint32_t)client_config.ifindex;
+    ifaddrmsg->ifa_index = (uint32_t)client_config->ifindex;
 
     if (ipaddr) {
         if (nl_add_rtattr(header, sizeof request, IFA_LOCAL,
                           ipaddr, sizeof *ipaddr) < 0) {
             log_error("%s: (%s) couldn't add IFA_LOCAL to nlmsg",
-                      client_config.interface, __func__);
+                      client_config->interface, __func__);
             return -1;
         }
     }
@@ -214,15 +283,15 @@ static ssize_t rtnl_addr_broadcast_send(int fd, int type, int ifa_flags,
         if (nl_add_rtattr(header, sizeof request, IFA_BROADCAST,
                           bcast, sizeof *bcast) < 0) {
             log_error("%s: (%s) couldn't add IFA_BROADCAST to nlmsg",
-                      client_config.interface, __func__);
+                      client_config->interface, __func__);
             return -1;
         }
     }
 
-    return rtnl_do_send(fd, request, header->nlmsg_len, __func__);
+    return rtnl_queue(request, header->nlmsg_len, __func__);
 }
 
-static ssize_t rtnl_set_default_gw_v4(int fd, uint32_t gw4, int metric)
+static ssize_t rtnl_set_default_gw_v4(uint32_t gw4, int metric)
 {
     uint8_t request[NLMSG_ALIGN(sizeof(struct nlmsghdr)) +
                     NLMSG_ALIGN(sizeof(struct rtmsg)) +
@@ -249,36 +318,35 @@ static ssize_t rtnl_set_default_gw_v4(int fd, uint32_t gw4, int metric)
     if (nl_add_rtattr(header, sizeof request, RTA_DST,
                       &dstaddr4, sizeof dstaddr4) < 0) {
         log_error("%s: (%s) couldn't add RTA_DST to nlmsg",
-                  client_config.interface, __func__);
+                  client_config->interface, __func__);
         return -1;
     }
     if (nl_add_rtattr(header, sizeof request, RTA_OIF,
-                      &client_config.ifindex,
-                      sizeof client_config.ifindex) < 0) {
+                      &client_config->ifindex,
+                      sizeof client_config->ifindex) < 0) {
         log_error("%s: (%s) couldn't add RTA_OIF to nlmsg",
-                  client_config.interface, __func__);
+                  client_config->interface, __func__);
         return -1;
     }
     if (nl_add_rtattr(header, sizeof request, RTA_GATEWAY,
                       &gw4, sizeof gw4) < 0) {
         log_error("%s: (%s) couldn't add RTA_GATEWAY to nlmsg",
-                  client_config.interface, __func__);
+                  client_config->interface, __func__);
         return -1;
     }
     if (metric > 0) {
         if (nl_add_rtattr(header, sizeof request, RTA_PRIORITY,
                           &metric, sizeof metric) < 0) {
             log_error("%s: (%s) couldn't add RTA_PRIORITY to nlmsg",
-                      client_config.interface, __func__);
+                      client_config->interface, __func__);
             return -1;
         }
     }
 
-    return rtnl_do_send(fd, request, header->nlmsg_len, __func__);
+    return rtnl_queue(request, header->nlmsg_len, __func__);
 }
 
 struct link_flag_data {
-    int fd;
     uint32_t flags;
     bool got_flags;
 };
@@ -290,7 +358,7 @@ static void link_flags_get_do(const struct nlmsghdr *nlh, void *data)
 
     switch(nlh->nlmsg_type) {
         case RTM_NEWLINK:
-            if (ifm->ifi_index != client_config.ifindex)
+            if (ifm->ifi_index != client_config->ifindex)
                 break;
             ifd->flags = ifm->ifi_flags;
             ifd->got_flags = true;
@@ -307,10 +375,10 @@ static void link_flags_get_do(const struct nlmsghdr *nlh, void *data)
 static int link_flags_get(int fd, uint32_t flags[static 1])
 {
     char nlbuf[8192];
-    struct link_flag_data ipx = { .fd = fd, .flags = 0, .got_flags = false };
+    struct link_flag_data ipx = { .flags = 0, .got_flags = false };
     ssize_t ret;
     uint32_t seq = ifset_nl_seq++;
-    if (nl_sendgetlink(fd, seq, client_config.ifindex) < 0)
+    if (nl_sendgetlink(fd, seq, client_config->ifindex) < 0)
         return -1;
 
     do {
@@ -327,27 +395,6 @@ static int link_flags_get(int fd, uint32_t flags[static 1])
     return -4;
 }
 
-int perform_carrier(void)
-{
-    int ret = -1;
-    uint32_t flags;
-    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK, NETLINK_ROUTE);
-    if (fd < 0) {
-        log_error("%s: (%s) netlink socket open failed: %s",
-                  client_config.interface, __func__, strerror(errno));
-        goto fail;
-    }
-
-    if (link_flags_get(fd, &flags) < 0)
-        goto fail_fd;
-    if ((flags & IFF_RUNNING) && (flags & IFF_UP))
-        ret = 0;
-fail_fd:
-    close(fd);
-fail:
-    return ret;
-}
-
 // Return  0 if flags were successfully changed.
 // Return  1 if flags were already set.
 // Return -1 on error.
@@ -360,12 +407,14 @@ static int link_set_flags(int fd, uint32_t flags)
     int r = link_flags_get(fd, &oldflags);
     if (r < 0) {
         log_error("%s: (%s) failed to get old link flags: %u",
-                  client_config.interface, __func__, r);
+                  client_config->interface, __func__, r);
         return -1;
     }
     if ((oldflags & flags) == flags)
         return 1;
-    return (int)rtnl_if_flags_send(fd, RTM_SETLINK, flags | oldflags);
+    if (rtnl_if_flags_queue(flags, flags) < 0)
+        return -1;
+    return rtnl_flush(fd);
 }
 
 #if 0
@@ -376,12 +425,14 @@ static int link_unset_flags(int fd, uint32_t flags)
     int r = link_flags_get(fd, &oldflags);
     if (r < 0) {
         log_error("%s: (%s) failed to get old link flags: %u",
-                  client_config.interface, __func__, r);
+                  client_config->interface, __func__, r);
         return -1;
     }
     if ((oldflags & flags) == 0)
         return 1;
-    return (int)rtnl_if_flags_send(fd, RTM_SETLINK, oldflags & ~flags);
+    if (rtnl_if_flags_queue(0, flags) < 0)
+        return -1;
+    return rtnl_flush(fd);
 }
 #endif
 
@@ -395,7 +446,7 @@ static void ipbcpfx_clear_others_do(const struct nlmsghdr *nlh, void *data)
     nl_rtattr_parse(nlh, sizeof *ifm, rtattr_assign, tb);
     switch(nlh->nlmsg_type) {
         case RTM_NEWADDR:
-            if (ifm->ifa_index != (unsigned)client_config.ifindex)
+            if (ifm->ifa_index != (unsigned)client_config->ifindex)
                 return;
             if (ifm->ifa_family != AF_INET)
                 return;
@@ -424,14 +475,14 @@ static void ipbcpfx_clear_others_do(const struct nlmsghdr *nlh, void *data)
     return;
 
   erase:
-    r = rtnl_addr_broadcast_send(ipx->fd, RTM_DELADDR, ifm->ifa_flags,
+    r = rtnl_addr_broadcast_queue(RTM_DELADDR, ifm->ifa_flags,
                                  ifm->ifa_scope,
                                  tb[IFA_ADDRESS] ? RTA_DATA(tb[IFA_ADDRESS]) : NULL,
                                  tb[IFA_BROADCAST] ? RTA_DATA(tb[IFA_BROADCAST]) : NULL,
                                  ifm->ifa_prefixlen);
-    if (r < 0 && r != -2) {
+    if (r < 0) {
         log_warning("%s: (%s) Failed to delete IP and broadcast addresses.",
-                    client_config.interface, __func__);
+                    client_config->interface, __func__);
     }
     return;
 }
@@ -440,11 +491,11 @@ static int ipbcpfx_clear_others(int fd, uint32_t ipaddr, uint32_t bcast,
                                 uint8_t prefixlen)
 {
     char nlbuf[8192];
-    struct ipbcpfx ipx = { .fd = fd, .ipaddr = ipaddr, .bcast = bcast,
+    struct ipbcpfx ipx = { .ipaddr = ipaddr, .bcast = bcast,
                            .prefixlen = prefixlen, .already_ok = false };
     ssize_t ret;
     uint32_t seq = ifset_nl_seq++;
-    if (nl_sendgetaddr4(fd, seq, (uint32_t)client_config.ifindex) < 0)
+    if (nl_sendgetaddr4(fd, seq, (uint32_t)client_config->ifindex) < 0)
         return -1;
 
     do {
@@ -458,21 +509,13 @@ static int ipbcpfx_clear_others(int fd, uint32_t ipaddr, uint32_t bcast,
     return ipx.already_ok ? 1 : 0;
 }
 
-static ssize_t rtnl_if_mtu_set(int fd, unsigned int mtu)
+static ssize_t rtnl_if_mtu_set(unsigned int mtu)
 {
     uint8_t request[NLMSG_ALIGN(sizeof(struct nlmsghdr)) +
                     NLMSG_ALIGN(sizeof(struct ifinfomsg)) +
                     RTA_LENGTH(sizeof(unsigned int))];
     struct nlmsghdr *header;
     struct ifinfomsg *ifinfomsg;
-    uint32_t oldflags;
-
-    int r = link_flags_get(fd, &oldflags);
-    if (r < 0) {
-        log_error("%s: (%s) failed to get old link flags: %u",
-                  client_config.interface, __func__, r);
-        return -1;
-    }
 
     memset(&request, 0, sizeof request);
     header = (struct nlmsghdr *)request;
@@ -481,27 +524,28 @@ static ssize_t rtnl_if_mtu_set(int fd, unsigned int mtu)
     header->nlmsg_flags = NLM_F_ACK | NLM_F_REQUEST;
     header->nlmsg_seq = ifset_nl_seq++;
 
+    // ifi_change is zero, so the link flags are left alone.
     ifinfomsg = NLMSG_DATA(header);
-    ifinfomsg->ifi_flags = oldflags;
-    ifinfomsg->ifi_index = client_config.ifindex;
-    ifinfomsg->ifi_change = 0xffffffff;
+    ifinfomsg->ifi_index = client_config->ifindex;
 
     if (nl_add_rtattr(header, sizeof request, IFLA_MTU,
                       &mtu, sizeof mtu) < 0) {
         log_error("%s: (%s) couldn't add IFLA_MTU to nlmsg",
-                  client_config.interface, __func__);
+                  client_config->interface, __func__);
         return -1;
     }
 
-    return rtnl_do_send(fd, request, header->nlmsg_len, __func__);
+    return rtnl_queue(request, header->nlmsg_len, __func__);
 }
 
+// Called by the master before ifch is spawned, so it uses a private
+// socket rather than the one that ifch keeps open.
 int perform_ifup(void)
 {
     int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK, NETLINK_ROUTE);
     if (fd < 0) {
         log_line("%s: (%s) netlink socket open failed: %s",
-                 client_config.interface, __func__, strerror(errno));
+                 client_config->interface, __func__, strerror(errno));
         return fd;
     }
 
@@ -509,180 +553,143 @@ int perform_ifup(void)
     if (r < 0) {
         if (r != -3)
             log_error("%s: (%s) Failed to set link to be up.",
-                      client_config.interface, __func__);
+                      client_config->interface, __func__);
         else
             log_line("%s: (%s) rfkill is set; waiting until it is unset",
-                     client_config.interface, __func__);
+                     client_config->interface, __func__);
     }
     close(fd);
     return r;
 }
 
-// str_bcast is optional.
-int perform_ip_subnet_bcast(const char str_ipaddr[static 1],
-                            const char str_subnet[static 1],
-                            const char *str_bcast)
+// All addresses are in network order; bcast is optional.  Netlink and
+// kernel errors return -1, which fails only this bind; -99 is kept for
+// malformed requests.
+int perform_ip_subnet_bcast(uint32_t ipaddr, uint32_t subnet,
+                            const uint32_t *bcast)
 {
-    struct in_addr ipaddr, subnet, bcast;
-    int fd, r, ret = -99;
+    char str_ipaddr[INET_ADDRSTRLEN], str_subnet[INET_ADDRSTRLEN];
+    char str_bcast[INET_ADDRSTRLEN];
+    int fd, r, ret = -1;
     uint8_t prefixlen;
 
-    if (inet_pton(AF_INET, str_ipaddr, &ipaddr) <= 0) {
-        log_error("%s: (%s) bad interface ip address: '%s'",
-                  client_config.interface, __func__, str_ipaddr);
-        goto fail;
-    }
+    prefixlen = subnet4_to_prefixlen(subnet);
+    // Generate the standard broadcast address if unspecified.
+    uint32_t bcaddr = bcast ? *bcast
+                            : ipaddr | htonl(0xfffffffflu >> prefixlen);
 
-    if (inet_pton(AF_INET, str_subnet, &subnet) <= 0) {
-        log_error("%s: (%s) bad interface subnet address: '%s'",
-                  client_config.interface, __func__, str_subnet);
+    fd = ifset_nl_fd();
+    if (fd < 0)
         goto fail;
-    }
-    prefixlen = subnet4_to_prefixlen(subnet.s_addr);
-
-    if (str_bcast) {
-        if (inet_pton(AF_INET, str_bcast, &bcast) <= 0) {
-            log_error("%s: (%s) bad interface broadcast address: '%s'",
-                      client_config.interface, __func__, str_bcast);
-            goto fail;
-        }
-    } else {
-        // Generate the standard broadcast address if unspecified.
-        bcast.s_addr = ipaddr.s_addr | htonl(0xfffffffflu >> prefixlen);
-    }
 
-    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK, NETLINK_ROUTE);
-    if (fd < 0) {
-        log_error("%s: (%s) netlink socket open failed: %s",
-                  client_config.interface, __func__, strerror(errno));
-        goto fail;
-    }
-
-    r = ipbcpfx_clear_others(fd, ipaddr.s_addr, bcast.s_addr, prefixlen);
+    r = ipbcpfx_clear_others(fd, ipaddr, bcaddr, prefixlen);
     if (r < 0 && r > -3) {
         if (r == -1)
             log_error("%s: (%s) error requesting link ip address list",
-                      client_config.interface, __func__);
+                      client_config->interface, __func__);
         else if (r == -2)
             log_error("%s: (%s) error receiving link ip address list",
-                      client_config.interface, __func__);
-        goto fail_fd;
+                      client_config->interface, __func__);
+        goto fail;
     }
 
     if (r < 1) {
-        r = rtnl_addr_broadcast_send(fd, RTM_NEWADDR, IFA_F_PERMANENT,
-                                     RT_SCOPE_UNIVERSE, &ipaddr.s_addr, &bcast.s_addr,
-                                     prefixlen);
+        r = rtnl_addr_broadcast_queue(RTM_NEWADDR, IFA_F_PERMANENT,
+                                      RT_SCOPE_UNIVERSE, &ipaddr, &bcaddr,
+                                      prefixlen);
         if (r < 0)
-            goto fail_fd;
+            goto fail;
 
-        log_line("%s: Interface IP set to: '%s'", client_config.interface,
+        inet_ntop(AF_INET, &ipaddr, str_ipaddr, sizeof str_ipaddr);
+        inet_ntop(AF_INET, &subnet, str_subnet, sizeof str_subnet);
+        log_line("%s: Interface IP set to: '%s'", client_config->interface,
                  str_ipaddr);
-        log_line("%s: Interface subnet set to: '%s'", client_config.interface,
+        log_line("%s: Interface subnet set to: '%s'", client_config->interface,
                  str_subnet);
-        if (str_bcast)
+        if (bcast) {
+            inet_ntop(AF_INET, bcast, str_bcast, sizeof str_bcast);
             log_line("%s: Broadcast address set to: '%s'",
-                     client_config.interface, str_bcast);
+                     client_config->interface, str_bcast);
+        }
     } else
         log_line("%s: Interface IP, subnet, and broadcast were already OK.",
-                 client_config.interface);
+                 client_config->interface);
 
-    if (link_set_flags(fd, IFF_UP | IFF_RUNNING) < 0) {
-        ret = -1;
+    // IFF_RUNNING is owned by the driver, so only IFF_UP is changed.
+    if (rtnl_if_flags_queue(IFF_UP, IFF_UP) < 0) {
         log_error("%s: (%s) Failed to set link to be up and running.",
-                  client_config.interface, __func__);
-        goto fail_fd;
+                  client_config->interface, __func__);
+        goto fail;
+    }
+    // Applied now, as the route and MTU that may follow depend on it.
+    if (rtnl_flush(fd) < 0) {
+        nl_batch_failed = true;
+        log_error("%s: (%s) Failed to set the interface address.",
+                  client_config->interface, __func__);
+        goto fail;
     }
     ret = 0;
-fail_fd:
-    close(fd);
 fail:
     return ret;
 }
 
 
-int perform_router(const char str_router[static 1], size_t len)
+// router is in network order.
+int perform_router(uint32_t router)
 {
-    int ret = -99;
-    if (len < 7)
-        goto fail;
-    struct in_addr router;
-    if (inet_pton(AF_INET, str_router, &router) <= 0) {
-        log_error("%s: (%s) bad router ip address: '%s'",
-                  client_config.interface, __func__, str_router);
-        goto fail;
-    }
-
-    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK, NETLINK_ROUTE);
-    if (fd < 0) {
-        log_error("%s: (%s) netlink socket open failed: %s",
-                  client_config.interface, __func__, strerror(errno));
-        goto fail;
-    }
-
-    if (rtnl_set_default_gw_v4(fd, router.s_addr, client_config.metric) < 0) {
-        log_error("%s: (%s) failed to set route: %s",
-                  client_config.interface, __func__, strerror(errno));
-        goto fail_fd;
+    char str_router[INET_ADDRSTRLEN];
+    if (rtnl_set_default_gw_v4(router, client_config->metric) < 0) {
+        log_error("%s: (%s) failed to set route",
+                  client_config->interface, __func__);
+        return -1;
     }
-    log_line("%s: Gateway router set to: '%s'", client_config.interface,
+    inet_ntop(AF_INET, &router, str_router, sizeof str_router);
+    log_line("%s: Gateway router set to: '%s'", client_config->interface,
              str_router);
-    ret = 0;
-fail_fd:
-    close(fd);
-fail:
-    return ret;
+    return 0;
 }
 
-int perform_mtu(const char str[static 1], size_t len)
+int perform_mtu(uint16_t mtu)
 {
-    unsigned int mtu;
-    int fd, ret = -99;
-    if (len < 2)
-        goto fail;
-
-    char *estr;
-    long tmtu = strtol(str, &estr, 10);
-    if (estr == str) {
-        log_error("%s: (%s) provided mtu arg isn't a valid number",
-                  client_config.interface, __func__);
-        goto fail;
-    }
-    if ((tmtu == LONG_MAX || tmtu == LONG_MIN) && errno == ERANGE) {
-        log_error("%s: (%s) provided mtu arg would overflow a long",
-                  client_config.interface, __func__);
-        goto fail;
-    }
-    if (tmtu > INT_MAX) {
-        log_error("%s: (%s) provided mtu arg would overflow int",
-                  client_config.interface, __func__);
-        goto fail;
-    }
     // 68 bytes for IPv4.  1280 bytes for IPv6.
-    if (tmtu < 68) {
-        log_error("%s: (%s) provided mtu arg (%ul) less than minimum MTU (68)",
-                  client_config.interface, __func__, tmtu);
-        goto fail;
+    if (mtu < 68) {
+        log_error("%s: (%s) provided mtu arg (%u) less than minimum MTU (68)",
+                  client_config->interface, __func__, mtu);
+        return -99;
+    }
+    if (rtnl_if_mtu_set(mtu) < 0) {
+        log_error("%s: (%s) failed to set MTU [%u]",
+                  client_config->interface, __func__, mtu);
+        return -1;
     }
-    mtu = (unsigned int)tmtu;
+    log_line("%s: MTU set to: '%u'", client_config->interface, mtu);
+    return 0;
+}
 
-    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK, NETLINK_ROUTE);
-    if (fd < 0) {
-        log_error("%s: (%s) netlink socket open failed: %s",
-                  client_config.interface, __func__, strerror(errno));
-        goto fail;
+// Sends the netlink requests that the perform_*() functions above queued
+// after the address in one batch, and ends the command buffer.  Returns 0
+// only if the kernel accepted all of them.
+int perform_flush(void)
+{
+    bool failed = nl_batch_failed;
+    nl_batch_failed = false;
+    if (failed) {
+        rtnl_discard();
+        return -1;
     }
-
-    if (rtnl_if_mtu_set(fd, mtu) < 0) {
-        log_error("%s: (%s) failed to set MTU [%d]",
-                  client_config.interface, __func__, mtu);
-        goto fail_fd;
+    if (!nl_batch_count)
+        return 0;
+    int fd = ifset_nl_fd();
+    if (fd < 0) {
+        rtnl_discard();
+        return -1;
     }
-    log_line("%s: MTU set to: '%s'", client_config.interface, str);
-    ret = 0;
-fail_fd:
-    close(fd);
-fail:
-    return ret;
+    return rtnl_flush(fd) < 0 ? -1 : 0;
 }
 
+
+void perform_discard(void)
+{
+    nl_batch_failed = false;
+    rtnl_discard();
+}
@@ -28,12 +28,13 @@
 
 #ifndef NJK_IFSET_H_
 #define NJK_IFSET_H_
-int perform_carrier(void);
+#include <stdint.h>
 int perform_ifup(void);
-int perform_ip_subnet_bcast(const char str_ipaddr[static 1],
-                            const char str_subnet[static 1],
-                            const char *str_bcast);
-int perform_router(const char str[static 1], size_t len);
-int perform_mtu(const char *str, size_t len);
+int perform_ip_subnet_bcast(uint32_t ipaddr, uint32_t subnet,
+                            const uint32_t *bcast);
+int perform_router(uint32_t router);
+int perform_mtu(uint16_t mtu);
+int perform_flush(void);
+void perform_discard(void);
 #endif
 
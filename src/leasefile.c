@@ -37,70 +37,293 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <limits.h>
+#include <time.h>
 #include "nk/log.h"
 #include "nk/io.h"
 #include "leasefile.h"
 #include "ndhc.h"
 
-static int leasefilefd = -1;
+// Opened for every interface by open_leasefile() before use.
+static int leasefilefds[NDHC_MAX_IFACES];
+static int leaserecfds[NDHC_MAX_IFACES];
+// state_dir, opened before we chroot so that the lease record files can
+// still be replaced by name afterwards.
+static int statedirfd = -1;
 
-static void get_leasefile_path(char *leasefile, size_t dlen, char *ifname)
+static void get_leasefile_path(char *leasefile, size_t dlen,
+                               const char *prefix, char *ifname)
 {
-    int splen = snprintf(leasefile, dlen, "%s/LEASE-%s",
-                         state_dir, ifname);
+    int splen = snprintf(leasefile, dlen, "%s/%s-%s",
+                         state_dir, prefix, ifname);
     if (splen < 0)
         suicide("%s: (%s) snprintf failed; return=%d",
-                client_config.interface, __func__, splen);
+                client_config->interface, __func__, splen);
     if ((size_t)splen >= dlen)
         suicide("%s: (%s) snprintf dest buffer too small %d >= %u",
-                client_config.interface, __func__, splen, sizeof dlen);
+                client_config->interface, __func__, splen, sizeof dlen);
 }
 
+// The LEASE file only holds the address for the benefit of scripts.  The
+// LEASEINFO file holds the rest of the lease and is not truncated here, as
+// it is read back by read_lease_record() when we start.
 void open_leasefile(void)
 {
     char leasefile[PATH_MAX];
-    get_leasefile_path(leasefile, sizeof leasefile, client_config.interface);
-    leasefilefd = open(leasefile, O_WRONLY|O_TRUNC|O_CREAT, 0644);
+    get_leasefile_path(leasefile, sizeof leasefile, "LEASE",
+                       client_config->interface);
+    int leasefilefd = open(leasefile, O_WRONLY|O_TRUNC|O_CREAT, 0644);
     if (leasefilefd < 0)
         suicide("%s: Failed to create lease file '%s': %s",
-                client_config.interface, leasefile, strerror(errno));
+                client_config->interface, leasefile, strerror(errno));
+    leasefilefds[client_config_idx()] = leasefilefd;
+
+    get_leasefile_path(leasefile, sizeof leasefile, "LEASEINFO",
+                       client_config->interface);
+    int leaserecfd = open(leasefile, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+    if (leaserecfd < 0)
+        suicide("%s: Failed to create lease file '%s': %s",
+                client_config->interface, leasefile, strerror(errno));
+    leaserecfds[client_config_idx()] = leaserecfd;
+
+    if (statedirfd < 0) {
+        statedirfd = open(state_dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (statedirfd < 0)
+            log_warning("%s: Failed to open state directory '%s': %s",
+                        client_config->interface, state_dir,
+                        strerror(errno));
+    }
+}
+
+static void replace_leasefile(int fd, const char *out, size_t outlen,
+                              const char *what)
+{
+    ssize_t ret;
+  retry_trunc:
+    ret = ftruncate(fd, 0);
+    switch (ret) {
+        default: break;
+        case -1:
+            if (errno == EINTR)
+                goto retry_trunc;
+            log_warning("%s: Failed to truncate %s file: %s",
+                        client_config->interface, what, strerror(errno));
+            return;
+    }
+    lseek(fd, 0, SEEK_SET);
+    ret = safe_write(fd, out, outlen);
+    if (ret < 0 || (size_t)ret != outlen)
+        log_warning("%s: Failed to write %s file.",
+                    client_config->interface, what);
+    else
+        fsync(fd);
+}
+
+// Writes the lease records to a new file and renames it over the old one,
+// so that a crash never leaves the file truncated.  That needs state_dir
+// to be writable by the user that we run as; if it is not, the file is
+// rewritten in place.
+static void replace_lease_records(const char *out, size_t outlen)
+{
+    static bool warned;
+    char name[PATH_MAX], tmpname[PATH_MAX];
+    size_t idx = client_config_idx();
+    int fd = -1;
+
+    if (statedirfd < 0)
+        goto in_place;
+    int nlen = snprintf(name, sizeof name, "LEASEINFO-%s",
+                        client_config->interface);
+    int tlen = snprintf(tmpname, sizeof tmpname, "LEASEINFO-%s.new",
+                        client_config->interface);
+    if (nlen < 0 || (size_t)nlen >= sizeof name ||
+        tlen < 0 || (size_t)tlen >= sizeof tmpname)
+        goto in_place;
+    fd = openat(statedirfd, tmpname, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (fd < 0)
+        goto in_place;
+    ssize_t ret = safe_write(fd, out, outlen);
+    if (ret < 0 || (size_t)ret != outlen || fsync(fd) < 0 ||
+        renameat(statedirfd, tmpname, statedirfd, name) < 0) {
+        unlinkat(statedirfd, tmpname, 0);
+        close(fd);
+        goto in_place;
+    }
+    fsync(statedirfd);
+    // The old fd refers to the file that was just replaced.
+    close(leaserecfds[idx]);
+    leaserecfds[idx] = fd;
+    return;
+
+  in_place:
+    if (!warned) {
+        warned = true;
+        log_warning("%s: Can't replace the lease record file in '%s' (%s); rewriting it in place.",
+                    client_config->interface, state_dir, strerror(errno));
+    }
+    replace_leasefile(leaserecfds[idx], out, outlen, "lease record");
 }
 
 void write_leasefile(struct in_addr ipnum)
 {
     char ip[INET_ADDRSTRLEN];
     char out[INET_ADDRSTRLEN*2];
-    ssize_t ret;
+    int leasefilefd = leasefilefds[client_config_idx()];
     if (leasefilefd < 0) {
         log_error("%s: (%s) leasefile fd < 0; no leasefile will be written",
-                  client_config.interface, __func__);
+                  client_config->interface, __func__);
         return;
     }
     inet_ntop(AF_INET, &ipnum, ip, sizeof ip);
     ssize_t olen = snprintf(out, sizeof out, "%s\n", ip);
     if (olen < 0 || (size_t)olen >= sizeof ip) {
         log_error("%s: (%s) snprintf failed; return=%d",
-                  client_config.interface, __func__, olen);
+                  client_config->interface, __func__, olen);
         return;
     }
-  retry_trunc:
-    ret = ftruncate(leasefilefd, 0);
-    switch (ret) {
-        default: break;
-        case -1:
-            if (errno == EINTR)
-                goto retry_trunc;
-            log_warning("%s: Failed to truncate lease file: %s",
-                        client_config.interface, strerror(errno));
-            return;
+    replace_leasefile(leasefilefd, out, (size_t)olen, "lease");
+}
+
+#define LEASE_RECORD_VERSION 1
+#define LEASE_RECORD_LINE_MAX 256
+
+// Returns true if the lease has not expired at the wall clock time now.
+bool lease_record_live(const struct lease_record lr[static 1], long long now)
+{
+    return lr->yiaddr && lr->start <= now && now < lr->start + lr->lease;
+}
+
+// Networks are told apart by the address and hardware address of their
+// gateway, or of their DHCP agent if they have no gateway.
+bool lease_record_same_network(const struct lease_record a[static 1],
+                               const struct lease_record b[static 1])
+{
+    if (a->router != b->router)
+        return false;
+    if (a->router)
+        return !memcmp(a->router_mac, b->router_mac, sizeof a->router_mac);
+    return a->srcaddr == b->srcaddr &&
+           !memcmp(a->server_mac, b->server_mac, sizeof a->server_mac);
+}
+
+// One line: version, lease address, server id, server source address,
+// router, wall clock start of the lease, lease time, T1, T2, and the
+// router and server hardware addresses.  Returns the length of the line,
+// or 0 if it does not fit in out.
+static size_t format_lease_record(char *out, size_t outlen,
+                                  const struct lease_record lr[static 1])
+{
+    char ip[4][INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &lr->yiaddr, ip[0], sizeof ip[0]);
+    inet_ntop(AF_INET, &lr->server, ip[1], sizeof ip[1]);
+    inet_ntop(AF_INET, &lr->srcaddr, ip[2], sizeof ip[2]);
+    inet_ntop(AF_INET, &lr->router, ip[3], sizeof ip[3]);
+    const uint8_t *rm = lr->router_mac, *sm = lr->server_mac;
+    int olen = snprintf(out, outlen,
+                        "%d %s %s %s %s %lld %u %u %u "
+                        "%02x:%02x:%02x:%02x:%02x:%02x "
+                        "%02x:%02x:%02x:%02x:%02x:%02x\n",
+                        LEASE_RECORD_VERSION, ip[0], ip[1], ip[2], ip[3],
+                        lr->start, lr->lease, lr->t1, lr->t2,
+                        rm[0], rm[1], rm[2], rm[3], rm[4], rm[5],
+                        sm[0], sm[1], sm[2], sm[3], sm[4], sm[5]);
+    if (olen < 0 || (size_t)olen >= outlen) {
+        log_error("%s: (%s) snprintf failed; return=%d",
+                  client_config->interface, __func__, olen);
+        return 0;
     }
-    lseek(leasefilefd, 0, SEEK_SET);
-    size_t outlen = strlen(out);
-    ret = safe_write(leasefilefd, out, outlen);
-    if (ret < 0 || (size_t)ret != outlen)
-        log_warning("%s: Failed to write ip to lease file.",
-                    client_config.interface);
-    else
-        fsync(leasefilefd);
+    return (size_t)olen;
+}
+
+// The record file holds the lease of each recently used network, one per
+// line, with the most recently bound lease first.  The new record replaces
+// any older one for the same network, and leases that have expired are
+// dropped.
+void write_lease_record(const struct lease_record lr[static 1])
+{
+    struct lease_record old[LEASE_CACHE_MAX];
+    char out[LEASE_RECORD_LINE_MAX * LEASE_CACHE_MAX];
+    int fd = leaserecfds[client_config_idx()];
+    if (fd < 0) {
+        log_error("%s: (%s) lease record fd < 0; no record will be written",
+                  client_config->interface, __func__);
+        return;
+    }
+    size_t oldcount = read_lease_records(old);
+    size_t olen = format_lease_record(out, sizeof out, lr);
+    if (!olen)
+        return;
+    long long now = (long long)time(NULL);
+    size_t count = 1;
+    for (size_t i = 0; i < oldcount && count < LEASE_CACHE_MAX; ++i) {
+        if (lease_record_same_network(&old[i], lr) ||
+            !lease_record_live(&old[i], now))
+            continue;
+        size_t l = format_lease_record(out + olen, sizeof out - olen, &old[i]);
+        if (!l)
+            break;
+        olen += l;
+        ++count;
+    }
+    replace_lease_records(out, olen);
+}
+
+static bool parse_lease_record(const char *in, struct lease_record lr[static 1])
+{
+    char ip[4][INET_ADDRSTRLEN];
+    int ver;
+    uint8_t *rm = lr->router_mac, *sm = lr->server_mac;
+    if (sscanf(in, "%d %15s %15s %15s %15s %lld %u %u %u "
+                   "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx "
+                   "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+               &ver, ip[0], ip[1], ip[2], ip[3],
+               &lr->start, &lr->lease, &lr->t1, &lr->t2,
+               &rm[0], &rm[1], &rm[2], &rm[3], &rm[4], &rm[5],
+               &sm[0], &sm[1], &sm[2], &sm[3], &sm[4], &sm[5]) != 21 ||
+        ver != LEASE_RECORD_VERSION)
+        return false;
+    return inet_pton(AF_INET, ip[0], &lr->yiaddr) == 1 &&
+           inet_pton(AF_INET, ip[1], &lr->server) == 1 &&
+           inet_pton(AF_INET, ip[2], &lr->srcaddr) == 1 &&
+           inet_pton(AF_INET, ip[3], &lr->router) == 1;
+}
+
+// Returns the number of well-formed records that were read, most recent
+// first.  The caller decides whether the leases that they describe are
+// still usable.
+size_t read_lease_records(struct lease_record lr[static LEASE_CACHE_MAX])
+{
+    char in[LEASE_RECORD_LINE_MAX * LEASE_CACHE_MAX];
+    int fd = leaserecfds[client_config_idx()];
+    if (fd < 0)
+        return 0;
+    ssize_t r = pread(fd, in, sizeof in - 1, 0);
+    if (r <= 0)
+        return 0;
+    in[r] = 0;
+    size_t count = 0;
+    for (char *line = in; *line && count < LEASE_CACHE_MAX;) {
+        char *eol = strchr(line, '\n');
+        if (eol)
+            *eol = 0;
+        if (parse_lease_record(line, &lr[count]))
+            ++count;
+        else
+            log_line("%s: Ignoring malformed lease record.",
+                     client_config->interface);
+        if (!eol)
+            break;
+        line = eol + 1;
+    }
+    return count;
+}
+
+// Returns true if a well-formed record of the most recent lease was read.
+bool read_lease_record(struct lease_record lr[static 1])
+{
+    struct lease_record all[LEASE_CACHE_MAX];
+    if (!read_lease_records(all))
+        return false;
+    *lr = all[0];
+    return true;
 }
 
@@ -29,8 +29,32 @@
 #ifndef NJK_NDHC_LEASEFILE_H_
 #define NJK_NDHC_LEASEFILE_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+// A lease that was bound on an interface, kept so that it can be requested
+// again with an INIT-REBOOT request when ndhc restarts or when we return to
+// the network that it belongs to.  Addresses are in network byte order.
+struct lease_record {
+    uint32_t yiaddr, server, srcaddr, router;
+    long long start; // Wall clock time of the ACK, in seconds.
+    uint32_t lease, t1, t2; // Relative to start, in seconds.
+    uint8_t router_mac[6], server_mac[6];
+};
+
+// Number of networks whose leases are remembered for each interface.
+#define LEASE_CACHE_MAX 8
+
 void open_leasefile(void);
 void write_leasefile(struct in_addr ipnum);
+bool lease_record_live(const struct lease_record lr[static 1], long long now);
+bool lease_record_same_network(const struct lease_record a[static 1],
+                               const struct lease_record b[static 1]);
+void write_lease_record(const struct lease_record lr[static 1]);
+size_t read_lease_records(struct lease_record lr[static LEASE_CACHE_MAX]);
+bool read_lease_record(struct lease_record lr[static 1]);
 
 #endif /* NJK_NDHC_LEASEFILE_H_ */
 
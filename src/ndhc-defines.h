@@ -3,6 +3,7 @@
 
 #define NDHC_VERSION "2.0"
 #define MAX_BUF 1024
+#define NDHC_MAX_IFACES 1024 // Max interfaces handled by one ndhc instance
 
 #endif /* NDHC_DEFINES_H_ */
 
@@ -63,6 +63,7 @@
 #include "sys.h"
 #include "ifchange.h"
 #include "arp.h"
+#include "timer.h"
 #include "nl.h"
 #include "netlink.h"
 #include "leasefile.h"
@@ -72,28 +73,70 @@
 #include "sockd.h"
 #include "rfkill.h"
 
-struct client_state_t cs = {
-    .program_init = true,
-    .epollFd = -1,
-    .signalFd = -1,
-    .listenFd = -1,
-    .arpFd = -1,
-    .nlFd = -1,
-    .nlPortId = 0,
-    .rfkillFd = -1,
-    .dhcp_wake_ts = -1,
-    .routerArp = "\0\0\0\0\0\0",
-    .serverArp = "\0\0\0\0\0\0",
+struct client_config_t client_configs[NDHC_MAX_IFACES] = {
+    [0] = {
+        .interface = "eth0",
+        .arp = "\0\0\0\0\0\0",
+        .clientid_len = 0,
+        .metric = 0,
+    },
 };
+struct client_config_t *client_config = &client_configs[0];
+size_t client_count = 1;
+
+static struct client_state_t clients[NDHC_MAX_IFACES];
+static size_t clients_active; // Clients whose interface still exists.
+
+// Shared by all of the interfaces.
+static int epollFd = -1;
+static int signalFd = -1;
+static int timerFd = -1;
+static int resumeFd = -1;
+static int nlFd = -1;
+static int rfkillFd = -1;
+static uint32_t nlPortId;
+
+void set_client_addr(const char v[static 1])
+{
+    clients[client_config_idx()].clientAddr = inet_addr(v);
+}
 
-struct client_config_t client_config = {
-    .interface = "eth0",
-    .arp = "\0\0\0\0\0\0",
-    .clientid_len = 0,
-    .metric = 0,
-};
+// Called for every interface option.  The first one names the default
+// interface.  Each later one adds another interface whose configuration
+// starts as a copy of the previous interface's, so options that are given
+// earlier act as defaults for the interfaces that follow.
+void new_client_config(void)
+{
+    static bool have_first;
+    if (!have_first) {
+        have_first = true;
+        return;
+    }
+    if (client_count >= NDHC_MAX_IFACES)
+        suicide("too many interfaces specified (maximum is %d)",
+                NDHC_MAX_IFACES);
+    memcpy(&client_configs[client_count], client_config,
+           sizeof client_configs[0]);
+    client_config = &client_configs[client_count++];
+}
 
-void set_client_addr(const char v[static 1]) { cs.clientAddr = inet_addr(v); }
+static void init_client_state(size_t idx)
+{
+    struct client_state_t *cs = &clients[idx];
+    cs->client_idx = idx;
+    cs->program_init = true;
+    cs->epollFd = -1;
+    cs->listenFd = -1;
+    cs->arpFd = -1;
+    cs->bcastFd = -1;
+    cs->unicastFd = -1;
+    cs->acquire_ts = -1;
+    nk_random_init(&cs->rnd_state);
+    arp_reset_state(cs);
+    // Run the state machine as soon as we start.  The DHCP timer must be
+    // due so that the first DISCOVER or INIT-REBOOT request is sent.
+    timer_set(cs, TMR_DHCP, 0);
+}
 
 void print_version(void)
 {
@@ -134,7 +177,8 @@ void show_usage(void)
 "  -b, --background                Fork to background if lease cannot be\n"
 "                                  immediately negotiated.\n"
 "  -p, --pidfile=FILE              File where the ndhc pid will be written\n"
-"  -i, --interface=INTERFACE       Interface to use (default: eth0)\n"
+"  -i, --interface=INTERFACE       Interface to use (default: eth0); may be\n"
+"                                  given more than once\n"
 "  -n, --now                       Exit with failure if lease cannot be\n"
 "                                  immediately negotiated.\n"
 "  -q, --quit                      Quit after obtaining lease\n"
@@ -150,9 +194,19 @@ void show_usage(void)
 "  -W, --arp-probe-num             Number of ARP probes before lease is ok\n"
 "  -m, --arp-probe-min             Min ms to wait for ARP response\n"
 "  -M, --arp-probe-max             Max ms to wait for ARP response\n"
+"  -o, --optimistic                Use the leased IP while ARP probes run\n"
+"      --fast-revalidate           Request the lease while the gateway is\n"
+"                                  checked when the link comes back\n"
 "  -t, --gw-metric                 Route metric for default gw (default: 0)\n"
 "  -R, --resolve-conf=FILE         Path to resolv.conf or equivalent\n"
 "  -H, --dhcp-set-hostname         Allow DHCP to set machine hostname\n"
+"      --retrans-profile=NAME      DHCP retransmit schedule: rfc (default)\n"
+"                                  or fast-lan\n"
+"      --retrans-selecting=SPEC    Override the schedule for a state as\n"
+"      --retrans-requesting=SPEC   rto,mult,max,jitter[%],retries[,window]\n"
+"      --retrans-renewing=SPEC     with times in ms and 0 retries meaning no\n"
+"      --retrans-rebinding=SPEC    limit; window is the time to wait for\n"
+"                                  more offers after the first\n"
 "  -v, --version                   Display version\n"
            );
     exit(EXIT_SUCCESS);
@@ -168,29 +222,29 @@ static void setup_signals_ndhc(void)
     sigaddset(&mask, SIGTERM);
     if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
         suicide("sigprocmask failed");
-    if (cs.signalFd >= 0) {
-        epoll_del(cs.epollFd, cs.signalFd);
-        close(cs.signalFd);
+    if (signalFd >= 0) {
+        epoll_del(epollFd, signalFd);
+        close(signalFd);
     }
-    cs.signalFd = signalfd(-1, &mask, SFD_NONBLOCK);
-    if (cs.signalFd < 0)
+    signalFd = signalfd(-1, &mask, SFD_NONBLOCK);
+    if (signalFd < 0)
         suicide("signalfd failed");
-    epoll_add(cs.epollFd, cs.signalFd);
+    epoll_add_tag(epollFd, signalFd, 0);
 }
 
 static int signal_dispatch(void)
 {
     struct signalfd_siginfo si;
     memset(&si, 0, sizeof si);
-    ssize_t r = safe_read(cs.signalFd, (char *)&si, sizeof si);
+    ssize_t r = safe_read(signalFd, (char *)&si, sizeof si);
     if (r < 0) {
         log_error("%s: ndhc: error reading from signalfd: %s",
-                  client_config.interface, strerror(errno));
+                  client_config->interface, strerror(errno));
         return SIGNAL_NONE;
     }
     if ((size_t)r < sizeof si) {
         log_error("%s: ndhc: short read from signalfd: %zd < %zu",
-                  client_config.interface, r, sizeof si);
+                  client_config->interface, r, sizeof si);
         return SIGNAL_NONE;
     }
     switch (si.ssi_signo) {
@@ -223,20 +277,20 @@ int get_clientid_string(const char str[static 1], size_t slen)
     if (!slen)
         return -1;
     if (!is_string_hwaddr(str, slen)) {
-        client_config.clientid[0] = 0;
-        memcpy(client_config.clientid + 1, str,
-               min_size_t(slen, sizeof client_config.clientid - 1));
-        client_config.clientid_len = slen + 1;
+        client_config->clientid[0] = 0;
+        memcpy(client_config->clientid + 1, str,
+               min_size_t(slen, sizeof client_config->clientid - 1));
+        client_config->clientid_len = slen + 1;
         return 0;
     }
 
     uint8_t mac[6];
     for (size_t i = 0; i < sizeof mac; ++i)
         mac[i] = strtol(str+i*3, NULL, 16);
-    client_config.clientid[0] = 1; // Ethernet MAC type
-    memcpy(client_config.clientid + 1, mac,
-           min_size_t(sizeof mac, sizeof client_config.clientid - 1));
-    client_config.clientid_len = 7;
+    client_config->clientid[0] = 1; // Ethernet MAC type
+    memcpy(client_config->clientid + 1, mac,
+           min_size_t(sizeof mac, sizeof client_config->clientid - 1));
+    client_config->clientid_len = 7;
     return 1;
 }
 
@@ -252,145 +306,294 @@ static void fail_if_state_dir_dne(void)
         suicide("state_dir path '%s' does not specify a directory", state_dir);
 }
 
+static void remove_client(struct client_state_t cs[static 1])
+{
+    stop_dhcp_listen(cs);
+    close_dhcp_xmit(cs);
+    arp_reset_state(cs);
+    cs->removed = true;
+    timer_clear(cs);
+    if (--clients_active == 0) {
+        log_line("No interfaces remain.  Exiting.");
+        exit(EXIT_SUCCESS);
+    }
+}
+
+// Runs the state machine of a single interface.  The state machine sets
+// the timers for its own next wakeup.
+static void do_client_work(struct client_state_t cs[static 1], bool sev_dhcp,
+                           struct dhcp_rx dhcp_packet[static 1],
+                           uint8_t dhcp_msgtype, uint32_t dhcp_srcaddr,
+                           bool sev_arp, int sev_rfk, int sev_signal)
+{
+    int sev_nl = cs->nl_event;
+    bool recheck = cs->recheck;
+    bool bind_failed = cs->bind_failed;
+    bool force_fingerprint = false;
+    bool had_event = sev_dhcp || sev_arp || sev_nl != IFS_NONE || recheck ||
+                     bind_failed || sev_rfk != RFK_NONE ||
+                     sev_signal != SIGNAL_NONE;
+
+    if (cs->removed)
+        return;
+    client_config = &client_configs[cs->client_idx];
+    cs->nl_event = IFS_NONE;
+    cs->recheck = false;
+    cs->bind_failed = false;
+
+    if (bind_failed)
+        reinit_failed_bind(cs);
+
+    if (sev_rfk == RFK_ENABLED) {
+        cs->rfkill_set = 1;
+        cs->rfkill_nl_carrier_wentup = false;
+        log_line("%s: rfkill: radio now blocked", client_config->interface);
+    } else if (sev_rfk == RFK_DISABLED) {
+        cs->rfkill_set = 0;
+        log_line("%s: rfkill: radio now unblocked", client_config->interface);
+        if (cs->rfkill_nl_carrier_wentup && carrier_isup(cs)) {
+            // We might have changed networks while the radio was down.
+            force_fingerprint = true;
+        }
+    }
+
+    if (sev_nl != IFS_NONE) {
+        cs->link_state = sev_nl;
+        // The link may now lead somewhere else.
+        close_dhcp_xmit(cs);
+    } else if (!had_event && cs->link_state != IFS_UP) {
+        // Woken to poll a down link; link state change notifications
+        // might have been missed, so ask ifch again.
+        cs->link_state = IFS_NONE;
+    }
+
+    if (recheck) {
+        // We may have been carried to another network while suspended
+        // or not running, and the notifications for it were missed.
+        cs->link_state = IFS_NONE;
+        close_dhcp_xmit(cs);
+        if (!cs->rfkill_set && carrier_isup(cs))
+            force_fingerprint = true;
+    }
+
+    if (sev_nl != IFS_NONE && nl_event_carrier_wentup(sev_nl)) {
+        if (!cs->rfkill_set)
+            force_fingerprint = true;
+        else
+            cs->rfkill_nl_carrier_wentup = true;
+    }
+    if (sev_nl == IFS_REMOVED) {
+        remove_client(cs);
+        return;
+    }
+
+    if (cs->rfkill_set || !carrier_isup(cs)) {
+        // We can't do anything while the iface is disabled, anyway.
+        // Link state change notifications might be missed, so we use a
+        // non-infinite timeout.
+        timer_set(cs, TMR_POLL, curms() + 2000
+                  + nk_random_u32(&cs->rnd_state) % 3000);
+        return;
+    }
+
+    long long nowts = curms();
+    timer_set(cs, TMR_POLL, -1);
+    int dhcp_ok = dhcp_handle(cs, nowts, sev_dhcp, dhcp_packet,
+                              dhcp_msgtype, dhcp_srcaddr,
+                              sev_arp, force_fingerprint,
+                              timer_expired(cs, nowts), sev_signal);
+
+    if (dhcp_ok == COR_ERROR)
+        timer_set(cs, TMR_POLL, nowts + 2000
+                  + nk_random_u32(&cs->rnd_state) % 3000);
+}
+
+// Runs each client that has a timer which is due.  The clients are found
+// first so that timers which they set while running wait for the next
+// round.
+static void do_timers(struct dhcp_rx dhcp_packet[static 1])
+{
+    static bool due[NDHC_MAX_IFACES];
+    static size_t due_idx[NDHC_MAX_IFACES];
+    size_t due_count = 0;
+    size_t idx;
+    long long nowts = curms();
+    while (timer_pop(nowts, &idx)) {
+        if (!due[idx]) {
+            due[idx] = true;
+            due_idx[due_count++] = idx;
+        }
+    }
+    for (size_t i = 0; i < due_count; ++i) {
+        due[due_idx[i]] = false;
+        do_client_work(&clients[due_idx[i]], false, dhcp_packet, 0, 0,
+                       false, RFK_NONE, SIGNAL_NONE);
+    }
+}
+
+// The lease timers run on CLOCK_BOOTTIME, so any that came due while we
+// were suspended fire now; each client also checks that its network is
+// still the same one.
+static void do_resume(struct dhcp_rx dhcp_packet[static 1])
+{
+    for (size_t i = 0; i < client_count; ++i) {
+        clients[i].recheck = true;
+        do_client_work(&clients[i], false, dhcp_packet, 0, 0,
+                       false, RFK_NONE, SIGNAL_NONE);
+    }
+}
+
+static void do_client_event(struct epoll_event ev[static 1])
+{
+    uint32_t idx = epoll_tag(ev);
+    int fd = epoll_tag_fd(ev);
+    if (idx >= client_count)
+        suicide("epoll_wait: unknown fd");
+    struct client_state_t *cs = &clients[idx];
+    struct dhcp_rx dhcp_packet;
+    client_config = &client_configs[idx];
+    if (fd == cs->listenFd) {
+        uint32_t dhcp_srcaddr;
+        uint8_t dhcp_msgtype;
+        if (!(ev->events & EPOLLIN))
+            suicide("%s: listenfd closed unexpectedly",
+                    client_config->interface);
+        if (dhcp_packet_get(cs, &dhcp_packet, &dhcp_msgtype, &dhcp_srcaddr))
+            do_client_work(cs, true, &dhcp_packet, dhcp_msgtype,
+                           dhcp_srcaddr, false, RFK_NONE, SIGNAL_NONE);
+    } else if (fd == cs->unicastFd) {
+        uint32_t dhcp_srcaddr;
+        uint8_t dhcp_msgtype;
+        // EPOLLERR here is an ICMP error for a renewal that was sent,
+        // which the read reports and handles.
+        if (dhcp_unicast_packet_get(cs, &dhcp_packet, &dhcp_msgtype,
+                                    &dhcp_srcaddr))
+            do_client_work(cs, true, &dhcp_packet, dhcp_msgtype,
+                           dhcp_srcaddr, false, RFK_NONE, SIGNAL_NONE);
+    } else if (fd == cs->arpFd) {
+        if (!(ev->events & EPOLLIN))
+            suicide("%s: arpfd closed unexpectedly",
+                    client_config->interface);
+        arp_packet_get(cs);
+        while (arp_packet_next(cs))
+            do_client_work(cs, false, &dhcp_packet, 0, 0, true,
+                           RFK_NONE, SIGNAL_NONE);
+    }
+    // Otherwise the fd was closed while handling an earlier event of the
+    // same epoll_wait() batch, as happens to the unicast socket on link
+    // changes, and the event is stale.
+}
+
 static void do_ndhc_work(void)
 {
-    static bool rfkill_set; // Is the rfkill switch set?
-    static bool rfkill_nl_carrier_wentup; // iface carrier changed to up during rfkill
-    struct dhcpmsg dhcp_packet;
-    struct epoll_event events[1];
-    long long nowts;
-    int timeout = 0;
-    bool had_event;
-
-    cs.epollFd = epoll_create1(0);
-    if (cs.epollFd < 0)
+    struct dhcp_rx dhcp_packet = {0};
+    struct epoll_event events[32];
+
+    epollFd = epoll_create1(0);
+    if (epollFd < 0)
         suicide("epoll_create1 failed");
 
     setup_signals_ndhc();
 
-    epoll_add(cs.epollFd, cs.nlFd);
-    epoll_add(cs.epollFd, ifchStream[0]);
-    epoll_add(cs.epollFd, sockdStream[0]);
-    if (client_config.enable_rfkill && cs.rfkillFd != -1)
-        epoll_add(cs.epollFd, cs.rfkillFd);
-    start_dhcp_listen(&cs);
+    timerFd = timer_open();
+    epoll_add_tag(epollFd, timerFd, 0);
+    resumeFd = timer_resume_open();
+    epoll_add_tag(epollFd, resumeFd, 0);
+
+    epoll_add_tag(epollFd, nlFd, 0);
+    epoll_add_tag(epollFd, ifchSock[0], 0);
+    epoll_add_tag(epollFd, ifchStream[0], 0);
+    epoll_add_tag(epollFd, sockdStream[0], 0);
+    if (rfkillFd != -1)
+        epoll_add_tag(epollFd, rfkillFd, 0);
+    for (size_t i = 0; i < client_count; ++i) {
+        clients[i].epollFd = epollFd;
+        client_config = &client_configs[i];
+        if (clients[i].dhcp_state != DS_BOUND) {
+            start_dhcp_listen(&clients[i]);
+            continue;
+        }
+        // The configuration was adopted, so only check that we are still
+        // on the network that it belongs to.
+        clients[i].recheck = true;
+        do_client_work(&clients[i], false, &dhcp_packet, 0, 0,
+                       false, RFK_NONE, SIGNAL_NONE);
+    }
 
     for (;;) {
-        had_event = false;
-        int maxi = epoll_wait(cs.epollFd, events, 1, timeout);
+        timer_arm();
+        int maxi = epoll_wait(epollFd, events,
+                              sizeof events / sizeof events[0], -1);
         if (maxi < 0) {
             if (errno == EINTR)
                 continue;
             else
                 suicide("epoll_wait failed");
         }
-        bool sev_dhcp = false;
-        uint32_t dhcp_srcaddr;
-        uint8_t dhcp_msgtype;
-        bool sev_arp = false;
-        int sev_nl = IFS_NONE;
-        int sev_rfk = RFK_NONE;
-        int sev_signal = SIGNAL_NONE;
-        bool force_fingerprint = false;
+        // Checked on every wakeup so that the clients revalidate before
+        // they handle any events that were queued during the suspend.
+        if (timer_resumed())
+            do_resume(&dhcp_packet);
         for (int i = 0; i < maxi; ++i) {
-            had_event = true;
-            int fd = events[i].data.fd;
-            if (fd == cs.signalFd) {
+            int fd = epoll_tag_fd(&events[i]);
+            if (fd == signalFd) {
                 if (!(events[i].events & EPOLLIN))
                     suicide("signalfd closed unexpectedly");
-                sev_signal = signal_dispatch();
-            } else if (fd == cs.listenFd) {
+                int sev_signal = signal_dispatch();
+                if (sev_signal == SIGNAL_NONE)
+                    continue;
+                for (size_t j = 0; j < client_count; ++j)
+                    do_client_work(&clients[j], false, &dhcp_packet, 0, 0,
+                                   false, RFK_NONE, sev_signal);
+            } else if (fd == timerFd) {
                 if (!(events[i].events & EPOLLIN))
-                    suicide("listenfd closed unexpectedly");
-                sev_dhcp = dhcp_packet_get(&cs, &dhcp_packet, &dhcp_msgtype,
-                                           &dhcp_srcaddr);
-            } else if (fd == cs.arpFd) {
+                    suicide("timerfd closed unexpectedly");
+                timer_ack();
+                do_timers(&dhcp_packet);
+            } else if (fd == resumeFd) {
                 if (!(events[i].events & EPOLLIN))
-                    suicide("arpfd closed unexpectedly");
-                sev_arp = arp_packet_get(&cs);
-            } else if (fd == cs.nlFd) {
+                    suicide("resumefd closed unexpectedly");
+                timer_resume_ack();
+            } else if (fd == nlFd) {
                 if (!(events[i].events & EPOLLIN))
                     suicide("nlfd closed unexpectedly");
-                sev_nl = nl_event_get(&cs);
+                nl_event_get(nlFd, nlPortId, clients);
+                for (size_t j = 0; j < client_count; ++j) {
+                    if (clients[j].nl_event != IFS_NONE)
+                        do_client_work(&clients[j], false, &dhcp_packet,
+                                       0, 0, false, RFK_NONE, SIGNAL_NONE);
+                }
+            } else if (fd == ifchSock[0]) {
+                if (!(events[i].events & EPOLLIN))
+                    suicide("ifchSock closed unexpectedly");
+                ifchange_get(clients);
+                for (size_t j = 0; j < client_count; ++j) {
+                    if (clients[j].bind_failed)
+                        do_client_work(&clients[j], false, &dhcp_packet,
+                                       0, 0, false, RFK_NONE, SIGNAL_NONE);
+                }
             } else if (fd == ifchStream[0]) {
                 if (events[i].events & (EPOLLHUP|EPOLLERR|EPOLLRDHUP))
                     exit(EXIT_FAILURE);
             } else if (fd == sockdStream[0]) {
                 if (events[i].events & (EPOLLHUP|EPOLLERR|EPOLLRDHUP))
                     exit(EXIT_FAILURE);
-            } else if (fd == cs.rfkillFd && client_config.enable_rfkill) {
+            } else if (fd == rfkillFd) {
                 if (!(events[i].events & EPOLLIN))
                     suicide("rfkillfd closed unexpectedly");
-                sev_rfk = rfkill_get(&cs, 1, client_config.rfkillIdx);
+                uint32_t rfkidx;
+                int sev_rfk = rfkill_get(rfkillFd, &rfkidx);
+                if (sev_rfk == RFK_NONE || sev_rfk == RFK_FAIL)
+                    continue;
+                for (size_t j = 0; j < client_count; ++j) {
+                    if (client_configs[j].enable_rfkill &&
+                        client_configs[j].rfkillIdx == rfkidx)
+                        do_client_work(&clients[j], false, &dhcp_packet,
+                                       0, 0, false, sev_rfk, SIGNAL_NONE);
+                }
             } else
-                suicide("epoll_wait: unknown fd");
-        }
-
-        if (sev_rfk == RFK_ENABLED) {
-            rfkill_set = 1;
-            rfkill_nl_carrier_wentup = false;
-            log_line("rfkill: radio now blocked");
-        } else if (sev_rfk == RFK_DISABLED) {
-            rfkill_set = 0;
-            log_line("rfkill: radio now unblocked");
-            if (rfkill_nl_carrier_wentup && carrier_isup()) {
-                // We might have changed networks while the radio was down.
-                force_fingerprint = true;
-            }
-        }
-
-        if (sev_nl != IFS_NONE && nl_event_carrier_wentup(sev_nl)) {
-            if (!rfkill_set)
-                force_fingerprint = true;
-            else
-                rfkill_nl_carrier_wentup = true;
+                do_client_event(&events[i]);
         }
-
-        if (rfkill_set || !carrier_isup()) {
-            // We can't do anything while the iface is disabled, anyway.
-            // Suspend might cause link state change notifications to be
-            // missed, so we use a non-infinite timeout.
-            timeout = 2000 + (int)(nk_random_u32(&cs.rnd_state) % 3000);
-            continue;
-        }
-
-        nowts = curms();
-        long long arp_wake_ts = arp_get_wake_ts();
-        int dhcp_ok = dhcp_handle(&cs, nowts, sev_dhcp, &dhcp_packet,
-                                  dhcp_msgtype, dhcp_srcaddr,
-                                  sev_arp, force_fingerprint,
-                                  cs.dhcp_wake_ts <= nowts,
-                                  arp_wake_ts <= nowts, sev_signal);
-
-        if (dhcp_ok == COR_ERROR) {
-            timeout = 2000 + (int)(nk_random_u32(&cs.rnd_state) % 3000);
-            continue;
-        }
-
-        int prev_timeout = timeout;
-        long long tt;
-
-        arp_wake_ts = arp_get_wake_ts();
-        if (arp_wake_ts < 0 && cs.dhcp_wake_ts < 0) {
-            timeout = -1;
-            continue;
-        } else if (arp_wake_ts < 0) {
-            tt = cs.dhcp_wake_ts - nowts;
-        } else if (cs.dhcp_wake_ts < 0) {
-            tt = arp_wake_ts - nowts;
-        } else {
-            tt = (arp_wake_ts < cs.dhcp_wake_ts ?
-                  arp_wake_ts : cs.dhcp_wake_ts) - nowts;
-        }
-        if (tt > INT_MAX) tt = INT_MAX;
-        if (tt < INT_MIN) tt = INT_MIN;
-        timeout = tt;
-        if (timeout < 0)
-            timeout = 0;
-
-        // Failsafe to prevent busy-spin.
-        if (timeout == 0 && prev_timeout == 0 && !had_event)
-            timeout = 10000;
     }
 }
 
@@ -428,7 +631,8 @@ static void spawn_ifch(void)
         close(ifchSock[0]);
         close(ifchStream[0]);
         // Don't share the RNG state with the master process.
-        nk_random_init(&cs.rnd_state);
+        for (size_t i = 0; i < client_count; ++i)
+            nk_random_init(&clients[i].rnd_state);
         ifch_main();
     } else if (ifch_pid > 0) {
         close(ifchSock[1]);
@@ -445,7 +649,8 @@ static void spawn_sockd(void)
         close(sockdSock[0]);
         close(sockdStream[0]);
         // Don't share the RNG state with the master process.
-        nk_random_init(&cs.rnd_state);
+        for (size_t i = 0; i < client_count; ++i)
+            nk_random_init(&clients[i].rnd_state);
         sockd_main();
     } else if (sockd_pid > 0) {
         close(sockdSock[1]);
@@ -456,26 +661,50 @@ static void spawn_sockd(void)
 
 static void ndhc_main(void) {
     prctl(PR_SET_NAME, "ndhc: master");
-    log_line("ndhc client " NDHC_VERSION " started on interface [%s].",
-             client_config.interface);
+    for (size_t i = 0; i < client_count; ++i)
+        log_line("ndhc client " NDHC_VERSION " started on interface [%s].",
+                 client_configs[i].interface);
 
-    if ((cs.nlFd = nl_open(NETLINK_ROUTE, RTMGRP_LINK, &cs.nlPortId)) < 0)
+    if ((nlFd = nl_open(NETLINK_ROUTE, RTMGRP_LINK, &nlPortId)) < 0)
         suicide("%s: failed to open netlink socket", __func__);
+    nl_event_set_filter(nlFd);
+
+    bool enable_rfkill = false;
+    for (size_t i = 0; i < client_count; ++i)
+        enable_rfkill |= client_configs[i].enable_rfkill;
+    rfkillFd = rfkill_open(&enable_rfkill);
+    if (!enable_rfkill) {
+        for (size_t i = 0; i < client_count; ++i)
+            client_configs[i].enable_rfkill = false;
+    }
 
-    cs.rfkillFd = rfkill_open(&client_config.enable_rfkill);
-
-    if (write_pid_enabled && !client_config.background_if_no_lease)
+    if (write_pid_enabled && !client_configs[0].background_if_no_lease)
         write_pid(pidfile);
 
-    open_leasefile();
+    for (size_t i = 0; i < client_count; ++i) {
+        client_config = &client_configs[i];
+        open_leasefile();
+        if (restore_lease_record(&clients[i])) {
+            log_line("%s: Found an unexpired lease from a previous run.",
+                     client_config->interface);
+            if (adopt_lease_record(&clients[i]))
+                log_line("%s: Interface already has its address.  Keeping it.",
+                         client_config->interface);
+        }
+    }
 
     nk_set_chroot(chroot_dir);
     memset(chroot_dir, '\0', sizeof chroot_dir);
     nk_set_uidgid(ndhc_uid, ndhc_gid, NULL, 0);
 
-    if (!carrier_isup()) {
-        if (ifchange_deconfig(&cs) < 0)
-            suicide("%s: can't deconfigure interface settings", __func__);
+    for (size_t i = 0; i < client_count; ++i) {
+        client_config = &client_configs[i];
+        // An adopted configuration is kept while the carrier is down, as
+        // it would be if we had been running all along.
+        if (clients[i].dhcp_state != DS_BOUND && !carrier_isup(&clients[i])) {
+            if (ifchange_deconfig(&clients[i]) < 0)
+                suicide("%s: can't deconfigure interface settings", __func__);
+        }
     }
 
     do_ndhc_work();
@@ -495,16 +724,16 @@ void background(void)
         write_pid(pidfile);
 }
 
-static void wait_for_rfkill()
+static void wait_for_rfkill(void)
 {
     struct epoll_event events[2];
-    cs.rfkillFd = rfkill_open(&client_config.enable_rfkill);
-    if (cs.rfkillFd < 0)
+    rfkillFd = rfkill_open(&client_config->enable_rfkill);
+    if (rfkillFd < 0)
         suicide("can't wait for rfkill to end if /dev/rfkill can't be opened");
     int epfd = epoll_create1(0);
     if (epfd < 0)
         suicide("epoll_create1 failed");
-    epoll_add(epfd, cs.rfkillFd);
+    epoll_add(epfd, rfkillFd);
     for (;;) {
         int r = epoll_wait(epfd, events, 2, -1);
         if (r < 0) {
@@ -515,10 +744,11 @@ static void wait_for_rfkill()
         }
         for (int i = 0; i < r; ++i) {
             int fd = events[i].data.fd;
-            if (fd != cs.rfkillFd)
+            if (fd != rfkillFd)
                 suicide("epoll_wait: unknown fd");
             if (events[i].events & EPOLLIN) {
-                int rfk = rfkill_get(&cs, 0, 0);
+                uint32_t rfkidx;
+                int rfk = rfkill_get(rfkillFd, &rfkidx);
                 if (rfk == RFK_DISABLED) {
                     switch (perform_ifup()) {
                     case 1: case 0: goto rfkill_gone;
@@ -535,31 +765,48 @@ rfkill_gone:
     close(epfd);
     // We always close because ifchd and sockd shouldn't keep
     // an rfkill fd open.
-    close(cs.rfkillFd);
-    cs.rfkillFd = -1;
+    close(rfkillFd);
+    rfkillFd = -1;
 }
 
 int main(int argc, char *argv[])
 {
     parse_cmdline(argc, argv);
 
-    nk_random_init(&cs.rnd_state);
-
     if (getuid())
         suicide("I need to be started as root.");
     if (!strncmp(chroot_dir, "", sizeof chroot_dir))
         suicide("No chroot path is specified.  Refusing to run.");
     fail_if_state_dir_dne();
 
-    if (nl_getifdata() < 0)
-        suicide("failed to get interface MAC or index");
+    for (size_t i = 0; i < client_count; ++i) {
+        if (client_count > 1 && client_configs[i].quit_after_lease)
+            suicide("Quit after lease can't be used with multiple interfaces.");
+    }
 
-    get_clientid(&cs, &client_config);
+    timer_init();
+    clients_active = client_count;
+    for (size_t i = 0; i < client_count; ++i) {
+        client_config = &client_configs[i];
+        init_client_state(i);
+
+        if (nl_getifdata() < 0)
+            suicide("%s: failed to get interface MAC or index",
+                    client_config->interface);
+        for (size_t j = 0; j < i; ++j) {
+            if (client_configs[j].ifindex == client_config->ifindex)
+                suicide("%s: interface is specified more than once",
+                        client_config->interface);
+        }
 
-    switch (perform_ifup()) {
-    case 1: case 0: break;
-    case -3: wait_for_rfkill(); break;
-    default: suicide("failed to set the interface to up state");
+        get_clientid(&clients[i], client_config);
+
+        switch (perform_ifup()) {
+        case 1: case 0: break;
+        case -3: wait_for_rfkill(); break;
+        default: suicide("%s: failed to set the interface to up state",
+                         client_config->interface);
+        }
     }
 
     if (setpgid(0, 0) < 0) {
@@ -28,27 +28,50 @@
 #ifndef NJK_NDHC_NDHC_H_
 #define NJK_NDHC_NDHC_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <limits.h>
 #include <net/if.h>
 #include "nk/random.h"
+#include "ndhc-defines.h"
+
+typedef enum {
+    DS_INIT = 0,        // Picking a new transaction id; enters DS_SELECTING.
+    DS_SELECTING,       // Broadcasting DHCPDISCOVER and waiting for offers.
+    DS_REBOOTING,       // Asking to reuse the lease from a previous run.
+    DS_REQUESTING,      // Requesting the address that was offered to us.
+    DS_COLLISION_CHECK, // Checking that no other host has the acked address.
+    DS_BOUND,           // BOUND, RENEWING, or REBINDING.
+    DS_RELEASED,        // Lease released by request; waiting for a renew.
+} dhcp_state_t;
 
 struct client_state_t {
     struct nk_random_state rnd_state;
     long long leaseStartTime, renewTime, rebindTime;
-    long long dhcp_wake_ts;
-    int ifDeconfig; // Set if the interface has already been deconfigured.
-    int epollFd, signalFd, listenFd, arpFd, nlFd, rfkillFd;
-    uint32_t nlPortId;
+    long long acquire_ts; // When the search for a new lease began, or -1.
+    size_t client_idx; // Index into client_configs[] and other per-iface data.
+    int epollFd, listenFd, arpFd;
+    int bcastFd, unicastFd; // Cached DHCP transmit sockets.
+    uint32_t unicastAddr, unicastServerAddr; // Endpoints of unicastFd.
+    int nl_event; // Pending link state change (IFS_*) for this interface.
+    bool recheck; // Pending check of the network after a suspend or restart.
+    bool bind_failed; // ifch could not apply our last bind.
+    int link_state; // Last known IFS_* state, or IFS_NONE if unknown.
     unsigned int num_dhcp_requests;
     uint32_t clientAddr, serverAddr, srcAddr, routerAddr;
     uint32_t lease, xid;
+    uint32_t listenXid; // xid built into the listenFd socket filter.
+    dhcp_state_t dhcp_state;
     uint8_t routerArp[6], serverArp[6];
     bool using_dhcp_bpf, got_router_arp, got_server_arp, arp_is_defense,
          check_fingerprint, program_init;
     bool sent_gw_query, sent_first_announce, sent_second_announce,
          init_fingerprint_inprogress;
+    bool revalidating; // An INIT-REBOOT request races the gateway check.
+    bool rfkill_set; // Is the rfkill switch set?
+    bool rfkill_nl_carrier_wentup; // iface carrier changed to up during rfkill
+    bool removed; // Interface has been removed from the system.
 };
 
 struct client_config_t {
@@ -67,7 +90,17 @@ struct client_config_t {
     bool enable_rfkill;          // Listen for rfkill events
 };
 
-extern struct client_config_t client_config;
+// One record per managed interface; client_configs[i] belongs to the
+// client_state_t with client_idx == i.  client_config points at the record
+// of the interface that is currently being serviced.
+extern struct client_config_t client_configs[NDHC_MAX_IFACES];
+extern struct client_config_t *client_config;
+extern size_t client_count;
+
+static inline uint16_t client_config_idx(void)
+{
+    return (uint16_t)(client_config - client_configs);
+}
 
 extern int ifchSock[2];
 extern int ifchStream[2];
@@ -82,6 +115,7 @@ extern gid_t ndhc_gid;
 extern bool write_pid_enabled;
 
 void set_client_addr(const char v[static 1]);
+void new_client_config(void);
 void show_usage(void);
 int get_clientid_string(const char str[static 1], size_t slen);
 void background(void);
@@ -37,6 +37,8 @@
 #include <time.h>
 #include <errno.h>
 #include <poll.h>
+#include <stddef.h>
+#include <linux/filter.h>
 #include "nk/log.h"
 
 #include "netlink.h"
@@ -48,61 +50,265 @@ bool nl_event_carrier_wentup(int state)
 {
     switch (state) {
     case IFS_UP:
-        log_line("%s: Carrier up.", client_config.interface);
+        log_line("%s: Carrier up.", client_config->interface);
         return true;
     case IFS_DOWN:
         // Interface configured, but no hardware carrier.
-        log_line("%s: Carrier down.", client_config.interface);
+        log_line("%s: Carrier down.", client_config->interface);
         return false;
     case IFS_SHUT:
         // User shut down the interface.
-        log_line("%s: Interface shut down.", client_config.interface);
+        log_line("%s: Interface shut down.", client_config->interface);
         return false;
     case IFS_REMOVED:
-        log_line("Interface removed.  Exiting.");
-        exit(EXIT_SUCCESS);
+        log_line("%s: Interface removed.", client_config->interface);
+        return false;
     default: return false;
     }
 }
 
-static int nl_process_msgs_return;
+static int nl_ifflags_state(unsigned flags)
+{
+    // IFF_UP corresponds to ifconfig down or ifconfig up.
+    // IFF_RUNNING is the hardware carrier.
+    if (flags & IFF_UP)
+        return (flags & IFF_RUNNING) ? IFS_UP : IFS_DOWN;
+    return IFS_SHUT;
+}
+
+// Installs a filter on the link event socket so that the kernel only
+// queues RTM_NEWLINK/RTM_DELLINK messages for the interfaces we manage.
+// Netlink is host byte order, but BPF loads are big endian, so constants
+// are converted with htons()/htonl() to match.
+void nl_event_set_filter(int nlfd)
+{
+    static struct sock_filter sf_link[2 * NDHC_MAX_IFACES + 6];
+    const struct sock_filter sf_head[] = {
+        // Only link add/change and remove messages.
+        BPF_STMT(BPF_LD + BPF_H + BPF_ABS, offsetof(struct nlmsghdr, nlmsg_type)),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, htons(RTM_NEWLINK), 2, 0),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, htons(RTM_DELLINK), 1, 0),
+        BPF_STMT(BPF_RET + BPF_K, 0),
+        // Load the interface index.
+        BPF_STMT(BPF_LD + BPF_W + BPF_ABS,
+                 NLMSG_HDRLEN + offsetof(struct ifinfomsg, ifi_index)),
+    };
+    size_t n = sizeof sf_head / sizeof sf_head[0];
+    memcpy(sf_link, sf_head, sizeof sf_head);
+    for (size_t i = 0; i < client_count; ++i) {
+        sf_link[n++] = (struct sock_filter)
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+                     htonl((uint32_t)client_configs[i].ifindex), 0, 1);
+        sf_link[n++] = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, 0x7fffffff);
+    }
+    sf_link[n++] = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, 0);
+    const struct sock_fprog sfp_link = {
+        .len = (unsigned short)n,
+        .filter = sf_link,
+    };
+    if (setsockopt(nlfd, SOL_SOCKET, SO_ATTACH_FILTER, &sfp_link,
+                   sizeof sfp_link) < 0)
+        log_warning("%s: Failed to set BPF for netlink socket: %s",
+                    __func__, strerror(errno));
+}
+
 static void nl_process_msgs(const struct nlmsghdr *nlh, void *data)
 {
-    (void)data;
+    struct client_state_t *clients = data;
     struct ifinfomsg *ifm = NLMSG_DATA(nlh);
+    struct client_state_t *cs = NULL;
 
-    if (ifm->ifi_index != client_config.ifindex)
+    for (size_t i = 0; i < client_count; ++i) {
+        if (ifm->ifi_index == client_configs[i].ifindex) {
+            cs = &clients[i];
+            break;
+        }
+    }
+    if (!cs)
         return;
 
-    if (nlh->nlmsg_type == RTM_NEWLINK) {
-        // IFF_UP corresponds to ifconfig down or ifconfig up.
-        // IFF_RUNNING is the hardware carrier.
-        if (ifm->ifi_flags & IFF_UP) {
-            if (ifm->ifi_flags & IFF_RUNNING)
-                nl_process_msgs_return = IFS_UP;
-            else
-                nl_process_msgs_return = IFS_DOWN;
-        } else {
-            nl_process_msgs_return = IFS_SHUT;
+    if (nlh->nlmsg_type == RTM_NEWLINK)
+        cs->nl_event = nl_ifflags_state(ifm->ifi_flags);
+    else if (nlh->nlmsg_type == RTM_DELLINK)
+        cs->nl_event = IFS_REMOVED;
+}
+
+// Drains the link event socket.  The most recent state change of each of
+// our interfaces is stored in the nl_event member of its client_state_t;
+// the caller must clear it after handling the event.
+void nl_event_get(int nlfd, uint32_t portid,
+                  struct client_state_t clients[static 1])
+{
+    char nlbuf[8192];
+    ssize_t ret;
+    assert(nlfd != -1);
+    do {
+        ret = nl_recv_buf(nlfd, nlbuf, sizeof nlbuf);
+        if (ret < 0) {
+            // Events may have been lost (eg, ENOBUFS on overrun), so the
+            // cached link states can no longer be trusted.
+            for (size_t i = 0; i < client_count; ++i)
+                clients[i].link_state = IFS_NONE;
+            break;
         }
-    } else if (nlh->nlmsg_type == RTM_DELLINK)
-        nl_process_msgs_return = IFS_REMOVED;
+        if (nl_foreach_nlmsg(nlbuf, (size_t)ret, 0, portid,
+                             nl_process_msgs, clients) < 0)
+            break;
+    } while (ret > 0);
+}
+
+static void do_handle_getlinkstate(const struct nlmsghdr *nlh, void *data)
+{
+    int *state = data;
+    struct ifinfomsg *ifm = NLMSG_DATA(nlh);
+    if (nlh->nlmsg_type == RTM_NEWLINK &&
+        ifm->ifi_index == client_config->ifindex)
+        *state = nl_ifflags_state(ifm->ifi_flags);
 }
 
-int nl_event_get(struct client_state_t cs[static 1])
+// Asks the kernel for the current link state of client_config.  The
+// reply to a single-link RTM_GETLINK is queued before sendto() returns,
+// so this never waits on anything but the kernel.  Returns IFS_NONE on
+// failure.
+int nl_getlinkstate(void)
 {
+    static uint32_t seq;
     char nlbuf[8192];
+    int state = IFS_NONE;
     ssize_t ret;
-    assert(cs->nlFd != -1);
-    nl_process_msgs_return = IFS_NONE;
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        log_line("%s: (%s) netlink socket open failed: %s",
+                 client_config->interface, __func__, strerror(errno));
+        return IFS_NONE;
+    }
+    if (++seq == 0)
+        ++seq;
+    if (nl_sendgetlink(fd, seq, client_config->ifindex) < 0)
+        goto out;
     do {
-        ret = nl_recv_buf(cs->nlFd, nlbuf, sizeof nlbuf);
+        ret = nl_recv_buf(fd, nlbuf, sizeof nlbuf);
         if (ret < 0)
             break;
-        if (nl_foreach_nlmsg(nlbuf, (size_t)ret, 0, cs->nlPortId, nl_process_msgs, 0) < 0)
+        if (nl_foreach_nlmsg(nlbuf, (size_t)ret, seq, 0,
+                             do_handle_getlinkstate, &state) < 0)
             break;
     } while (ret > 0);
-    return nl_process_msgs_return;
+  out:
+    close(fd);
+    return state;
+}
+
+// Reads the replies to a request until the kernel has no more of them.
+static int nl_recv_replies(int fd, uint32_t seq, nlmsg_foreach_fn pfn,
+                           void *data)
+{
+    char nlbuf[8192];
+    ssize_t ret;
+    do {
+        ret = nl_recv_buf(fd, nlbuf, sizeof nlbuf);
+        if (ret < 0)
+            return -1;
+        if (nl_foreach_nlmsg(nlbuf, (size_t)ret, seq, 0, pfn, data) < 0)
+            return -1;
+    } while (ret > 0);
+    return 0;
+}
+
+static void do_handle_getifaddr(const struct nlmsghdr *nlh, void *data)
+{
+    struct nl_ifconfig *ifc = data;
+    struct rtattr *tb[IFA_MAX] = {0};
+    struct ifaddrmsg *ifm = NLMSG_DATA(nlh);
+
+    if (nlh->nlmsg_type != RTM_NEWADDR || ifm->ifa_family != AF_INET ||
+        ifm->ifa_index != (unsigned)client_config->ifindex)
+        return;
+    // ifch only installs permanent addresses of global scope.
+    if (!(ifm->ifa_flags & IFA_F_PERMANENT) ||
+        ifm->ifa_scope != RT_SCOPE_UNIVERSE || ifm->ifa_prefixlen > 32)
+        return;
+    nl_rtattr_parse(nlh, sizeof *ifm, rtattr_assign, tb);
+    if (!tb[IFA_ADDRESS] || memcmp(RTA_DATA(tb[IFA_ADDRESS]), &ifc->ipaddr,
+                                   sizeof ifc->ipaddr))
+        return;
+    ifc->have_ipaddr = true;
+    ifc->prefixlen = ifm->ifa_prefixlen;
+    if (tb[IFA_BROADCAST])
+        memcpy(&ifc->bcast, RTA_DATA(tb[IFA_BROADCAST]), sizeof ifc->bcast);
+}
+
+static void do_handle_getroute(const struct nlmsghdr *nlh, void *data)
+{
+    struct nl_ifconfig *ifc = data;
+    struct rtattr *tb[RTA_MAX] = {0};
+    struct rtmsg *rtm = NLMSG_DATA(nlh);
+    int oif;
+    uint32_t priority = 0;
+
+    // Only a default route like the one that ifch installs.
+    if (nlh->nlmsg_type != RTM_NEWROUTE || rtm->rtm_family != AF_INET ||
+        rtm->rtm_dst_len || rtm->rtm_table != RT_TABLE_MAIN ||
+        rtm->rtm_protocol != RTPROT_DHCP || rtm->rtm_type != RTN_UNICAST)
+        return;
+    nl_rtattr_parse(nlh, sizeof *rtm, rtattr_assign, tb);
+    if (!tb[RTA_OIF] || !tb[RTA_GATEWAY])
+        return;
+    memcpy(&oif, RTA_DATA(tb[RTA_OIF]), sizeof oif);
+    if (oif != client_config->ifindex)
+        return;
+    if (tb[RTA_PRIORITY])
+        memcpy(&priority, RTA_DATA(tb[RTA_PRIORITY]), sizeof priority);
+    if (priority != (uint32_t)client_config->metric)
+        return;
+    memcpy(&ifc->router, RTA_DATA(tb[RTA_GATEWAY]), sizeof ifc->router);
+}
+
+static void do_handle_getmtu(const struct nlmsghdr *nlh, void *data)
+{
+    struct nl_ifconfig *ifc = data;
+    struct rtattr *tb[IFLA_MAX] = {0};
+    struct ifinfomsg *ifm = NLMSG_DATA(nlh);
+
+    if (nlh->nlmsg_type != RTM_NEWLINK ||
+        ifm->ifi_index != client_config->ifindex)
+        return;
+    nl_rtattr_parse(nlh, sizeof *ifm, rtattr_assign, tb);
+    if (tb[IFLA_MTU])
+        memcpy(&ifc->mtu, RTA_DATA(tb[IFLA_MTU]), sizeof ifc->mtu);
+}
+
+// Reads back the configuration that ifch would have made on client_config
+// for a lease of ipaddr: the address, the default route with our metric,
+// and the MTU.  Nothing is changed.  Returns -1 if the kernel could not be
+// asked.
+int nl_getifconfig(uint32_t ipaddr, struct nl_ifconfig ifc[static 1])
+{
+    uint32_t seq = 0;
+    int ret = -1;
+    *ifc = (struct nl_ifconfig){ .ipaddr = ipaddr };
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        log_line("%s: (%s) netlink socket open failed: %s",
+                 client_config->interface, __func__, strerror(errno));
+        return -1;
+    }
+    // Lets the kernel filter the dumps by interface; the handlers check
+    // anyway, as older kernels ignore the filters.
+    nl_set_strict_check(fd);
+    if (nl_sendgetaddr4(fd, ++seq, (uint32_t)client_config->ifindex) < 0 ||
+        nl_recv_replies(fd, seq, do_handle_getifaddr, ifc) < 0)
+        goto out;
+    if (nl_sendgetroutes4(fd, ++seq, client_config->ifindex) < 0 ||
+        nl_recv_replies(fd, seq, do_handle_getroute, ifc) < 0)
+        goto out;
+    if (nl_sendgetlink(fd, ++seq, client_config->ifindex) < 0 ||
+        nl_recv_replies(fd, seq, do_handle_getmtu, ifc) < 0)
+        goto out;
+    ret = 0;
+  out:
+    close(fd);
+    return ret;
 }
 
 static int get_if_index_and_mac(const struct nlmsghdr *nlh,
@@ -110,10 +316,10 @@ static int get_if_index_and_mac(const struct nlmsghdr *nlh,
 {
     struct rtattr *tb[IFLA_MAX] = {0};
     nl_rtattr_parse(nlh, sizeof *ifm, rtattr_assign, tb);
-    if (tb[IFLA_IFNAME] && !strncmp(client_config.interface,
+    if (tb[IFLA_IFNAME] && !strncmp(client_config->interface,
                                     RTA_DATA(tb[IFLA_IFNAME]),
-                                    sizeof client_config.interface)) {
-        client_config.ifindex = ifm->ifi_index;
+                                    sizeof client_config->interface)) {
+        client_config->ifindex = ifm->ifi_index;
         if (!tb[IFLA_ADDRESS])
             suicide("FATAL: Adapter %s lacks a hardware address.");
         int maclen = tb[IFLA_ADDRESS]->rta_len - 4;
@@ -123,9 +329,9 @@ static int get_if_index_and_mac(const struct nlmsghdr *nlh,
 
         const unsigned char *mac = RTA_DATA(tb[IFLA_ADDRESS]);
         log_line("%s hardware address %x:%x:%x:%x:%x:%x",
-                 client_config.interface,
+                 client_config->interface,
                  mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-        memcpy(client_config.arp, mac, 6);
+        memcpy(client_config->arp, mac, 6);
         return 1;
     }
     return 0;
@@ -167,20 +373,20 @@ int nl_getifdata(void)
     int fd = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
     if (fd < 0) {
         log_line("%s: (%s) netlink socket open failed: %s",
-                 client_config.interface, __func__, strerror(errno));
+                 client_config->interface, __func__, strerror(errno));
         goto fail;
     }
 
     struct timespec ts;
     if (clock_gettime(CLOCK_REALTIME, &ts) < 0) {
         log_line("%s: (%s) clock_gettime failed",
-                 client_config.interface, __func__);
+                 client_config->interface, __func__);
         goto fail_fd;
     }
     uint32_t seq = ts.tv_nsec;
-    if (nl_sendgetlinks(fd, seq)) {
-        log_line("%s: (%s) nl_sendgetlinks failed",
-                 client_config.interface, __func__);
+    if (nl_sendgetlink_name(fd, seq, client_config->interface)) {
+        log_line("%s: (%s) nl_sendgetlink_name failed",
+                 client_config->interface, __func__);
         goto fail_fd;
     }
 
@@ -41,8 +41,22 @@ enum {
     IFS_REMOVED
 };
 
+// The IPv4 configuration of the interface as read back from the kernel.
+struct nl_ifconfig {
+    uint32_t ipaddr;    // The address that was looked for.
+    uint32_t bcast;     // Broadcast address, or 0 if it has none.
+    uint32_t router;    // Gateway of our default route, or 0 if none.
+    uint32_t mtu;       // Interface MTU, or 0 if unknown.
+    uint8_t prefixlen;
+    bool have_ipaddr;   // Is ipaddr configured on the interface?
+};
+
 bool nl_event_carrier_wentup(int state);
-int nl_event_get(struct client_state_t cs[static 1]);
+void nl_event_set_filter(int nlfd);
+void nl_event_get(int nlfd, uint32_t portid,
+                  struct client_state_t clients[static 1]);
 int nl_getifdata(void);
+int nl_getlinkstate(void);
+int nl_getifconfig(uint32_t ipaddr, struct nl_ifconfig ifc[static 1]);
 
 #endif /* NK_NETLINK_H_ */
@@ -148,7 +148,8 @@ int nl_foreach_nlmsg(char buf[static 1], size_t blen, uint32_t seq, uint32_t por
     return 0;
 }
 
-static int nl_sendgetlink_do(int fd, uint32_t seq, int ifindex, int by_ifindex)
+static int nl_sendgetlink_do(int fd, uint32_t seq, int ifindex,
+                             const char *ifname, int dump)
 {
     char nlbuf[512];
     struct nlmsghdr *nlh = (struct nlmsghdr *)nlbuf;
@@ -157,12 +158,17 @@ static int nl_sendgetlink_do(int fd, uint32_t seq, int ifindex, int by_ifindex)
     memset(nlbuf, 0, sizeof nlbuf);
     nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
     nlh->nlmsg_type = RTM_GETLINK;
-    nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ROOT;
+    // Without NLM_F_ROOT the kernel replies with just the one link that
+    // matches ifi_index or IFLA_IFNAME rather than every link on the host.
+    nlh->nlmsg_flags = NLM_F_REQUEST | (dump ? NLM_F_ROOT : 0);
     nlh->nlmsg_seq = seq;
 
-    if (by_ifindex) {
-        ifinfomsg = NLMSG_DATA(nlh);
-        ifinfomsg->ifi_index = ifindex;
+    ifinfomsg = NLMSG_DATA(nlh);
+    ifinfomsg->ifi_index = ifindex;
+    if (ifname && nl_add_rtattr(nlh, sizeof nlbuf, IFLA_IFNAME,
+                                ifname, strlen(ifname) + 1) < 0) {
+        log_error("%s: couldn't add IFLA_IFNAME to nlmsg", __func__);
+        return -1;
     }
 
     struct sockaddr_nl addr = {
@@ -184,12 +190,17 @@ static int nl_sendgetlink_do(int fd, uint32_t seq, int ifindex, int by_ifindex)
 
 int nl_sendgetlinks(int fd, uint32_t seq)
 {
-    return nl_sendgetlink_do(fd, seq, 0, 0);
+    return nl_sendgetlink_do(fd, seq, 0, NULL, 1);
 }
 
 int nl_sendgetlink(int fd, uint32_t seq, int ifindex)
 {
-    return nl_sendgetlink_do(fd, seq, ifindex, 1);
+    return nl_sendgetlink_do(fd, seq, ifindex, NULL, 0);
+}
+
+int nl_sendgetlink_name(int fd, uint32_t seq, const char ifname[static 1])
+{
+    return nl_sendgetlink_do(fd, seq, 0, ifname, 0);
 }
 
 static int nl_sendgetaddr_do(int fd, uint32_t seq, uint32_t ifindex, int by_ifindex,
@@ -258,6 +269,61 @@ int nl_sendgetaddr6(int fd, uint32_t seq, uint32_t ifindex)
     return nl_sendgetaddr_do(fd, seq, ifindex, 1, AF_INET6, 1);
 }
 
+// Dumps the IPv4 routes of the main table that go out through ifindex.
+// The kernel only filters them when strict checking is enabled.
+int nl_sendgetroutes4(int fd, uint32_t seq, int ifindex)
+{
+    char nlbuf[512];
+    struct nlmsghdr *nlh = (struct nlmsghdr *)nlbuf;
+    struct rtmsg *rtmsg;
+
+    memset(nlbuf, 0, sizeof nlbuf);
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    nlh->nlmsg_type = RTM_GETROUTE;
+    nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ROOT;
+    nlh->nlmsg_seq = seq;
+
+    rtmsg = NLMSG_DATA(nlh);
+    rtmsg->rtm_family = AF_INET;
+    rtmsg->rtm_table = RT_TABLE_MAIN;
+    if (nl_add_rtattr(nlh, sizeof nlbuf, RTA_OIF,
+                      &ifindex, sizeof ifindex) < 0) {
+        log_error("%s: couldn't add RTA_OIF to nlmsg", __func__);
+        return -1;
+    }
+
+    struct sockaddr_nl addr = {
+        .nl_family = AF_NETLINK,
+    };
+    ssize_t r = safe_sendto(fd, nlbuf, nlh->nlmsg_len, 0,
+                            (struct sockaddr *)&addr, sizeof addr);
+    if (r < 0 || (size_t)r != nlh->nlmsg_len) {
+        if (r < 0)
+            log_error("%s: sendto socket failed: %s", __func__,
+                      strerror(errno));
+        else
+            log_error("%s: sendto short write: %zd < %u", __func__, r,
+                      nlh->nlmsg_len);
+        return -1;
+    }
+    return 0;
+}
+
+// Asks the kernel to validate GET requests strictly and to honor the
+// header fields of dump requests as filters (Linux 4.20+).  Without it,
+// an RTM_GETADDR dump for one ifindex returns every address on the host.
+int nl_set_strict_check(int fd)
+{
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK 12
+#endif
+    int one = 1;
+    if (setsockopt(fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK,
+                   &one, sizeof one) < 0)
+        return -1;
+    return 0;
+}
+
 int nl_open(int nltype, unsigned nlgroup, uint32_t *nlportid)
 {
     int fd;
@@ -56,13 +56,16 @@ int nl_foreach_nlmsg(char *buf, size_t blen, uint32_t seq,
                      nlmsg_foreach_fn pfn, void *fnarg);
 int nl_sendgetlinks(int fd, uint32_t seq);
 int nl_sendgetlink(int fd, uint32_t seq, int ifindex);
+int nl_sendgetlink_name(int fd, uint32_t seq, const char ifname[static 1]);
 int nl_sendgetaddr(int fd, uint32_t seq, uint32_t ifindex);
 int nl_sendgetaddr4(int fd, uint32_t seq, uint32_t ifindex);
 int nl_sendgetaddr6(int fd, uint32_t seq, uint32_t ifindex);
 int nl_sendgetaddrs(int fd, uint32_t seq);
 int nl_sendgetaddrs4(int fd, uint32_t seq);
 int nl_sendgetaddrs6(int fd, uint32_t seq);
+int nl_sendgetroutes4(int fd, uint32_t seq, int ifindex);
 
+int nl_set_strict_check(int fd);
 int nl_open(int nltype, unsigned nlgroup, uint32_t *nlportid);
 
 #endif /* NK_NL_H_ */
@@ -35,86 +35,86 @@
 
 #include "options.h"
 
-static int do_overload_value(const uint8_t *buf, ssize_t blen, int overload)
+struct dhcp_opt_span {
+    const uint8_t *src;
+    uint8_t code;
+    uint8_t len;
+};
+
+// Every option takes at least two bytes of the option areas.
+#define MAX_OPT_SPANS (sizeof ((struct dhcp_opts *)0)->data / 2)
+
+// Records the options of one option area.  Returns true if the area was
+// terminated by an END option.
+static bool do_index_dhcp_opts(const uint8_t *buf, size_t blen,
+                               struct dhcp_opts opts[static 1],
+                               struct dhcp_opt_span spans[static 1],
+                               size_t nspans[static 1])
 {
-    ssize_t i = 0;
+    size_t i = 0;
     while (i < blen) {
         if (buf[i] == DCODE_PADDING) {
             ++i;
             continue;
         }
         if (buf[i] == DCODE_END)
-            break;
+            return true;
         if (i >= blen - 2)
             break;
-        if (buf[i] == DCODE_OVERLOAD) {
-            if (buf[i+1] == 1) {
-                overload |= buf[i+2];
-                i += 3;
-                continue;
-            }
-        }
-        i += buf[i+1] + 2;
+        size_t soptsiz = buf[i+1];
+        if (blen < soptsiz + i + 2)
+            break;
+        spans[(*nspans)++] = (struct dhcp_opt_span){
+            .src = buf + i + 2, .code = buf[i], .len = (uint8_t)soptsiz,
+        };
+        opts->len[buf[i]] += soptsiz;
+        i += soptsiz + 2;
     }
-    return overload;
+    return false;
 }
 
-static int overload_value(const struct dhcpmsg * const packet)
+// Builds the option index of a received packet.  Returns false if the
+// options field has no END option.
+bool index_dhcp_opts(struct dhcp_opts opts[static 1],
+                     const struct dhcpmsg packet[static 1])
 {
-    int ol = do_overload_value(packet->options, sizeof packet->options, 0);
-    if (ol & 1 && ol & 2)
-        return ol;
-    if (ol & 1) {
-        ol |= do_overload_value(packet->file, sizeof packet->file, ol);
-        return ol;
-    }
-    if (ol & 2) {
-        ol |= do_overload_value(packet->sname, sizeof packet->sname, ol);
-        return ol;
+    struct dhcp_opt_span spans[MAX_OPT_SPANS];
+    size_t nspans = 0;
+    memset(opts->len, 0, sizeof opts->len);
+
+    bool ended = do_index_dhcp_opts(packet->options, sizeof packet->options,
+                                    opts, spans, &nspans);
+    int ol = 0;
+    for (size_t i = 0; i < nspans; ++i) {
+        if (spans[i].code == DCODE_OVERLOAD && spans[i].len == 1)
+            ol |= spans[i].src[0];
     }
-    return ol; // ol == 0
-}
+    if (ol & 1)
+        do_index_dhcp_opts(packet->file, sizeof packet->file,
+                           opts, spans, &nspans);
+    if (ol & 2)
+        do_index_dhcp_opts(packet->sname, sizeof packet->sname,
+                           opts, spans, &nspans);
 
-static void do_get_dhcp_opt(const uint8_t *sbuf, size_t slen, uint8_t code,
-                            uint8_t *dbuf, size_t dlen, size_t *didx)
-{
-    size_t i = 0;
-    while (i < slen) {
-        if (sbuf[i] == DCODE_PADDING) {
-            ++i;
-            continue;
-        }
-        if (sbuf[i] == DCODE_END)
-            break;
-        if (i >= slen - 2)
-            break;
-        size_t soptsiz = sbuf[i+1];
-        if (sbuf[i] == code) {
-            if (dlen < soptsiz + *didx)
-                return;
-            if (slen < soptsiz + i + 2)
-                return;
-            memcpy(dbuf + *didx, sbuf+i+2, soptsiz);
-            *didx += soptsiz;
-        }
-        i += soptsiz + 2;
+    uint16_t pos[256];
+    size_t off = 0;
+    for (size_t i = 0; i < 256; ++i) {
+        opts->off[i] = pos[i] = (uint16_t)off;
+        off += opts->len[i];
     }
+    for (size_t i = 0; i < nspans; ++i) {
+        memcpy(opts->data + pos[spans[i].code], spans[i].src, spans[i].len);
+        pos[spans[i].code] += spans[i].len;
+    }
+    return ended;
 }
 
-size_t get_dhcp_opt(const struct dhcpmsg * const packet, uint8_t code,
-                     uint8_t *dbuf, size_t dlen)
+// Returns the data of an option and stores its length in len.
+const uint8_t *get_dhcp_opt(const struct dhcp_opts opts[static 1],
+                            uint8_t code, size_t len[static 1])
 {
-    int ol = overload_value(packet);
-    size_t didx = 0;
-    do_get_dhcp_opt(packet->options, sizeof packet->options, code,
-                    dbuf, dlen, &didx);
-    if (ol & 1)
-        do_get_dhcp_opt(packet->file, sizeof packet->file, code,
-                        dbuf, dlen, &didx);
-    if (ol & 2)
-        do_get_dhcp_opt(packet->sname, sizeof packet->sname, code,
-                        dbuf, dlen, &didx);
-    return didx;
+    *len = opts->len[code];
+    return opts->data + opts->off[code];
 }
 
 // return the position of the 'end' option
@@ -303,57 +303,41 @@ void add_option_hostname(struct dhcpmsg *packet, const char * const hostname,
 }
 #endif
 
-uint32_t get_option_router(const struct dhcpmsg * const packet)
+uint32_t get_option_router(const struct dhcp_opts opts[static 1])
 {
     uint32_t ret = 0;
-    uint8_t buf[MAX_DOPT_SIZE];
-    const size_t ol = get_dhcp_opt(packet, DCODE_ROUTER, buf, sizeof buf);
-    if (ol == sizeof ret)
-        memcpy(&ret, buf, sizeof ret);
+    if (opts->len[DCODE_ROUTER] == sizeof ret)
+        memcpy(&ret, opts->data + opts->off[DCODE_ROUTER], sizeof ret);
     return ret;
 }
 
-uint8_t get_option_msgtype(const struct dhcpmsg * const packet)
+uint8_t get_option_msgtype(const struct dhcp_opts opts[static 1])
 {
     uint8_t ret = 0;
-    uint8_t buf[MAX_DOPT_SIZE];
-    const size_t ol = get_dhcp_opt(packet, DCODE_MSGTYPE, buf, sizeof buf);
-    if (ol == sizeof ret)
-        ret = buf[0];
+    if (opts->len[DCODE_MSGTYPE] == sizeof ret)
+        ret = opts->data[opts->off[DCODE_MSGTYPE]];
     return ret;
 }
 
-uint32_t get_option_serverid(const struct dhcpmsg *const packet, int *found)
+uint32_t get_option_serverid(const struct dhcp_opts opts[static 1],
+                             int *found)
 {
     uint32_t ret = 0;
-    uint8_t buf[MAX_DOPT_SIZE];
     *found = 0;
-    const size_t ol = get_dhcp_opt(packet, DCODE_SERVER_ID, buf, sizeof buf);
-    if (ol == sizeof ret) {
+    if (opts->len[DCODE_SERVER_ID] == sizeof ret) {
         *found = 1;
-        memcpy(&ret, buf, sizeof ret);
+        memcpy(&ret, opts->data + opts->off[DCODE_SERVER_ID], sizeof ret);
     }
     return ret;
 }
 
-uint32_t get_option_leasetime(const struct dhcpmsg * const packet)
+uint32_t get_option_leasetime(const struct dhcp_opts opts[static 1])
 {
     uint32_t ret = 0;
-    uint8_t buf[MAX_DOPT_SIZE];
-    const size_t ol = get_dhcp_opt(packet, DCODE_LEASET, buf, sizeof buf);
-    if (ol == sizeof ret) {
-        memcpy(&ret, buf, sizeof ret);
+    if (opts->len[DCODE_LEASET] == sizeof ret) {
+        memcpy(&ret, opts->data + opts->off[DCODE_LEASET], sizeof ret);
         ret = ntohl(ret);
     }
     return ret;
 }
 
-// Returned buffer is not nul-terminated.
-size_t get_option_clientid(const struct dhcpmsg * const packet, char *cbuf,
-                           size_t clen)
-{
-    if (clen < 1)
-        return 0;
-    return get_dhcp_opt(packet, DCODE_CLIENT_ID, (uint8_t *)cbuf, clen);
-}
-
@@ -54,10 +54,10 @@
 #define DCODE_CLIENT_ID    0x3d
 #define DCODE_END          0xff
 
-#define MAX_DOPT_SIZE 500
-
-size_t get_dhcp_opt(const struct dhcpmsg * const packet, uint8_t code,
-                    uint8_t *dbuf, size_t dlen);
+bool index_dhcp_opts(struct dhcp_opts opts[static 1],
+                     const struct dhcpmsg packet[static 1]);
+const uint8_t *get_dhcp_opt(const struct dhcp_opts opts[static 1],
+                            uint8_t code, size_t len[static 1]);
 ssize_t get_end_option_idx(const struct dhcpmsg * const packet);
 
 size_t add_option_string(struct dhcpmsg *packet, uint8_t code,
@@ -83,12 +83,11 @@ void add_option_vendor(struct dhcpmsg *packet, const char * const vendor,
 void add_option_hostname(struct dhcpmsg *packet, const char * const hostname,
                          size_t hsize);
 #endif
-uint32_t get_option_router(const struct dhcpmsg * const packet);
-uint8_t get_option_msgtype(const struct dhcpmsg * const packet);
-uint32_t get_option_serverid(const struct dhcpmsg * const packet, int *found);
-uint32_t get_option_leasetime(const struct dhcpmsg *const packet);
-size_t get_option_clientid(const struct dhcpmsg * const packet,
-                           char *cbuf, size_t clen);
+uint32_t get_option_router(const struct dhcp_opts opts[static 1]);
+uint8_t get_option_msgtype(const struct dhcp_opts opts[static 1]);
+uint32_t get_option_serverid(const struct dhcp_opts opts[static 1],
+                             int *found);
+uint32_t get_option_leasetime(const struct dhcp_opts opts[static 1]);
 
 #endif
 
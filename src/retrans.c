@@ -0,0 +1,149 @@
+/* retrans.c - DHCP retransmission and backoff policies
+ *
+ * Copyright (c) 2017 Nicholas J. Kain <njkain at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "nk/log.h"
+#include "nk/random.h"
+#include "retrans.h"
+
+// RFC2131 4.1: 4, 8, 16, 32, then 64 seconds with a second of jitter.
+// Renew and rebind requests are spaced about a minute apart.  The number of
+// DHCPREQUESTs before giving up is ours, as is the offer window.
+#define RETRANS_RFC {                                         \
+    [RT_SELECTING] = { 4000, 2, 64000, 1000, false, 0, 250 }, \
+    [RT_REQUESTING] = { 4000, 2, 64000, 1000, false, 5 },     \
+    [RT_RENEWING] = { 50000, 1, 50000, 20000, false, 0 },     \
+    [RT_REBINDING] = { 50000, 1, 50000, 20000, false, 0 },    \
+}
+static const struct retrans_policy retrans_rfc[RT_MAX] = RETRANS_RFC;
+
+// For networks where servers answer within milliseconds.  A lost packet
+// costs a fraction of a second instead of four, and the proportional
+// jitter keeps a mass of clients from retrying in lockstep after a server
+// outage.
+static const struct retrans_policy retrans_fast_lan[RT_MAX] = {
+    [RT_SELECTING] = { 250, 2, 8000, 25, true, 0, 50 },
+    [RT_REQUESTING] = { 250, 2, 4000, 25, true, 5 },
+    [RT_RENEWING] = { 2000, 2, 60000, 25, true, 0 },
+    [RT_REBINDING] = { 2000, 2, 60000, 25, true, 0 },
+};
+
+static struct retrans_policy retrans[RT_MAX] = RETRANS_RFC;
+
+// Replaces every phase's policy, so it should be given before any
+// per-phase overrides.
+void set_retrans_profile(const char name[static 1])
+{
+    if (!strcmp(name, "rfc"))
+        memcpy(retrans, retrans_rfc, sizeof retrans);
+    else if (!strcmp(name, "fast-lan"))
+        memcpy(retrans, retrans_fast_lan, sizeof retrans);
+    else
+        suicide("unknown retransmit profile '%s' (expected rfc or fast-lan)",
+                name);
+}
+
+static int retrans_field(const char **s, const char *spec, int minval)
+{
+    char *q;
+    long v = strtol(*s, &q, 10);
+    if (q == *s || v < minval || v > INT_MAX)
+        suicide("invalid retransmit policy '%s'", spec);
+    *s = q;
+    return (int)v;
+}
+
+// The spec is "rto,mult,max,jitter,retries[,window]", where times are in
+// ms and jitter may be suffixed with '%' to make it proportional.  The
+// window keeps its current value if it is not given.
+void set_retrans_policy(enum retrans_phase phase, const char spec[static 1])
+{
+    struct retrans_policy p = {0};
+    const char *s = spec;
+    p.rto = retrans_field(&s, spec, 1);
+    if (*s++ != ',') goto fail;
+    p.mult = retrans_field(&s, spec, 1);
+    if (*s++ != ',') goto fail;
+    p.max_ms = retrans_field(&s, spec, p.rto);
+    if (*s++ != ',') goto fail;
+    p.jitter = retrans_field(&s, spec, 0);
+    if (*s == '%') {
+        p.jitter_pct = true;
+        if (p.jitter > 100) goto fail;
+        ++s;
+    }
+    if (*s++ != ',') goto fail;
+    p.retries = (unsigned int)retrans_field(&s, spec, 0);
+    p.window = retrans[phase].window;
+    if (*s == ',') {
+        ++s;
+        p.window = retrans_field(&s, spec, 0);
+    }
+    if (*s) goto fail;
+    retrans[phase] = p;
+    return;
+fail:
+    suicide("invalid retransmit policy '%s'", spec);
+}
+
+unsigned int retrans_retries(enum retrans_phase phase)
+{
+    return retrans[phase].retries;
+}
+
+int retrans_window(enum retrans_phase phase)
+{
+    return retrans[phase].window;
+}
+
+// Returns the time in ms to wait after sending the nth (from zero)
+// transmission of a message before sending it again.
+int retrans_delay(struct client_state_t cs[static 1], enum retrans_phase phase,
+                  unsigned int n)
+{
+    const struct retrans_policy *p = &retrans[phase];
+    long long to = p->rto;
+    for (unsigned int i = 0; i < n && to < p->max_ms; ++i)
+        to *= p->mult;
+    if (to > p->max_ms)
+        to = p->max_ms;
+    // Distributions are a bit biased but it doesn't really matter here.
+    if (p->jitter_pct) {
+        long long span = to * p->jitter / 100;
+        if (span > 0)
+            to += (long long)(nk_random_u32(&cs->rnd_state)
+                              % (uint32_t)(2 * span + 1)) - span;
+    } else if (p->jitter > 0) {
+        to += nk_random_u32(&cs->rnd_state) % (uint32_t)p->jitter;
+    }
+    // A large max_ms plus jitter may not fit in an int.
+    if (to > INT_MAX)
+        to = INT_MAX;
+    return to > 0 ? (int)to : 1;
+}
@@ -0,0 +1,66 @@
+/* retrans.h - DHCP retransmission and backoff policies
+ *
+ * Copyright (c) 2017 Nicholas J. Kain <njkain at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef NDHC_RETRANS_H_
+#define NDHC_RETRANS_H_
+
+#include <stdbool.h>
+#include "ndhc.h"
+
+// The DHCP exchanges that have their own retransmission schedule.
+enum retrans_phase {
+    RT_SELECTING = 0,   // DHCPDISCOVER
+    RT_REQUESTING,      // DHCPREQUEST in REQUESTING and INIT-REBOOT
+    RT_RENEWING,        // Unicast DHCPREQUEST before T2
+    RT_REBINDING,       // Broadcast DHCPREQUEST before the lease expires
+    RT_MAX,
+};
+
+// The nth retransmission waits rto * mult^n ms, capped at max_ms, and then
+// jittered.  If jitter_pct is set, the jitter is uniform within +/- jitter
+// percent of that wait; otherwise, it is uniform in [0, jitter) ms added to
+// the wait.  A retries of 0 means no limit.  After the first DHCPOFFER,
+// the client waits window ms for other servers to make theirs; the window
+// is only used for RT_SELECTING.
+struct retrans_policy {
+    int rto;
+    int mult;
+    int max_ms;
+    int jitter;
+    bool jitter_pct;
+    unsigned int retries;
+    int window;
+};
+
+void set_retrans_profile(const char name[static 1]);
+void set_retrans_policy(enum retrans_phase phase, const char spec[static 1]);
+unsigned int retrans_retries(enum retrans_phase phase);
+int retrans_window(enum retrans_phase phase);
+int retrans_delay(struct client_state_t cs[static 1], enum retrans_phase phase,
+                  unsigned int n);
+
+#endif
@@ -50,13 +50,11 @@ int rfkill_open(bool enable_rfkill[static 1])
     return r;
 }
 
-// check_idx: Does rfkidx have any meaning?
-// rfkidx: Pay attention only to this radio kill switch number.
-int rfkill_get(struct client_state_t cs[static 1],
-               int check_idx, uint32_t rfkidx)
+// rfkidx: Set to the radio kill switch number that the event applies to.
+int rfkill_get(int rfkfd, uint32_t rfkidx[static 1])
 {
     struct rfkill_event event;
-    ssize_t len = safe_read(cs->rfkillFd, (char *)&event, sizeof event);
+    ssize_t len = safe_read(rfkfd, (char *)&event, sizeof event);
     if (len < 0) {
         log_error("rfkill: safe_read failed: %s", strerror(errno));
         return RFK_FAIL;
@@ -67,8 +65,7 @@ int rfkill_get(struct client_state_t cs[static 1],
     }
     log_line("rfkill: idx[%u] type[%u] op[%u] soft[%u] hard[%u]",
              event.idx, event.type, event.op, event.soft, event.hard);
-    if (check_idx && event.idx != rfkidx)
-        return RFK_NONE;
+    *rfkidx = event.idx;
     if (event.op != RFKILL_OP_CHANGE && event.op != RFKILL_OP_CHANGE_ALL)
         return RFK_NONE;
     if (event.soft || event.hard) {
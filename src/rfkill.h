@@ -36,8 +36,7 @@ enum {
 };
 
 int rfkill_open(bool enable_rfkill[static 1]);
-int rfkill_get(struct client_state_t cs[static 1],
-               int check_idx, uint32_t rfkidx);
+int rfkill_get(int rfkfd, uint32_t rfkidx[static 1]);
 
 #endif
 
@@ -27,6 +27,7 @@
  */
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -42,6 +43,7 @@
 #include <sys/prctl.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
+#include <netinet/udp.h>
 #include <netpacket/packet.h>
 #include <net/ethernet.h>
 #include <netinet/if_ether.h>
@@ -68,11 +70,16 @@ gid_t sockd_gid = 0;
 // Interface to make requests of sockd.  Called from ndhc process.
 int request_sockd_fd(char buf[static 1], size_t buflen, char *response)
 {
-    if (!buflen)
+    // Every request starts with the index of the interface it applies to.
+    char req[32];
+    uint16_t idx = client_config_idx();
+    if (!buflen || buflen > sizeof req - sizeof idx)
         return -1;
-    ssize_t r = safe_write(sockdSock[0], buf, buflen);
-    if (r < 0 || (size_t)r != buflen)
-        suicide("%s: (%s) write failed: %d", client_config.interface,
+    memcpy(req, &idx, sizeof idx);
+    memcpy(req + sizeof idx, buf, buflen);
+    ssize_t r = safe_write(sockdSock[0], req, buflen + sizeof idx);
+    if (r < 0 || (size_t)r != buflen + sizeof idx)
+        suicide("%s: (%s) write failed: %d", client_config->interface,
                 __func__, r);
 
     char data[MAX_BUF], control[MAX_BUF];
@@ -88,10 +95,10 @@ int request_sockd_fd(char buf[static 1], size_t buflen, char *response)
     };
     r = safe_recvmsg(sockdSock[0], &msg, 0);
     if (r == 0) {
-        suicide("%s: (%s) recvmsg received EOF", client_config.interface,
+        suicide("%s: (%s) recvmsg received EOF", client_config->interface,
                 __func__);
     } else if (r < 0) {
-        suicide("%s: (%s) recvmsg failed: %s", client_config.interface,
+        suicide("%s: (%s) recvmsg failed: %s", client_config->interface,
                 __func__, strerror(errno));
     }
     data[iov.iov_len] = '\0';
@@ -103,42 +110,42 @@ int request_sockd_fd(char buf[static 1], size_t buflen, char *response)
                 *response = repc;
             else if (repc != buf[0])
                 suicide("%s: (%s) expected %c sockd reply but got %c",
-                        client_config.interface, __func__, buf[0], repc);
+                        client_config->interface, __func__, buf[0], repc);
             int *fd = (int *)CMSG_DATA(cmsg);
             return *fd;
         }
     }
     suicide("%s: (%s) sockd reply did not include a fd",
-            client_config.interface, __func__);
+            client_config->interface, __func__);
 }
 
 static int create_arp_socket(void)
 {
     int fd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, htons(ETH_P_ARP));
     if (fd < 0) {
-        log_error("%s: (%s) socket failed: %s", client_config.interface,
+        log_error("%s: (%s) socket failed: %s", client_config->interface,
                   __func__, strerror(errno));
         goto out;
     }
 
     int opt = 1;
     if (setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &opt, sizeof opt) < 0) {
-        log_error("%s: (%s) setsockopt failed: %s", client_config.interface,
+        log_error("%s: (%s) setsockopt failed: %s", client_config->interface,
                   __func__, strerror(errno));
         goto out_fd;
     }
     if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
-        log_error("%s: (%s) fcntl failed: %s", client_config.interface,
+        log_error("%s: (%s) fcntl failed: %s", client_config->interface,
                   __func__, strerror(errno));
         goto out_fd;
     }
     struct sockaddr_ll saddr = {
         .sll_family = AF_PACKET,
         .sll_protocol = htons(ETH_P_ARP),
-        .sll_ifindex = client_config.ifindex,
+        .sll_ifindex = client_config->ifindex,
     };
     if (bind(fd, (struct sockaddr *)&saddr, sizeof(struct sockaddr_ll)) < 0) {
-        log_error("%s: (%s) bind failed: %s", client_config.interface,
+        log_error("%s: (%s) bind failed: %s", client_config->interface,
                   __func__, strerror(errno));
         goto out_fd;
     }
@@ -155,18 +162,18 @@ static int create_udp_socket(uint32_t ip, uint16_t port, char *iface)
     int fd;
     if ((fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP)) < 0) {
         log_error("%s: (%s) socket failed: %s",
-                  client_config.interface, __func__, strerror(errno));
+                  client_config->interface, __func__, strerror(errno));
         goto out;
     }
     int opt = 1;
     if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof opt) < 0) {
         log_error("%s: (%s) Set reuse addr failed: %s",
-                  client_config.interface, __func__, strerror(errno));
+                  client_config->interface, __func__, strerror(errno));
         goto out_fd;
     }
     if (setsockopt(fd, SOL_SOCKET, SO_DONTROUTE, &opt, sizeof opt) < 0) {
         log_error("%s: (%s) Set don't route failed: %s",
-                  client_config.interface, __func__, strerror(errno));
+                  client_config->interface, __func__, strerror(errno));
         goto out_fd;
     }
     struct ifreq ifr;
@@ -174,17 +181,17 @@ static int create_udp_socket(uint32_t ip, uint16_t port, char *iface)
     ssize_t sl = snprintf(ifr.ifr_name, sizeof ifr.ifr_name, "%s", iface);
     if (sl < 0 || (size_t)sl >= sizeof ifr.ifr_name) {
         log_error("%s: (%s) Set interface name failed.",
-                  client_config.interface, __func__);
+                  client_config->interface, __func__);
         goto out_fd;
     }
     if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, &ifr, sizeof ifr) < 0) {
         log_error("%s: (%s) Set bind to device failed: %s",
-                  client_config.interface, __func__, strerror(errno));
+                  client_config->interface, __func__, strerror(errno));
         goto out_fd;
     }
     if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
         log_error("%s: (%s) Set non-blocking failed: %s",
-                  client_config.interface, __func__, strerror(errno));
+                  client_config->interface, __func__, strerror(errno));
         goto out_fd;
     }
 
@@ -195,7 +202,7 @@ static int create_udp_socket(uint32_t ip, uint16_t port, char *iface)
     };
     if (bind(fd, (struct sockaddr *)&sa, sizeof sa) < 0) {
         log_error("%s: (%s) bind failed: %s",
-                  client_config.interface, __func__, strerror(errno));
+                  client_config->interface, __func__, strerror(errno));
         goto out_fd;
     }
 
@@ -229,10 +236,10 @@ static int create_raw_socket(struct sockaddr_ll *sa, bool *using_bpf,
                     *using_bpf = true;
             } else
                 log_warning("%s: Failed to lock BPF for raw socket: %s",
-                            client_config.interface, strerror(errno));
+                            client_config->interface, strerror(errno));
         } else
             log_warning("%s: Failed to set BPF for raw socket: %s",
-                        client_config.interface, strerror(errno));
+                        client_config->interface, strerror(errno));
     }
 
     int opt = 1;
@@ -257,9 +264,20 @@ out:
     return -1;
 }
 
-static int create_raw_listen_socket(bool *using_bpf)
+// The filter only passes replies to the current transaction (xid) that
+// are addressed to our hardware address, so the master is not woken for
+// DHCP traffic that belongs to other clients on the segment.
+static int create_raw_listen_socket(uint32_t xid, uint8_t client_mac[6],
+                                    bool *using_bpf)
 {
-    static const struct sock_filter sf_dhcp[] = {
+    // BPF loads are big-endian, so these match the on-wire bytes.
+    uint32_t mac4b;
+    uint16_t mac2b;
+    memcpy(&mac4b, client_mac, 4);
+    memcpy(&mac2b, client_mac + 4, 2);
+    const size_t dhcp_off = sizeof(struct iphdr) + sizeof(struct udphdr);
+
+    struct sock_filter sf_dhcp[] = {
         // Verify that the packet has a valid IPv4 version nibble and
         // that no IP options are defined.
         BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 0),
@@ -283,6 +301,21 @@ static int create_raw_listen_socket(bool *using_bpf)
         BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
                  (DHCP_SERVER_PORT << 16) + DHCP_CLIENT_PORT, 1, 0),
         BPF_STMT(BPF_RET + BPF_K, 0),
+        // Verify that the DHCP xid is that of our current transaction.
+        // The IP header is known to be 20 bytes long.
+        BPF_STMT(BPF_LD + BPF_W + BPF_ABS,
+                 dhcp_off + offsetof(struct dhcpmsg, xid)),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohl(xid), 1, 0),
+        BPF_STMT(BPF_RET + BPF_K, 0),
+        // Verify that the DHCP chaddr is our hardware address.
+        BPF_STMT(BPF_LD + BPF_W + BPF_ABS,
+                 dhcp_off + offsetof(struct dhcpmsg, chaddr)),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohl(mac4b), 1, 0),
+        BPF_STMT(BPF_RET + BPF_K, 0),
+        BPF_STMT(BPF_LD + BPF_H + BPF_ABS,
+                 dhcp_off + offsetof(struct dhcpmsg, chaddr) + 4),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohs(mac2b), 1, 0),
+        BPF_STMT(BPF_RET + BPF_K, 0),
         // Get the UDP length field and store it in X.
         BPF_STMT(BPF_LD + BPF_H + BPF_IND, 4),
         BPF_STMT(BPF_MISC + BPF_TAX, 0),
@@ -297,34 +330,50 @@ static int create_raw_listen_socket(bool *using_bpf)
         BPF_STMT(BPF_LD + BPF_MEM, 0),
         BPF_STMT(BPF_RET + BPF_A, 0),
     };
-    static const struct sock_fprog sfp_dhcp = {
+    const struct sock_fprog sfp_dhcp = {
         .len = sizeof sf_dhcp / sizeof sf_dhcp[0],
-        .filter = (struct sock_filter *)sf_dhcp,
+        .filter = sf_dhcp,
     };
     struct sockaddr_ll sa = {
         .sll_family = AF_PACKET,
         .sll_protocol = htons(ETH_P_IP),
-        .sll_ifindex = client_config.ifindex,
+        .sll_ifindex = client_config->ifindex,
     };
     return create_raw_socket(&sa, using_bpf, &sfp_dhcp);
 }
 
+// The master keeps this socket open and only ever sends on it, so it
+// should not queue a copy of every IP packet received on the interface.
 static int create_raw_broadcast_socket(void)
 {
+    static const struct sock_filter sf_drop[] = {
+        BPF_STMT(BPF_RET + BPF_K, 0),
+    };
+    static const struct sock_fprog sfp_drop = {
+        .len = sizeof sf_drop / sizeof sf_drop[0],
+        .filter = (struct sock_filter *)sf_drop,
+    };
     struct sockaddr_ll da = {
         .sll_family = AF_PACKET,
         .sll_protocol = htons(ETH_P_IP),
         .sll_pkttype = PACKET_BROADCAST,
-        .sll_ifindex = client_config.ifindex,
+        .sll_ifindex = client_config->ifindex,
         .sll_halen = 6,
     };
     memcpy(da.sll_addr, "\xff\xff\xff\xff\xff\xff", 6);
-    return create_raw_socket(&da, NULL, NULL);
+    return create_raw_socket(&da, NULL, &sfp_drop);
 }
 
-static bool arp_set_bpf_basic(int fd)
+// Only ARP packets that mention one of the addresses we are probing or
+// querying, or replies addressed to our hardware address, are passed.
+static bool arp_set_bpf_basic(int fd, uint32_t ip_a, uint32_t ip_b,
+                              uint8_t client_mac[6])
 {
-    static const struct sock_filter sf_arp[] = {
+    uint32_t mac4b;
+    uint16_t mac2b;
+    memcpy(&mac4b, client_mac, 4);
+    memcpy(&mac2b, client_mac + 4, 2);
+    struct sock_filter sf_arp[] = {
         // Verify that the frame has ethernet protocol type of ARP
         // and that the ARP hardware type field indicates Ethernet.
         BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 12),
@@ -337,12 +386,29 @@ static bool arp_set_bpf_basic(int fd)
         BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 16),
         BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, (ETH_P_IP << 16) | 0x0604, 1, 0),
         BPF_STMT(BPF_RET + BPF_K, 0),
-        // Sanity tests passed, so send all possible data.
+        // Pass the packet if the ARP sender IP is one we are interested in.
+        BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 28),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohl(ip_a), 11, 0),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohl(ip_b), 10, 0),
+        // Likewise for the ARP target IP.
+        BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 38),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohl(ip_a), 8, 0),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohl(ip_b), 7, 0),
+        // Otherwise only pass ARP replies whose target hardware address
+        // is our hardware address.
+        BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 20),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ARPOP_REPLY, 0, 4),
+        BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 32),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohl(mac4b), 0, 2),
+        BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 36),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohs(mac2b), 1, 0),
+        BPF_STMT(BPF_RET + BPF_K, 0),
+        // Packet is of interest, so send all possible data.
         BPF_STMT(BPF_RET + BPF_K, 0x7fffffff),
     };
-    static const struct sock_fprog sfp_arp = {
+    struct sock_fprog sfp_arp = {
         .len = sizeof sf_arp / sizeof sf_arp[0],
-        .filter = (struct sock_filter *)sf_arp,
+        .filter = sf_arp,
     };
     int ret = setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &sfp_arp,
                          sizeof sfp_arp) != -1;
@@ -355,11 +421,11 @@ static bool arp_set_bpf_basic(int fd)
         // filter.
         if (ret < 0)
             log_warning("%s: Failed to lock BPF for basic ARP socket: %s",
-                        client_config.interface, strerror(errno));
+                        client_config->interface, strerror(errno));
         return ret >= 0;
     } else
         log_warning("%s: Failed to set BPF for basic ARP socket: %s",
-                    client_config.interface, strerror(errno));
+                    client_config->interface, strerror(errno));
     return false;
 }
 
@@ -421,11 +487,11 @@ static bool arp_set_bpf_defense(int fd, uint32_t client_addr,
         // filter.
         if (ret < 0)
             log_warning("%s: Failed to lock BPF for defense ARP socket: %s",
-                        client_config.interface, strerror(errno));
+                        client_config->interface, strerror(errno));
         return ret >= 0;
     } else
         log_warning("%s: Failed to set BPF for defense ARP socket: %s",
-                    client_config.interface, strerror(errno));
+                    client_config->interface, strerror(errno));
     return false;
 }
 
@@ -438,11 +504,12 @@ static int create_arp_defense_socket(uint32_t client_addr,
     return fd;
 }
 
-static int create_arp_basic_socket(bool *using_bpf)
+static int create_arp_basic_socket(uint32_t ip_a, uint32_t ip_b,
+                                   uint8_t client_mac[6], bool *using_bpf)
 {
     assert(using_bpf);
     int fd = create_arp_socket();
-    *using_bpf = arp_set_bpf_basic(fd);
+    *using_bpf = arp_set_bpf_basic(fd, ip_a, ip_b, client_mac);
     return fd;
 }
 
@@ -470,13 +537,13 @@ static void xfer_fd(int fd, char cmd)
     if (sendmsg(sockdSock[1], &msg, 0) < 0) {
         if (errno == EINTR)
             goto retry;
-        suicide("%s: (%s) sendmsg failed: %s", client_config.interface,
+        suicide("%s: (%s) sendmsg failed: %s", client_config->interface,
                 __func__, strerror(errno));
     }
     close(fd);
 }
 
-static size_t execute_sockd(char buf[static 1], size_t buflen)
+static size_t execute_sockd_cmd(char buf[static 1], size_t buflen)
 {
     if (!buflen)
         return 0;
@@ -484,15 +551,31 @@ static size_t execute_sockd(char buf[static 1], size_t buflen)
     char c = buf[0];
     switch (c) {
     case 'L': {
+        uint32_t xid;
+        uint8_t client_mac[6];
         bool using_bpf;
-        int fd = create_raw_listen_socket(&using_bpf);
+        if (buflen < 1 + sizeof xid + 6)
+            suicide("%s: (%s) 'L' does not have necessary arguments: %zu",
+                      client_config->interface, __func__, buflen);
+        memcpy(&xid, buf + 1, sizeof xid);
+        memcpy(client_mac, buf + 1 + sizeof xid, 6);
+        int fd = create_raw_listen_socket(xid, client_mac, &using_bpf);
         xfer_fd(fd, using_bpf ? 'L' : 'l');
-        return 1;
+        return 11;
     }
     case 'a': {
+        uint32_t ip_a, ip_b;
+        uint8_t client_mac[6];
         bool using_bpf;
-        int fd = create_arp_basic_socket(&using_bpf);
-        xfer_fd(fd, using_bpf ? 'A' : 'a'); return 1;
+        if (buflen < 1 + sizeof ip_a + sizeof ip_b + 6)
+            suicide("%s: (%s) 'a' does not have necessary arguments: %zu",
+                      client_config->interface, __func__, buflen);
+        memcpy(&ip_a, buf + 1, sizeof ip_a);
+        memcpy(&ip_b, buf + 1 + sizeof ip_a, sizeof ip_b);
+        memcpy(client_mac, buf + 1 + sizeof ip_a + sizeof ip_b, 6);
+        int fd = create_arp_basic_socket(ip_a, ip_b, client_mac, &using_bpf);
+        xfer_fd(fd, using_bpf ? 'A' : 'a');
+        return 15;
     }
     case 'd': {
         uint32_t client_addr;
@@ -500,7 +583,7 @@ static size_t execute_sockd(char buf[static 1], size_t buflen)
         bool using_bpf;
         if (buflen < 1 + sizeof client_addr + 6)
             suicide("%s: (%s) 'd' does not have necessary arguments: %zu",
-                      client_config.interface, __func__, buflen);
+                      client_config->interface, __func__, buflen);
         memcpy(&client_addr, buf + 1, sizeof client_addr);
         memcpy(client_mac, buf + 1 + sizeof client_addr, 6);
         int fd = create_arp_defense_socket(client_addr, client_mac,
@@ -513,24 +596,39 @@ static size_t execute_sockd(char buf[static 1], size_t buflen)
         uint32_t client_addr;
         if (buflen < 1 + sizeof client_addr)
             suicide("%s: (%s) 'u' does not have necessary arguments: %zu",
-                      client_config.interface, __func__, buflen);
+                      client_config->interface, __func__, buflen);
         memcpy(&client_addr, buf + 1, sizeof client_addr);
         xfer_fd(create_udp_socket(client_addr, DHCP_CLIENT_PORT,
-                                  client_config.interface), 'u');
+                                  client_config->interface), 'u');
         return 5;
     }
     default: suicide("%s: (%s) received invalid commands: '%c'",
-                     client_config.interface, __func__, c);
+                     client_config->interface, __func__, c);
     }
 }
 
+// Each request is prefixed with the index of the interface it applies to.
+static size_t execute_sockd(char buf[static 1], size_t buflen)
+{
+    uint16_t idx;
+    if (buflen <= sizeof idx)
+        return 0;
+    memcpy(&idx, buf, sizeof idx);
+    if (idx >= client_count)
+        suicide("%s: (%s) received request for unknown interface %u",
+                client_config->interface, __func__, idx);
+    client_config = &client_configs[idx];
+    size_t r = execute_sockd_cmd(buf + sizeof idx, buflen - sizeof idx);
+    return r ? r + sizeof idx : 0;
+}
+
 static void process_client_socket(void)
 {
     static char buf[MAX_BUF];
     static size_t buflen;
 
     if (buflen == MAX_BUF)
-        suicide("%s: (%s) receive buffer exhausted", client_config.interface,
+        suicide("%s: (%s) receive buffer exhausted", client_config->interface,
                 __func__);
 
     int r = safe_recv(sockdSock[1], buf + buflen, sizeof buf - buflen,
@@ -542,7 +640,7 @@ static void process_client_socket(void)
         if (errno == EAGAIN || errno == EWOULDBLOCK)
             return;
         suicide("%s: (%s) error reading from ndhc -> sockd socket: %s",
-                client_config.interface, __func__, strerror(errno));
+                client_config->interface, __func__, strerror(errno));
     }
     buflen += (size_t)r;
     buflen -= execute_sockd(buf, buflen);
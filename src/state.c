@@ -31,17 +31,20 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <time.h>
 #include "nk/log.h"
 #include "nk/random.h"
 
 #include "state.h"
 #include "ifchange.h"
 #include "arp.h"
+#include "timer.h"
 #include "options.h"
 #include "ndhc.h"
 #include "sys.h"
 #include "netlink.h"
-#include "coroutine.h"
+#include "leasefile.h"
+#include "retrans.h"
 
 #define SEL_SUCCESS 0
 #define SEL_FAIL -1
@@ -63,17 +66,163 @@
 #define IFUP_NEWLEASE 1
 #define IFUP_FAIL -1
 
-static int delay_timeout(struct client_state_t cs[static 1], size_t numpackets)
+// Send a DHCP request along with the gateway check when the link comes up.
+static bool fast_revalidate;
+void set_fast_revalidate(bool v) { fast_revalidate = v; }
+
+#define OFFER_MAX 4       // DHCPOFFERs remembered per transaction
+
+struct dhcp_offer {
+    uint32_t yiaddr, serverAddr, srcAddr;
+    uint32_t lease;       // Offered lease time in seconds, or 0 if unknown.
+    long long latency;    // ms between our DHCPDISCOVER and the offer.
+    long long ts;         // When the offer arrived.
+};
+
+// Offers received for the current xid that have not yet been requested.
+// When a request fails, the client falls back to the best remaining one
+// instead of starting a new discovery.
+struct offer_table {
+    struct dhcp_offer offer[OFFER_MAX];
+    size_t count;
+    long long discover_ts; // When the last DHCPDISCOVER was sent.
+};
+static struct offer_table offer_tables[NDHC_MAX_IFACES];
+
+static void offer_clear(struct client_state_t cs[static 1])
 {
-    int to = 64;
-    char tot[] = { 4, 8, 16, 32, 64 };
-    if (numpackets < sizeof tot)
-        to = tot[numpackets];
-    // Distribution is a bit biased but it doesn't really matter.
-    return to * 1000 + (int)(nk_random_u32(&cs->rnd_state) % 1000);
+    offer_tables[cs->client_idx].count = 0;
 }
 
-static void reinit_shared_deconfig(struct client_state_t cs[static 1])
+#define BLACKLIST_MAX 4        // Declined addresses remembered per interface
+#define BLACKLIST_TIME 120000  // ms that offers of a declined address are
+                               // ignored
+
+// Addresses that we recently declined because another host was using them.
+// Servers often offer the same address again right after a DHCPDECLINE, so
+// offers of these are ignored until the entry expires.
+struct addr_blacklist {
+    uint32_t addr[BLACKLIST_MAX];
+    long long expire_ts[BLACKLIST_MAX]; // 0 if the slot is unused.
+};
+static struct addr_blacklist blacklists[NDHC_MAX_IFACES];
+
+static void blacklist_add(struct client_state_t cs[static 1], uint32_t addr,
+                          long long nowts)
+{
+    struct addr_blacklist *bl = &blacklists[cs->client_idx];
+    size_t slot = 0;
+    for (size_t i = 0; i < BLACKLIST_MAX; ++i) {
+        if (bl->addr[i] == addr) {
+            slot = i;
+            break;
+        }
+        // Otherwise replace the entry that expires first.
+        if (bl->expire_ts[i] < bl->expire_ts[slot])
+            slot = i;
+    }
+    bl->addr[slot] = addr;
+    bl->expire_ts[slot] = nowts + BLACKLIST_TIME;
+}
+
+static bool blacklist_has(struct client_state_t cs[static 1], uint32_t addr,
+                          long long nowts)
+{
+    struct addr_blacklist *bl = &blacklists[cs->client_idx];
+    for (size_t i = 0; i < BLACKLIST_MAX; ++i) {
+        if (bl->addr[i] == addr && bl->expire_ts[i] > nowts)
+            return true;
+    }
+    return false;
+}
+
+// An earlier offer is preferred unless a later one carries a lease that is
+// at least twice as long.
+static bool offer_better(const struct dhcp_offer a[static 1],
+                         const struct dhcp_offer b[static 1])
+{
+    if (a->lease / 2 >= b->lease && a->lease > b->lease)
+        return true;
+    if (b->lease / 2 >= a->lease && b->lease > a->lease)
+        return false;
+    return a->latency < b->latency;
+}
+
+static void offer_add(struct client_state_t cs[static 1],
+                      const struct dhcp_offer o[static 1])
+{
+    struct offer_table *ot = &offer_tables[cs->client_idx];
+    for (size_t i = 0; i < ot->count; ++i) {
+        // A retransmitted offer keeps its original latency.
+        if (ot->offer[i].yiaddr == o->yiaddr &&
+            ot->offer[i].serverAddr == o->serverAddr)
+            return;
+    }
+    if (ot->count < OFFER_MAX) {
+        ot->offer[ot->count++] = *o;
+        return;
+    }
+    size_t worst = 0;
+    for (size_t i = 1; i < ot->count; ++i) {
+        if (offer_better(&ot->offer[worst], &ot->offer[i]))
+            worst = i;
+    }
+    if (offer_better(o, &ot->offer[worst]))
+        ot->offer[worst] = *o;
+}
+
+// Returns true if there are offers left that we have not yet requested.
+static bool offer_available(struct client_state_t cs[static 1],
+                            long long nowts)
+{
+    struct offer_table *ot = &offer_tables[cs->client_idx];
+    // Redundant servers may have offered an address that was since declined,
+    // and offers made before the last DHCPDISCOVER belong to an older
+    // transaction.
+    for (size_t i = 0; i < ot->count;) {
+        if (blacklist_has(cs, ot->offer[i].yiaddr, nowts) ||
+            ot->offer[i].ts < ot->discover_ts)
+            ot->offer[i] = ot->offer[--ot->count];
+        else
+            ++i;
+    }
+    return ot->count > 0;
+}
+
+// Removes the best remaining offer from the table and makes it the one
+// that we request.  Returns false if there are no offers left.
+static bool offer_take(struct client_state_t cs[static 1], long long nowts)
+{
+    struct offer_table *ot = &offer_tables[cs->client_idx];
+    if (!offer_available(cs, nowts))
+        return false;
+    size_t best = 0;
+    for (size_t i = 1; i < ot->count; ++i) {
+        if (offer_better(&ot->offer[i], &ot->offer[best]))
+            best = i;
+    }
+    struct dhcp_offer o = ot->offer[best];
+    ot->offer[best] = ot->offer[--ot->count];
+
+    char clibuf[INET_ADDRSTRLEN];
+    char svrbuf[INET_ADDRSTRLEN];
+    cs->clientAddr = o.yiaddr;
+    cs->serverAddr = o.serverAddr;
+    cs->srcAddr = o.srcAddr;
+    timer_set(cs, TMR_DHCP, nowts);
+    cs->num_dhcp_requests = 0;
+    inet_ntop(AF_INET, &(struct in_addr){.s_addr=cs->clientAddr},
+              clibuf, sizeof clibuf);
+    inet_ntop(AF_INET, &(struct in_addr){.s_addr=cs->serverAddr},
+              svrbuf, sizeof svrbuf);
+    log_line("%s: Selected IP offer: %s from server %s (%lld ms, %u s lease).",
+             client_config->interface, clibuf, svrbuf, o.latency, o.lease);
+    return true;
+}
+
+// Forgets the lease that we held or were asking for.  The offers of the
+// current transaction are kept, so that the next one can be requested.
+static void reinit_lease_state(struct client_state_t cs[static 1])
 {
     cs->clientAddr = 0;
     cs->num_dhcp_requests = 0;
@@ -84,16 +233,51 @@ static void reinit_shared_deconfig(struct client_state_t cs[static 1])
     cs->sent_first_announce = false;
     cs->sent_second_announce = false;
     cs->init_fingerprint_inprogress = false;
+    cs->revalidating = false;
     memset(&cs->routerArp, 0, sizeof cs->routerArp);
     memset(&cs->serverArp, 0, sizeof cs->serverArp);
     arp_reset_state(cs);
+    close_dhcp_xmit(cs);
+}
+
+static void reinit_shared_deconfig(struct client_state_t cs[static 1])
+{
+    offer_clear(cs);
+    reinit_lease_state(cs);
 }
 
 static void reinit_selecting(struct client_state_t cs[static 1], int timeout)
 {
     reinit_shared_deconfig(cs);
-    cs->dhcp_wake_ts = curms() + timeout;
+    timer_set(cs, TMR_DHCP, curms() + timeout);
+    start_dhcp_listen(cs);
+}
+
+// Called when ifch could not apply the lease to the interface.  Whatever
+// part of it was applied is removed, and a new lease is searched for after
+// a delay, so that a bind that keeps failing does not spin.
+void reinit_failed_bind(struct client_state_t cs[static 1])
+{
+    log_line("%s: Searching for a new lease...", client_config->interface);
+    if (ifchange_deconfig(cs) < 0)
+        log_warning("%s: Failed to reset the IP configuration.",
+                    client_config->interface);
+    reinit_selecting(cs, 3000);
+    cs->dhcp_state = DS_INIT;
+}
+
+// Falls back to the next offer of the current transaction after the one we
+// requested was rejected or found to be in use.  Returns false if there are
+// no offers left and a new discovery is needed.
+static bool reinit_next_offer(struct client_state_t cs[static 1],
+                              long long nowts)
+{
+    if (!offer_available(cs, nowts))
+        return false;
+    reinit_lease_state(cs);
+    offer_take(cs, nowts);
     start_dhcp_listen(cs);
+    return true;
 }
 
 // Triggered after a DHCP lease request packet has been sent and no reply has
@@ -103,20 +287,162 @@ static void reinit_selecting(struct client_state_t cs[static 1], int timeout)
 static int requesting_timeout(struct client_state_t cs[static 1],
                                long long nowts)
 {
-    if (cs->num_dhcp_requests >= 5) {
+    unsigned int retries = retrans_retries(RT_REQUESTING);
+    if (retries && cs->num_dhcp_requests >= retries) {
         reinit_selecting(cs, 0);
         return REQ_TIMEOUT;
     }
     if (send_selecting(cs) < 0) {
         log_warning("%s: Failed to send a selecting request packet.",
-                    client_config.interface);
+                    client_config->interface);
+        return REQ_FAIL;
+    }
+    timer_set(cs, TMR_DHCP, nowts + retrans_delay(cs, RT_REQUESTING,
+                                                  cs->num_dhcp_requests));
+    cs->num_dhcp_requests++;
+    return REQ_SUCCESS;
+}
+
+// Triggered after an INIT-REBOOT request has been sent and no reply has been
+// received within the response wait time.  The server may be gone or may not
+// know about our lease, so do not wait long before starting a discovery.
+static int rebooting_timeout(struct client_state_t cs[static 1],
+                             long long nowts)
+{
+    if (cs->num_dhcp_requests >= 2) {
+        log_line("%s: No reply to our request for the previous lease.  Searching for a new lease...",
+                 client_config->interface);
+        reinit_selecting(cs, 0);
+        return REQ_TIMEOUT;
+    }
+    if (send_init_reboot(cs) < 0) {
+        log_warning("%s: Failed to send an init-reboot request packet.",
+                    client_config->interface);
         return REQ_FAIL;
     }
-    cs->dhcp_wake_ts = nowts + delay_timeout(cs, cs->num_dhcp_requests);
+    timer_set(cs, TMR_DHCP, nowts + retrans_delay(cs, RT_REQUESTING,
+                                                  cs->num_dhcp_requests));
     cs->num_dhcp_requests++;
     return REQ_SUCCESS;
 }
 
+static void make_lease_record(struct client_state_t cs[static 1],
+                              struct lease_record lr[static 1])
+{
+    *lr = (struct lease_record){
+        .yiaddr = cs->clientAddr,
+        .server = cs->serverAddr,
+        .srcaddr = cs->srcAddr,
+        .router = cs->routerAddr,
+        .start = (long long)time(NULL) - (curms() - cs->leaseStartTime) / 1000,
+        .lease = cs->lease,
+        .t1 = (uint32_t)cs->renewTime,
+        .t2 = (uint32_t)cs->rebindTime,
+    };
+    memcpy(lr->router_mac, cs->routerArp, sizeof lr->router_mac);
+    memcpy(lr->server_mac, cs->serverArp, sizeof lr->server_mac);
+}
+
+// Records the bound lease so that it can be requested again after restart,
+// or when we come back to this network.
+void save_lease_record(struct client_state_t cs[static 1])
+{
+    struct lease_record lr;
+    make_lease_record(cs, &lr);
+    write_lease_record(&lr);
+}
+
+// Finds the unexpired leases of the networks other than the one we are
+// bound on, so that the gateway check can look for them as well.
+static size_t known_networks(struct client_state_t cs[static 1],
+                             struct lease_record known[static LEASE_CACHE_MAX])
+{
+    struct lease_record cur, all[LEASE_CACHE_MAX];
+    make_lease_record(cs, &cur);
+    size_t count = read_lease_records(all);
+    size_t n = 0;
+    long long now = (long long)time(NULL);
+    for (size_t i = 0; i < count; ++i) {
+        if (lease_record_live(&all[i], now) &&
+            !lease_record_same_network(&all[i], &cur))
+            known[n++] = all[i];
+    }
+    return n;
+}
+
+// Makes the lease the one that we ask for with an INIT-REBOOT request, if
+// it has not yet expired.
+static bool use_lease_record(struct client_state_t cs[static 1],
+                             const struct lease_record lr[static 1])
+{
+    long long now = (long long)time(NULL);
+    if (!lease_record_live(lr, now))
+        return false;
+    cs->clientAddr = lr->yiaddr;
+    cs->serverAddr = lr->server;
+    cs->srcAddr = lr->srcaddr;
+    cs->routerAddr = lr->router;
+    cs->lease = lr->lease;
+    cs->renewTime = lr->t1;
+    cs->rebindTime = lr->t2;
+    cs->leaseStartTime = curms() - (now - lr->start) * 1000;
+    memcpy(cs->routerArp, lr->router_mac, sizeof cs->routerArp);
+    memcpy(cs->serverArp, lr->server_mac, sizeof cs->serverArp);
+    cs->xid = nk_random_u32(&cs->rnd_state);
+    cs->num_dhcp_requests = 0;
+    cs->acquire_ts = curms();
+    // Offers from before this request are for another transaction, and
+    // perhaps another network.
+    offer_clear(cs);
+    offer_tables[cs->client_idx].discover_ts = cs->acquire_ts;
+    cs->dhcp_state = DS_REBOOTING;
+    return true;
+}
+
+// Called at startup.  If the lease from the previous run has not yet
+// expired, the client begins in INIT-REBOOT and asks for it again instead of
+// starting with a discovery.
+bool restore_lease_record(struct client_state_t cs[static 1])
+{
+    struct lease_record lr;
+    if (!read_lease_record(&lr))
+        return false;
+    return use_lease_record(cs, &lr);
+}
+
+static bool mac_is_set(const uint8_t mac[static 6])
+{
+    static const uint8_t zero[6];
+    return memcmp(mac, zero, sizeof zero) != 0;
+}
+
+// Called at startup after restore_lease_record().  If the kernel still
+// has the configuration of the lease, it is kept as it is and the client
+// resumes in BOUND, renewing only when the lease says to.  Restarting
+// then neither drops traffic nor rewrites the interface.  The lease must
+// carry the network fingerprint so that the network can be checked.
+bool adopt_lease_record(struct client_state_t cs[static 1])
+{
+    if (cs->dhcp_state != DS_REBOOTING || client_config->quit_after_lease)
+        return false;
+    if (!mac_is_set(cs->serverArp) ||
+        (cs->routerAddr && !mac_is_set(cs->routerArp)))
+        return false;
+    if (!ifchange_adopt(cs))
+        return false;
+    cs->dhcp_state = DS_BOUND;
+    cs->program_init = false;
+    cs->acquire_ts = -1;
+    cs->got_router_arp = true;
+    cs->got_server_arp = true;
+    cs->sent_gw_query = true;
+    cs->sent_first_announce = true;
+    cs->sent_second_announce = true;
+    timer_set(cs, TMR_DHCP, cs->leaseStartTime + cs->renewTime * 1000);
+    write_leasefile((struct in_addr){.s_addr = cs->clientAddr});
+    return true;
+}
+
 static bool is_renewing(struct client_state_t cs[static 1], long long nowts)
 {
     long long rnt = cs->leaseStartTime + cs->renewTime * 1000;
@@ -139,18 +465,24 @@ static int rebinding_timeout(struct client_state_t cs[static 1],
     long long elt = cs->leaseStartTime + cs->lease * 1000;
     if (nowts >= elt) {
         log_line("%s: Lease expired.  Searching for a new lease...",
-                 client_config.interface);
+                 client_config->interface);
         reinit_selecting(cs, 0);
         return BTO_EXPIRED;
     }
+    unsigned int retries = retrans_retries(RT_REBINDING);
+    if (retries && cs->num_dhcp_requests >= retries) {
+        timer_set(cs, TMR_DHCP, elt);
+        return BTO_WAIT;
+    }
     start_dhcp_listen(cs);
     if (send_rebind(cs) < 0) {
         log_warning("%s: Failed to send a rebind request packet.",
-                    client_config.interface);
+                    client_config->interface);
         return BTO_HARDFAIL;
     }
-    long long ts0 = nowts + (50 + nk_random_u32(&cs->rnd_state) % 20) * 1000;
-    cs->dhcp_wake_ts = ts0 < elt ? ts0 : elt;
+    long long ts0 = nowts + retrans_delay(cs, RT_REBINDING,
+                                          cs->num_dhcp_requests++);
+    timer_set(cs, TMR_DHCP, ts0 < elt ? ts0 : elt);
     return BTO_WAIT;
 }
 
@@ -166,14 +498,24 @@ static int renewing_timeout(struct client_state_t cs[static 1],
     long long rbt = cs->leaseStartTime + cs->rebindTime * 1000;
     if (nowts >= rbt)
         return rebinding_timeout(cs, nowts);
-    start_dhcp_listen(cs);
+    unsigned int retries = retrans_retries(RT_RENEWING);
+    if (retries && cs->num_dhcp_requests >= retries) {
+        timer_set(cs, TMR_DHCP, rbt);
+        return BTO_WAIT;
+    }
+    // The reply to a unicast renewal arrives on the unicast socket, so
+    // the raw listener is only needed again once we are rebinding, or
+    // while a revalidation request is outstanding.
+    if (!cs->revalidating)
+        stop_dhcp_listen(cs);
     if (send_renew(cs) < 0) {
         log_warning("%s: Failed to send a renew request packet.",
-                    client_config.interface);
+                    client_config->interface);
         return BTO_HARDFAIL;
     }
-    long long ts0 = nowts + (50 + nk_random_u32(&cs->rnd_state) % 20) * 1000;
-    cs->dhcp_wake_ts = ts0 < rbt ? ts0 : rbt;
+    long long ts0 = nowts + retrans_delay(cs, RT_RENEWING,
+                                          cs->num_dhcp_requests++);
+    timer_set(cs, TMR_DHCP, ts0 < rbt ? ts0 : rbt);
     return BTO_WAIT;
 }
 
@@ -183,21 +525,21 @@ static int bound_timeout(struct client_state_t cs[static 1], long long nowts)
 {
     long long rnt = cs->leaseStartTime + cs->renewTime * 1000;
     if (nowts < rnt) {
-        cs->dhcp_wake_ts = rnt;
+        timer_set(cs, TMR_DHCP, rnt);
         return BTO_WAIT;
     }
     return renewing_timeout(cs, nowts);
 }
 
 static int validate_serverid(struct client_state_t cs[static 1],
-                             struct dhcpmsg packet[static 1],
+                             struct dhcp_rx packet[static 1],
                              const char typemsg[static 1])
 {
     int found;
-    uint32_t sid = get_option_serverid(packet, &found);
+    uint32_t sid = get_option_serverid(&packet->opts, &found);
     if (!found) {
         log_line("%s: Received %s with no server id.  Ignoring it.",
-                 client_config.interface, typemsg);
+                 client_config->interface, typemsg);
         return 0;
     }
     if (cs->serverAddr != sid) {
@@ -205,25 +547,27 @@ static int validate_serverid(struct client_state_t cs[static 1],
         inet_ntop(AF_INET, &(struct in_addr){.s_addr=sid},
                   svrbuf, sizeof svrbuf);
         log_line("%s: Received %s with an unexpected server id: %s.  Ignoring it.",
-                 client_config.interface, typemsg, svrbuf);
+                 client_config->interface, typemsg, svrbuf);
         return 0;
     }
     return 1;
 }
 
 static void get_leasetime(struct client_state_t cs[static 1],
-                          struct dhcpmsg packet[static 1])
+                          struct dhcp_rx packet[static 1])
 {
-    cs->lease = get_option_leasetime(packet);
+    cs->lease = get_option_leasetime(&packet->opts);
     cs->leaseStartTime = curms();
+    // Renew and rebind retransmissions count from the new lease.
+    cs->num_dhcp_requests = 0;
     if (!cs->lease) {
         log_line("%s: No lease time received; assuming 1h.",
-                 client_config.interface);
+                 client_config->interface);
         cs->lease = 60 * 60;
     } else {
         if (cs->lease < 60) {
             log_warning("Server sent lease of <1m.  Forcing lease to 1m.",
-                        client_config.interface);
+                        client_config->interface);
             cs->lease = 60;
         }
     }
@@ -231,11 +575,11 @@ static void get_leasetime(struct client_state_t cs[static 1],
     // the remote server values, if they even exist, for sanity.
     cs->renewTime = cs->lease >> 1;
     cs->rebindTime = (cs->lease >> 3) * 0x7; // * 0.875
-    cs->dhcp_wake_ts = cs->leaseStartTime + cs->renewTime * 1000;
+    timer_set(cs, TMR_DHCP, cs->leaseStartTime + cs->renewTime * 1000);
 }
 
 static int extend_packet(struct client_state_t cs[static 1],
-                         struct dhcpmsg packet[static 1], uint8_t msgtype,
+                         struct dhcp_rx packet[static 1], uint8_t msgtype,
                          uint32_t srcaddr)
 {
     (void)srcaddr;
@@ -245,19 +589,20 @@ static int extend_packet(struct client_state_t cs[static 1],
         get_leasetime(cs, packet);
 
         // Did we receive a lease with a different IP than we had before?
-        if (memcmp(&packet->yiaddr, &cs->clientAddr, 4)) {
+        if (memcmp(&packet->msg.yiaddr, &cs->clientAddr, 4)) {
             char clibuf[INET_ADDRSTRLEN];
             inet_ntop(AF_INET, &(struct in_addr){.s_addr=cs->clientAddr},
                       clibuf, sizeof clibuf);
             log_line("%s: Server is now offering IP %s.  Validating...",
-                     client_config.interface, clibuf);
+                     client_config->interface, clibuf);
             return ANP_CHECK_IP;
         } else {
             log_line("%s: Lease refreshed to %u seconds.",
-                     client_config.interface, cs->lease);
+                     client_config->interface, cs->lease);
+            save_lease_record(cs);
             if (arp_set_defense_mode(cs) < 0)
                 log_warning("%s: Failed to create ARP defense socket.",
-                            client_config.interface);
+                            client_config->interface);
             stop_dhcp_listen(cs);
             return ANP_SUCCESS;
         }
@@ -265,7 +610,7 @@ static int extend_packet(struct client_state_t cs[static 1],
         if (!validate_serverid(cs, packet, "a DHCP NAK"))
             return ANP_IGNORE;
         log_line("%s: Our request was rejected.  Searching for a new lease...",
-                 client_config.interface);
+                 client_config->interface);
         reinit_selecting(cs, 3000);
         return ANP_REJECTED;
     }
@@ -273,48 +618,70 @@ static int extend_packet(struct client_state_t cs[static 1],
 }
 
 static int selecting_packet(struct client_state_t cs[static 1],
-                            struct dhcpmsg packet[static 1], uint8_t msgtype,
+                            struct dhcp_rx packet[static 1], uint8_t msgtype,
                             uint32_t srcaddr, bool is_requesting)
 {
-    if (!is_requesting && msgtype == DHCPOFFER) {
+    if (msgtype == DHCPOFFER) {
+        // Offers that arrive after we have chosen one are still kept as
+        // fallbacks for the case where the chosen one fails.
         int found;
-        uint32_t sid = get_option_serverid(packet, &found);
+        uint32_t sid = get_option_serverid(&packet->opts, &found);
         if (!found) {
             log_line("%s: Invalid offer received: it didn't have a server id.",
-                     client_config.interface);
+                     client_config->interface);
+            return ANP_IGNORE;
+        }
+        if (!packet->msg.yiaddr) {
+            log_line("%s: Invalid offer received: it didn't have an address.",
+                     client_config->interface);
             return ANP_IGNORE;
         }
         char clibuf[INET_ADDRSTRLEN];
         char svrbuf[INET_ADDRSTRLEN];
         char srcbuf[INET_ADDRSTRLEN];
-        cs->clientAddr = packet->yiaddr;
-        cs->serverAddr = sid;
-        cs->srcAddr = srcaddr;
-        cs->dhcp_wake_ts = curms();
-        cs->num_dhcp_requests = 0;
-        inet_ntop(AF_INET, &(struct in_addr){.s_addr=cs->clientAddr},
+        long long nowts = curms();
+        inet_ntop(AF_INET, &(struct in_addr){.s_addr=packet->msg.yiaddr},
                   clibuf, sizeof clibuf);
-        inet_ntop(AF_INET, &(struct in_addr){.s_addr=cs->serverAddr},
+        if (blacklist_has(cs, packet->msg.yiaddr, nowts)) {
+            log_line("%s: Ignoring offer of %s, which we recently declined.",
+                     client_config->interface, clibuf);
+            return ANP_IGNORE;
+        }
+        struct dhcp_offer o = {
+            .yiaddr = packet->msg.yiaddr,
+            .serverAddr = sid,
+            .srcAddr = srcaddr,
+            .lease = get_option_leasetime(&packet->opts),
+            .latency = nowts - offer_tables[cs->client_idx].discover_ts,
+            .ts = nowts,
+        };
+        offer_add(cs, &o);
+        inet_ntop(AF_INET, &(struct in_addr){.s_addr=o.serverAddr},
                   svrbuf, sizeof svrbuf);
-        inet_ntop(AF_INET, &(struct in_addr){.s_addr=cs->srcAddr},
+        inet_ntop(AF_INET, &(struct in_addr){.s_addr=o.srcAddr},
                   srcbuf, sizeof srcbuf);
         log_line("%s: Received IP offer: %s from server %s via %s.",
-                 client_config.interface, clibuf, svrbuf, srcbuf);
-        return ANP_SUCCESS;
+                 client_config->interface, clibuf, svrbuf, srcbuf);
+        return is_requesting ? ANP_IGNORE : ANP_SUCCESS;
+    } else if (is_requesting && msgtype == DHCPNAK) {
+        if (!validate_serverid(cs, packet, "a DHCP NAK"))
+            return ANP_IGNORE;
+        log_line("%s: Our request was rejected.", client_config->interface);
+        return ANP_REJECTED;
     } else if (is_requesting && msgtype == DHCPACK) {
         // Don't validate the server id.  Instead validate that the
         // yiaddr matches.  Some networks have multiple servers
         // that don't respect the serverid that was specified in
         // our DHCPREQUEST.
-        if (!memcmp(&packet->yiaddr, &cs->clientAddr, 4)) {
+        if (!memcmp(&packet->msg.yiaddr, &cs->clientAddr, 4)) {
             char clibuf[INET_ADDRSTRLEN];
             char svrbuf[INET_ADDRSTRLEN];
             char srcbuf[INET_ADDRSTRLEN];
             int found;
-            uint32_t sid = get_option_serverid(packet, &found);
+            uint32_t sid = get_option_serverid(&packet->opts, &found);
             if (!found) {
                 log_line("%s: Invalid offer received: it didn't have a server id.",
-                         client_config.interface);
+                         client_config->interface);
                 return ANP_IGNORE;
             }
             if (cs->serverAddr != sid) {
@@ -330,7 +697,7 @@ static int selecting_packet(struct client_state_t cs[static 1],
             inet_ntop(AF_INET, &(struct in_addr){.s_addr=cs->srcAddr},
                       srcbuf, sizeof srcbuf);
             log_line("%s: Received ACK: %s from server %s via %s.  Validating...",
-                     client_config.interface, clibuf, svrbuf, srcbuf);
+                     client_config->interface, clibuf, svrbuf, srcbuf);
             return ANP_CHECK_IP;
         }
     }
@@ -345,22 +712,28 @@ static int selecting_timeout(struct client_state_t cs[static 1],
                               long long nowts)
 {
     if (cs->program_init && cs->num_dhcp_requests >= 2) {
-        if (client_config.background_if_no_lease) {
+        if (client_config->background_if_no_lease) {
             log_line("%s: No lease; going to background.",
-                     client_config.interface);
+                     client_config->interface);
             cs->program_init = false;
             background();
-        } else if (client_config.abort_if_no_lease)
-            suicide("%s: No lease; failing.", client_config.interface);
+        } else if (client_config->abort_if_no_lease)
+            suicide("%s: No lease; failing.", client_config->interface);
     }
+    // Start over with a new transaction once the retry limit is reached.
+    unsigned int retries = retrans_retries(RT_SELECTING);
+    if (retries && cs->num_dhcp_requests >= retries)
+        cs->num_dhcp_requests = 0;
     if (cs->num_dhcp_requests == 0)
         cs->xid = nk_random_u32(&cs->rnd_state);
     if (send_discover(cs) < 0) {
         log_warning("%s: Failed to send a discover request packet.",
-                    client_config.interface);
+                    client_config->interface);
         return SEL_FAIL;
     }
-    cs->dhcp_wake_ts = nowts + delay_timeout(cs, cs->num_dhcp_requests);
+    offer_tables[cs->client_idx].discover_ts = nowts;
+    timer_set(cs, TMR_DHCP, nowts + retrans_delay(cs, RT_SELECTING,
+                                                  cs->num_dhcp_requests));
     cs->num_dhcp_requests++;
     return SEL_SUCCESS;
 }
@@ -369,9 +742,9 @@ static int selecting_timeout(struct client_state_t cs[static 1],
 static void print_release(struct client_state_t cs[static 1])
 {
     log_line("%s: ndhc going to sleep.  Wake it by sending a SIGUSR1.",
-             client_config.interface);
+             client_config->interface);
     reinit_shared_deconfig(cs);
-    cs->dhcp_wake_ts = -1;
+    timer_set(cs, TMR_DHCP, -1);
     stop_dhcp_listen(cs);
 }
 
@@ -384,11 +757,11 @@ static int xmit_release(struct client_state_t cs[static 1])
               clibuf, sizeof clibuf);
     inet_ntop(AF_INET, &(struct in_addr){.s_addr=cs->serverAddr},
               svrbuf, sizeof svrbuf);
-    log_line("%s: Unicasting a release of %s to %s.", client_config.interface,
+    log_line("%s: Unicasting a release of %s to %s.", client_config->interface,
              clibuf, svrbuf);
     if (send_release(cs) < 0) {
         log_warning("%s: Failed to send a release request packet.",
-                    client_config.interface);
+                    client_config->interface);
         return -1;
     }
     print_release(cs);
@@ -399,11 +772,10 @@ static int xmit_release(struct client_state_t cs[static 1])
 static int frenew(struct client_state_t cs[static 1], bool is_bound)
 {
     if (is_bound) {
-        log_line("%s: Forcing a DHCP renew...", client_config.interface);
-        start_dhcp_listen(cs);
+        log_line("%s: Forcing a DHCP renew...", client_config->interface);
         if (send_renew(cs) < 0) {
             log_warning("%s: Failed to send a renew request packet.",
-                        client_config.interface);
+                        client_config->interface);
             return -1;
         }
     } else { // RELEASED
@@ -412,6 +784,32 @@ static int frenew(struct client_state_t cs[static 1], bool is_bound)
     return 0;
 }
 
+// Asks for our lease with an INIT-REBOOT request while the gateway check
+// runs.  Whichever of them is answered first ends the revalidation.
+static void revalidate_request(struct client_state_t cs[static 1])
+{
+    cs->xid = nk_random_u32(&cs->rnd_state);
+    start_dhcp_listen(cs);
+    if (send_init_reboot(cs) < 0) {
+        log_warning("%s: Failed to send an init-reboot request packet.",
+                    client_config->interface);
+        return;
+    }
+    cs->revalidating = true;
+}
+
+// Stops waiting for an answer to the revalidation request.
+static void revalidate_done(struct client_state_t cs[static 1],
+                            long long nowts)
+{
+    if (!cs->revalidating)
+        return;
+    cs->revalidating = false;
+    // Only rebinding still needs the broadcast listener.
+    if (!is_rebinding(cs, nowts))
+        stop_dhcp_listen(cs);
+}
+
 // If we have a lease, check to see if our gateway is still valid via ARP.
 // If it fails, state -> SELECTING.
 static int ifup_action(struct client_state_t cs[static 1])
@@ -419,326 +817,478 @@ static int ifup_action(struct client_state_t cs[static 1])
     if (cs->routerAddr && cs->serverAddr) {
         if (cs->init_fingerprint_inprogress) {
             suicide("%s: Carrier lost during initial fingerprint.  Forcing restart.",
-                    client_config.interface);
+                    client_config->interface);
         }
-        if (arp_gw_check(cs) >= 0) {
+        struct lease_record known[LEASE_CACHE_MAX];
+        size_t known_count = known_networks(cs, known);
+        if (arp_gw_check(cs, known, known_count, fast_revalidate) >= 0) {
             log_line("%s: Interface is back.  Revalidating lease...",
-                     client_config.interface);
+                     client_config->interface);
+            if (fast_revalidate)
+                revalidate_request(cs);
             return IFUP_REVALIDATE;
         } else {
             log_warning("%s: arp_gw_check could not make arp socket.",
-                        client_config.interface);
+                        client_config->interface);
             return IFUP_FAIL;
         }
     }
     log_line("%s: Interface is back.  Searching for new lease...",
-             client_config.interface);
+             client_config->interface);
     return IFUP_NEWLEASE;
 }
 
 #define BAD_STATE() suicide("%s(%d): bad state", __func__, __LINE__)
 
-// XXX: Should be re-entrant so as to handle multiple servers.
-int dhcp_handle(struct client_state_t cs[static 1], long long nowts,
-                bool sev_dhcp, struct dhcpmsg dhcp_packet[static 1],
-                uint8_t dhcp_msgtype, uint32_t dhcp_srcaddr, bool sev_arp,
-                bool force_fingerprint, bool dhcp_timeout, bool arp_timeout,
-                int sev_signal)
+// Results of the per-state handlers of dhcp_handle().
+#define DHR_SUCCESS 0 // Wait for the next event.
+#define DHR_ERROR -1  // Wait for the next event after a delay.
+#define DHR_AGAIN 1   // State changed; handle the same events in the new state.
+
+// The events that dhcp_handle() was invoked to process.
+struct client_events {
+    struct dhcp_rx *dhcp_packet;
+    long long nowts;
+    uint32_t dhcp_srcaddr;
+    uint8_t dhcp_msgtype;
+    int sev_signal;
+    unsigned int expired; // TMRF_* mask of the timers that are due.
+    bool sev_dhcp, sev_arp, force_fingerprint;
+};
+
+static int goto_state(struct client_state_t cs[static 1], dhcp_state_t state)
+{
+    // Only a collision check that passed keeps an optimistic address.
+    if (cs->dhcp_state == DS_COLLISION_CHECK && state != DS_BOUND)
+        arp_drop_optimistic(cs);
+    cs->dhcp_state = state;
+    return DHR_AGAIN;
+}
+
+// Start over with a new transaction.
+static int goto_init(struct client_state_t cs[static 1],
+                     struct client_events ev[static 1])
+{
+    ev->sev_dhcp = false;
+    return goto_state(cs, DS_INIT);
+}
+
+// The gateway of another network that we still hold a lease on answered
+// the gateway check, so ask for that lease again with an INIT-REBOOT
+// request right away.
+static int goto_known_network(struct client_state_t cs[static 1],
+                              struct client_events ev[static 1])
+{
+    struct lease_record lr = *arp_gw_known(cs);
+    // Likely only to fail because of rfkill.
+    bool deconfig_failed = ifchange_deconfig(cs) < 0;
+    reinit_shared_deconfig(cs);
+    if (!use_lease_record(cs, &lr)) {
+        reinit_selecting(cs, 0);
+        goto_init(cs, ev);
+        return deconfig_failed ? DHR_ERROR : DHR_AGAIN;
+    }
+    log_line("%s: Returned to a known network.  Requesting its lease...",
+             client_config->interface);
+    timer_set(cs, TMR_DHCP, ev->nowts);
+    start_dhcp_listen(cs);
+    ev->sev_dhcp = false;
+    ev->sev_arp = false;
+    ev->expired |= TMRF_DHCP;
+    return deconfig_failed ? DHR_ERROR : DHR_AGAIN;
+}
+
+static int init_state(struct client_state_t cs[static 1])
 {
-    scrBegin;
-reinit:
     cs->xid = nk_random_u32(&cs->rnd_state);
-    // We're in the SELECTING state here.
-    for (;;) {
-        int ret = COR_SUCCESS;
-        if (sev_signal == SIGNAL_RELEASE) {
-            print_release(cs);
-            goto skip_to_released;
-        }
-        if (sev_dhcp) {
-            int r = selecting_packet(cs, dhcp_packet, dhcp_msgtype,
-                                     dhcp_srcaddr, false);
-            if (r == ANP_SUCCESS) {
-                // Send a request packet to the answering DHCP server.
-                sev_dhcp = false;
-                goto skip_to_requesting;
-            }
+    offer_clear(cs);
+    cs->acquire_ts = curms();
+    return goto_state(cs, DS_SELECTING);
+}
+
+static int selecting_state(struct client_state_t cs[static 1],
+                           struct client_events ev[static 1])
+{
+    int ret = DHR_SUCCESS;
+    if (ev->sev_signal == SIGNAL_RELEASE) {
+        print_release(cs);
+        return goto_state(cs, DS_RELEASED);
+    }
+    if (ev->sev_dhcp) {
+        int r = selecting_packet(cs, ev->dhcp_packet, ev->dhcp_msgtype,
+                                 ev->dhcp_srcaddr, false);
+        if (r == ANP_SUCCESS) {
+            // Give other servers a short window to make their offers.
+            long long wts = ev->nowts + retrans_window(RT_SELECTING);
+            long long dts = timer_get(cs, TMR_DHCP);
+            if (dts < 0 || dts > wts)
+                timer_set(cs, TMR_DHCP, wts);
         }
-        if (dhcp_timeout) {
-            int r = selecting_timeout(cs, nowts);
-            if (r == SEL_SUCCESS) {
-            } else if (r == SEL_FAIL) {
-                ret = COR_ERROR;
-            } else BAD_STATE();
+    }
+    if (ev->expired & TMRF_DHCP) {
+        if (offer_take(cs, ev->nowts)) {
+            // Send a request packet to the best answering DHCP server.
+            ev->sev_dhcp = false;
+            return goto_state(cs, DS_REQUESTING);
         }
-        scrReturn(ret);
+        int r = selecting_timeout(cs, ev->nowts);
+        if (r == SEL_SUCCESS) {
+        } else if (r == SEL_FAIL) {
+            ret = DHR_ERROR;
+        } else BAD_STATE();
     }
-    scrReturn(COR_SUCCESS);
-    // We're in the REQUESTING state here.
-    for (;;) {
-        int ret;
-skip_to_requesting:
-        ret = COR_SUCCESS;
-        if (sev_signal == SIGNAL_RELEASE) {
-            print_release(cs);
-            goto skip_to_released;
+    return ret;
+}
+
+static int rebooting_state(struct client_state_t cs[static 1],
+                           struct client_events ev[static 1])
+{
+    int ret = DHR_SUCCESS;
+    if (ev->sev_signal == SIGNAL_RELEASE) {
+        print_release(cs);
+        return goto_state(cs, DS_RELEASED);
+    }
+    if (ev->sev_dhcp) {
+        // Any server may tell us that our old lease is not valid here.
+        if (ev->dhcp_msgtype == DHCPNAK) {
+            log_line("%s: Our previous lease was rejected.  Searching for a new lease...",
+                     client_config->interface);
+            reinit_selecting(cs, 0);
+            return goto_init(cs, ev);
         }
-        if (sev_dhcp) {
-            int r = selecting_packet(cs, dhcp_packet, dhcp_msgtype,
-                                     dhcp_srcaddr, true);
-            if (r == ANP_IGNORE) {
-            } else if (r == ANP_CHECK_IP) {
-                if (arp_check(cs, dhcp_packet) < 0) {
-                    log_warning("%s: Failed to make arp socket.  Searching for new lease...",
-                                client_config.interface);
-                    reinit_selecting(cs, 3000);
-                    sev_dhcp = false;
-                    goto reinit;
-                }
-                break;
-            } else BAD_STATE();
+        int r = selecting_packet(cs, ev->dhcp_packet, ev->dhcp_msgtype,
+                                 ev->dhcp_srcaddr, true);
+        if (r == ANP_IGNORE) {
+        } else if (r == ANP_CHECK_IP) {
+            if (arp_check(cs, ev->dhcp_packet) < 0) {
+                log_warning("%s: Failed to make arp socket.  Searching for new lease...",
+                            client_config->interface);
+                reinit_selecting(cs, 3000);
+                return goto_init(cs, ev);
+            }
+            cs->dhcp_state = DS_COLLISION_CHECK;
+            return DHR_SUCCESS;
+        } else BAD_STATE();
+    }
+    if (ev->expired & TMRF_DHCP) {
+        int r = rebooting_timeout(cs, ev->nowts);
+        if (r == REQ_SUCCESS) {
+        } else if (r == REQ_TIMEOUT) {
+            return goto_init(cs, ev);
+        } else if (r == REQ_FAIL) {
+            // Failed to send packet.  Sleep and retry.
+            ret = DHR_ERROR;
+        } else BAD_STATE();
+    }
+    return ret;
+}
+
+static int requesting_state(struct client_state_t cs[static 1],
+                            struct client_events ev[static 1])
+{
+    int ret = DHR_SUCCESS;
+    if (ev->sev_signal == SIGNAL_RELEASE) {
+        print_release(cs);
+        return goto_state(cs, DS_RELEASED);
+    }
+    if (ev->sev_dhcp) {
+        int r = selecting_packet(cs, ev->dhcp_packet, ev->dhcp_msgtype,
+                                 ev->dhcp_srcaddr, true);
+        if (r == ANP_IGNORE) {
+        } else if (r == ANP_REJECTED) {
+            if (reinit_next_offer(cs, ev->nowts)) {
+                ev->sev_dhcp = false;
+                ev->expired |= TMRF_DHCP;
+                return goto_state(cs, DS_REQUESTING);
+            }
+            log_line("%s: Searching for a new lease...",
+                     client_config->interface);
+            reinit_selecting(cs, 3000);
+            return goto_init(cs, ev);
+        } else if (r == ANP_CHECK_IP) {
+            if (arp_check(cs, ev->dhcp_packet) < 0) {
+                log_warning("%s: Failed to make arp socket.  Searching for new lease...",
+                            client_config->interface);
+                reinit_selecting(cs, 3000);
+                return goto_init(cs, ev);
+            }
+            cs->dhcp_state = DS_COLLISION_CHECK;
+            return DHR_SUCCESS;
+        } else BAD_STATE();
+    }
+    if (ev->expired & TMRF_DHCP) {
+        // Send a request packet to the answering DHCP server.
+        int r = requesting_timeout(cs, ev->nowts);
+        if (r == REQ_SUCCESS) {
+        } else if (r == REQ_TIMEOUT) {
+            // We timed out.  Send another packet.
+            return goto_init(cs, ev);
+        } else if (r == REQ_FAIL) {
+            // Failed to send packet.  Sleep and retry.
+            ret = DHR_ERROR;
+        } else BAD_STATE();
+    }
+    return ret;
+}
+
+// We're checking to see if there's a conflict for our IP.  Technically,
+// this is still in REQUESTING.
+static int collision_check_state(struct client_state_t cs[static 1],
+                                 struct client_events ev[static 1])
+{
+    int ret = DHR_SUCCESS;
+    if (ev->sev_signal == SIGNAL_RELEASE) {
+        print_release(cs);
+        return goto_state(cs, DS_RELEASED);
+    }
+    if (ev->sev_dhcp && ev->dhcp_msgtype == DHCPOFFER) {
+        // Remember late offers in case this address is in use.
+        selecting_packet(cs, ev->dhcp_packet, ev->dhcp_msgtype,
+                         ev->dhcp_srcaddr, true);
+    }
+    if (ev->sev_arp) {
+        uint32_t declined;
+        int r = arp_do_collision_check(cs, &declined);
+        if (r == ARPR_OK) {
+        } else if (r == ARPR_CONFLICT) {
+            // When renewing onto a new address, clientAddr is still the
+            // old one, so blacklist what was actually declined.
+            blacklist_add(cs, declined, ev->nowts);
+            if (reinit_next_offer(cs, ev->nowts)) {
+                ev->sev_arp = false;
+                ev->expired |= TMRF_DHCP;
+                return goto_state(cs, DS_REQUESTING);
+            }
+            reinit_selecting(cs, 0);
+            return goto_init(cs, ev);
+        } else if (r == ARPR_FAIL) {
+            return DHR_ERROR;
+        } else BAD_STATE();
+    }
+    if (ev->expired & TMRF_ARP) {
+        int r = arp_collision_timeout(cs, ev->nowts);
+        if (r == ARPR_FREE) {
+            offer_clear(cs);
+            arp_query_gateway(cs);
+            arp_announce(cs);
+            cs->dhcp_state = DS_BOUND;
+            return DHR_SUCCESS;
+        } else if (r == ARPR_OK) {
+        } else if (r == ARPR_FAIL) {
+            return DHR_ERROR;
+        } else BAD_STATE();
+    }
+    if (ev->expired & TMRF_DHCP) {
+        // Send a request packet to the answering DHCP server.
+        int r = requesting_timeout(cs, ev->nowts);
+        if (r == REQ_SUCCESS) {
+        } else if (r == REQ_TIMEOUT) {
+            // We timed out.  Send another packet.
+            return goto_init(cs, ev);
+        } else if (r == REQ_FAIL) {
+            // Failed to send packet.  Sleep and retry.
+            ret = DHR_ERROR;
+        } else BAD_STATE();
+    }
+    return ret;
+}
+
+// Handles the BOUND, RENEWING, and REBINDING states.
+static int bound_state(struct client_state_t cs[static 1],
+                       struct client_events ev[static 1])
+{
+    int ret = DHR_SUCCESS;
+    if (ev->sev_signal) {
+        if (ev->sev_signal == SIGNAL_RELEASE) {
+            if (xmit_release(cs))
+                return DHR_ERROR;
+            return goto_state(cs, DS_RELEASED);
         }
-        if (dhcp_timeout) {
-            // Send a request packet to the answering DHCP server.
-            int r = requesting_timeout(cs, nowts);
-            if (r == REQ_SUCCESS) {
-            } else if (r == REQ_TIMEOUT) {
-                // We timed out.  Send another packet.
-                sev_dhcp = false;
-                goto reinit;
-            } else if (r == REQ_FAIL) {
-                // Failed to send packet.  Sleep and retry.
-                ret = COR_ERROR;
-            } else BAD_STATE();
+        if (ev->sev_signal == SIGNAL_RENEW) {
+            if (frenew(cs, true))
+                return DHR_ERROR;
         }
-        scrReturn(ret);
     }
-    scrReturn(COR_SUCCESS);
-    // We're checking to see if there's a conflict for our IP.  Technically,
-    // this is still in REQUESTING.
-    for (;;) {
-        int ret;
-        ret = COR_SUCCESS;
-        if (sev_signal == SIGNAL_RELEASE) {
-            print_release(cs);
-            goto skip_to_released;
+    if (ev->sev_dhcp && cs->revalidating && ev->dhcp_msgtype == DHCPNAK) {
+        // Any server may tell us that our lease is not valid here.  If
+        // this may be one of the known networks, the gateway check has
+        // the last word.
+        if (!cs->check_fingerprint || !arp_gw_known_pending(cs)) {
+            log_line("%s: Our lease was rejected on this network.  Searching for a new lease...",
+                     client_config->interface);
+            reinit_selecting(cs, 0);
+            return goto_init(cs, ev);
         }
-        if (sev_dhcp) {
-            // XXX: Maybe I can think of something to do here.  Would
-            //      be more relevant if we tracked multiple dhcp servers.
+        log_line("%s: Our lease was rejected on this network.",
+                 client_config->interface);
+        revalidate_done(cs, ev->nowts);
+        ev->sev_dhcp = false;
+    }
+    if (ev->sev_dhcp && (cs->revalidating || is_renewing(cs, ev->nowts))) {
+        int r = extend_packet(cs, ev->dhcp_packet, ev->dhcp_msgtype,
+                              ev->dhcp_srcaddr);
+        if (cs->revalidating && r != ANP_IGNORE) {
+            // The server answered before the gateway check finished.
+            cs->revalidating = false;
+            if (cs->check_fingerprint) {
+                cs->check_fingerprint = false;
+                arp_gw_check_cancel(cs);
+            }
         }
-        if (sev_arp) {
-            int r = arp_do_collision_check(cs);
+        if (r == ANP_SUCCESS || r == ANP_IGNORE) {
+        } else if (r == ANP_REJECTED) {
+            return goto_init(cs, ev);
+        } else if (r == ANP_CHECK_IP) {
+            if (arp_check(cs, ev->dhcp_packet) < 0) {
+                log_warning("%s: Failed to make arp socket.  Searching for new lease...",
+                            client_config->interface);
+                reinit_selecting(cs, 3000);
+                return goto_init(cs, ev);
+            }
+            // The new address is bound once the check finishes.
+            cs->dhcp_state = DS_COLLISION_CHECK;
+            return DHR_SUCCESS;
+        } else BAD_STATE();
+    }
+    if (ev->sev_arp) {
+        int r;
+        r = arp_do_defense(cs);
+        if (r == ARPR_OK) {
+        } else if (r == ARPR_CONFLICT) {
+            reinit_selecting(cs, 0);
+            return goto_init(cs, ev);
+        } else if (r == ARPR_FAIL) {
+            return DHR_ERROR;
+        } else BAD_STATE();
+        if (!cs->got_router_arp || !cs->got_server_arp) {
+            r = arp_do_gw_query(cs);
             if (r == ARPR_OK) {
-            } else if (r == ARPR_CONFLICT) {
-                // XXX: If we tracked multiple DHCP servers, then we
-                //      could fall back on another one.
-                reinit_selecting(cs, 0);
-                sev_dhcp = false;
-                goto reinit;
+            } else if (r == ARPR_FREE) {
+                log_line("%s: Network fingerprinting complete.", client_config->interface);
+                cs->init_fingerprint_inprogress = false;
+                save_lease_record(cs);
             } else if (r == ARPR_FAIL) {
-                ret = COR_ERROR;
-                scrReturn(ret);
-                continue;
+                return DHR_ERROR;
             } else BAD_STATE();
-        }
-        if (arp_timeout) {
-            int r = arp_collision_timeout(cs, nowts);
-            if (r == ARPR_FREE) {
-                arp_query_gateway(cs);
-                arp_announce(cs);
-                break;
-            } else if (r == ARPR_OK) {
+        } else if (cs->check_fingerprint) {
+            r = arp_do_gw_check(cs);
+            if (r == ARPR_OK) {
+            } else if (r == ARPR_FREE) {
+                cs->check_fingerprint = false;
+                revalidate_done(cs, ev->nowts);
+            } else if (r == ARPR_KNOWN) {
+                cs->check_fingerprint = false;
+                return goto_known_network(cs, ev);
+            } else if (r == ARPR_CONFLICT) {
+                cs->check_fingerprint = false;
+                reinit_selecting(cs, 0);
+                return goto_init(cs, ev);
             } else if (r == ARPR_FAIL) {
-                ret = COR_ERROR;
-                scrReturn(ret);
-                continue;
+                return DHR_ERROR;
             } else BAD_STATE();
         }
-        if (dhcp_timeout) {
-            // Send a request packet to the answering DHCP server.
-            int r = requesting_timeout(cs, nowts);
-            if (r == REQ_SUCCESS) {
-            } else if (r == REQ_TIMEOUT) {
-                // We timed out.  Send another packet.
-                sev_dhcp = false;
-                goto reinit;
-            } else if (r == REQ_FAIL) {
-                // Failed to send packet.  Sleep and retry.
-                ret = COR_ERROR;
-            } else BAD_STATE();
-        }
-        scrReturn(ret);
     }
-    scrReturn(COR_SUCCESS);
-    // We're in the BOUND, RENEWING, or REBINDING states here.
-    for (;;) {
-        int ret = COR_SUCCESS;
-        if (sev_signal) {
-            if (sev_signal == SIGNAL_RELEASE) {
-                int r = xmit_release(cs);
-                if (r) {
-                    ret = COR_ERROR;
-                    scrReturn(ret);
-                    continue;
-                }
-                goto skip_to_released;
-            }
-            if (sev_signal == SIGNAL_RENEW) {
-                int r = frenew(cs, true);
-                if (r) {
-                    ret = COR_ERROR;
-                    scrReturn(ret);
-                    continue;
-                }
-            }
-        }
-        if (sev_dhcp && is_renewing(cs, nowts)) {
-            int r = extend_packet(cs, dhcp_packet, dhcp_msgtype, dhcp_srcaddr);
-            if (r == ANP_SUCCESS || r == ANP_IGNORE) {
-            } else if (r == ANP_REJECTED) {
-                sev_dhcp = false;
-                goto reinit;
-            } else if (r == ANP_CHECK_IP) {
-                if (arp_check(cs, dhcp_packet) < 0) {
-                    log_warning("%s: Failed to make arp socket.  Searching for new lease...",
-                                client_config.interface);
-                    reinit_selecting(cs, 3000);
-                    sev_dhcp = false;
-                    goto reinit;
-                }
+    if (ev->expired & TMRF_ARP) {
+        if (cs->sent_first_announce && cs->sent_second_announce)
+            arp_defense_timeout(cs, ev->nowts);
+        else
+            arp_announce_timeout(cs, ev->nowts);
+        if (!cs->sent_gw_query)
+            arp_query_gateway_timeout(cs, ev->nowts);
+        else if (!cs->got_router_arp || !cs->got_server_arp) {
+            int r = arp_gw_query_timeout(cs, ev->nowts);
+            if (r == ARPR_OK) {
+            } else if (r == ARPR_FAIL) {
+                return DHR_ERROR;
             } else BAD_STATE();
-        }
-        if (sev_arp) {
-            int r;
-            r = arp_do_defense(cs);
+        } else if (cs->check_fingerprint) {
+            int r = arp_gw_check_timeout(cs, ev->nowts);
             if (r == ARPR_OK) {
             } else if (r == ARPR_CONFLICT) {
+                cs->check_fingerprint = false;
                 reinit_selecting(cs, 0);
-                sev_dhcp = false;
-                goto reinit;
+                return goto_init(cs, ev);
             } else if (r == ARPR_FAIL) {
-                ret = COR_ERROR;
-                scrReturn(ret);
-                continue;
+                return DHR_ERROR;
             } else BAD_STATE();
-            if (!cs->got_router_arp || !cs->got_server_arp) {
-                r = arp_do_gw_query(cs);
-                if (r == ARPR_OK) {
-                } else if (r == ARPR_FREE) {
-                    log_line("%s: Network fingerprinting complete.", client_config.interface);
-                    cs->init_fingerprint_inprogress = false;
-                } else if (r == ARPR_FAIL) {
-                    ret = COR_ERROR;
-                    scrReturn(ret);
-                    continue;
-                } else BAD_STATE();
-            } else if (cs->check_fingerprint) {
-                r = arp_do_gw_check(cs);
-                if (r == ARPR_OK) {
-                } else if (r == ARPR_FREE) {
-                    cs->check_fingerprint = false;
-                } else if (r == ARPR_CONFLICT) {
-                    cs->check_fingerprint = false;
-                    reinit_selecting(cs, 0);
-                    sev_dhcp = false;
-                    goto reinit;
-                } else if (r == ARPR_FAIL) {
-                    ret = COR_ERROR;
-                    scrReturn(ret);
-                    continue;
-                } else BAD_STATE();
-            }
         }
-        if (arp_timeout) {
-            if (cs->sent_first_announce && cs->sent_second_announce)
-                arp_defense_timeout(cs, nowts);
-            else
-                arp_announce_timeout(cs, nowts);
-            if (!cs->sent_gw_query)
-                arp_query_gateway_timeout(cs, nowts);
-            else if (!cs->got_router_arp || !cs->got_server_arp) {
-                int r = arp_gw_query_timeout(cs, nowts);
-                if (r == ARPR_OK) {
-                } else if (r == ARPR_FAIL) {
-                    ret = COR_ERROR;
-                    scrReturn(ret);
-                    continue;
-                } else BAD_STATE();
-            } else if (cs->check_fingerprint) {
-                int r = arp_gw_check_timeout(cs, nowts);
-                if (r == ARPR_OK) {
-                } else if (r == ARPR_CONFLICT) {
-                    cs->check_fingerprint = false;
-                    reinit_selecting(cs, 0);
-                    sev_dhcp = false;
-                    goto reinit;
-                } else if (r == ARPR_FAIL) {
-                    ret = COR_ERROR;
-                    scrReturn(ret);
-                    continue;
-                } else BAD_STATE();
-            }
-        }
-        if (force_fingerprint) {
-            int r = ifup_action(cs);
-            if (r == IFUP_REVALIDATE) {
-            } else if (r == IFUP_NEWLEASE) {
-                if (ifchange_deconfig(cs) < 0) {
-                    // Likely only to fail because of rfkill.
-                    ret = COR_ERROR;
-                    scrReturn(ret);
-                }
-                reinit_selecting(cs, 0);
-                sev_dhcp = false;
-                goto reinit;
-            } else if (r == IFUP_FAIL) {
-                ret = COR_ERROR;
-                scrReturn(ret);
-                continue;
-            } else BAD_STATE();
-        }
-        if (dhcp_timeout) {
-            int r;
-            if (is_rebinding(cs, nowts)) {
-                r = rebinding_timeout(cs, nowts);
-            } else if (is_renewing(cs, nowts)) {
-                r = renewing_timeout(cs, nowts);
-            } else {
-                r = bound_timeout(cs, nowts);
-            }
-            if (r == BTO_WAIT) {
-            } else if (r == BTO_EXPIRED) {
-                sev_dhcp = false;
-                goto reinit;
-            } else if (r == BTO_HARDFAIL) {
-                ret = COR_ERROR;
-            } else
-                BAD_STATE();
-        }
-        scrReturn(ret);
     }
-    sev_dhcp = false;
-    goto reinit;
-    // We're in the RELEASED state here.
-    for (;;) {
-        int ret;
-skip_to_released:
-        ret = COR_SUCCESS;
-        if (sev_signal == SIGNAL_RENEW) {
-            int r = frenew(cs, false);
-            if (r) {
-                ret = COR_ERROR;
-                scrReturn(ret);
-                continue;
-            }
-            break;
+    if (ev->force_fingerprint) {
+        int r = ifup_action(cs);
+        if (r == IFUP_REVALIDATE) {
+        } else if (r == IFUP_NEWLEASE) {
+            // Likely only to fail because of rfkill.
+            bool deconfig_failed = ifchange_deconfig(cs) < 0;
+            reinit_selecting(cs, 0);
+            goto_init(cs, ev);
+            return deconfig_failed ? DHR_ERROR : DHR_AGAIN;
+        } else if (r == IFUP_FAIL) {
+            return DHR_ERROR;
+        } else BAD_STATE();
+    }
+    if (ev->expired & TMRF_DHCP) {
+        int r;
+        if (is_rebinding(cs, ev->nowts)) {
+            r = rebinding_timeout(cs, ev->nowts);
+        } else if (is_renewing(cs, ev->nowts)) {
+            r = renewing_timeout(cs, ev->nowts);
+        } else {
+            r = bound_timeout(cs, ev->nowts);
         }
-        scrReturn(ret);
+        if (r == BTO_WAIT) {
+        } else if (r == BTO_EXPIRED) {
+            return goto_init(cs, ev);
+        } else if (r == BTO_HARDFAIL) {
+            ret = DHR_ERROR;
+        } else
+            BAD_STATE();
     }
-    sev_dhcp = false;
-    goto reinit;
-    scrFinish(COR_SUCCESS);
+    return ret;
 }
 
+static int released_state(struct client_state_t cs[static 1],
+                          struct client_events ev[static 1])
+{
+    if (ev->sev_signal == SIGNAL_RENEW) {
+        if (frenew(cs, false))
+            return DHR_ERROR;
+        return goto_init(cs, ev);
+    }
+    return DHR_SUCCESS;
+}
 
+// Each client_state_t carries its own position in the state machine, so
+// any number of clients can be driven concurrently.
+int dhcp_handle(struct client_state_t cs[static 1], long long nowts,
+                bool sev_dhcp, struct dhcp_rx dhcp_packet[static 1],
+                uint8_t dhcp_msgtype, uint32_t dhcp_srcaddr, bool sev_arp,
+                bool force_fingerprint, unsigned int expired, int sev_signal)
+{
+    struct client_events ev = {
+        .dhcp_packet = dhcp_packet,
+        .nowts = nowts,
+        .dhcp_srcaddr = dhcp_srcaddr,
+        .dhcp_msgtype = dhcp_msgtype,
+        .sev_signal = sev_signal,
+        .sev_dhcp = sev_dhcp,
+        .sev_arp = sev_arp,
+        .force_fingerprint = force_fingerprint,
+        .expired = expired,
+    };
+    for (;;) {
+        int r;
+        switch (cs->dhcp_state) {
+        case DS_INIT: r = init_state(cs); break;
+        case DS_SELECTING: r = selecting_state(cs, &ev); break;
+        case DS_REBOOTING: r = rebooting_state(cs, &ev); break;
+        case DS_REQUESTING: r = requesting_state(cs, &ev); break;
+        case DS_COLLISION_CHECK: r = collision_check_state(cs, &ev); break;
+        case DS_BOUND: r = bound_state(cs, &ev); break;
+        case DS_RELEASED: r = released_state(cs, &ev); break;
+        default: BAD_STATE();
+        }
+        if (r == DHR_AGAIN)
+            continue;
+        return r == DHR_ERROR ? COR_ERROR : COR_SUCCESS;
+    }
+}
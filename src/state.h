@@ -40,11 +40,16 @@ enum {
     SIGNAL_RELEASE
 };
 
+void set_fast_revalidate(bool v);
+void save_lease_record(struct client_state_t cs[static 1]);
+bool restore_lease_record(struct client_state_t cs[static 1]);
+bool adopt_lease_record(struct client_state_t cs[static 1]);
+void reinit_failed_bind(struct client_state_t cs[static 1]);
+
 int dhcp_handle(struct client_state_t cs[static 1], long long nowts,
-                bool sev_dhcp, struct dhcpmsg dhcp_packet[static 1],
+                bool sev_dhcp, struct dhcp_rx dhcp_packet[static 1],
                 uint8_t dhcp_msgtype, uint32_t dhcp_srcaddr, bool sev_arp,
-                bool force_fingerprint, bool dhcp_timeout, bool arp_timeout,
-                int sev_signal);
+                bool force_fingerprint, unsigned int expired, int sev_signal);
 
 #endif
 
@@ -38,12 +38,14 @@
 #include "ndhc.h"
 #include "sys.h"
 
+// CLOCK_BOOTTIME keeps running while the system is suspended, as the
+// lease time on the DHCP server does.
 long long IMPL_curms(const char *parent_function)
 {
     struct timespec ts;
-    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+    if (clock_gettime(CLOCK_BOOTTIME, &ts) < 0) {
         suicide("%s: (%s) clock_gettime failed: %s",
-                client_config.interface, parent_function, strerror(errno));
+                client_config->interface, parent_function, strerror(errno));
     }
     return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000LL;
 }
@@ -59,6 +61,19 @@ void epoll_add(int epfd, int fd)
         suicide("epoll_add failed %s", strerror(errno));
 }
 
+// The interface index is kept alongside the fd so that the master can find
+// the client that owns a ready fd without searching for it.
+void epoll_add_tag(int epfd, int fd, uint32_t tag)
+{
+    struct epoll_event ev;
+    int r;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP;
+    ev.data.u64 = (uint64_t)tag << 32 | (uint32_t)fd;
+    r = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    if (r < 0)
+        suicide("epoll_add failed %s", strerror(errno));
+}
+
 void epoll_del(int epfd, int fd)
 {
     struct epoll_event ev;
@@ -92,12 +107,12 @@ void signal_dispatch_subprocess(int sfd, const char pname[static 1])
     ssize_t r = safe_read(sfd, (char *)&si, sizeof si);
     if (r < 0) {
         log_error("%s: %s: error reading from signalfd: %s",
-                  client_config.interface, pname, strerror(errno));
+                  client_config->interface, pname, strerror(errno));
         return;
     }
     if ((size_t)r < sizeof si) {
         log_error("%s: %s: short read from signalfd: %zd < %zu",
-                  client_config.interface, pname, r, sizeof si);
+                  client_config->interface, pname, r, sizeof si);
         return;
     }
     switch (si.ssi_signo) {
@@ -29,6 +29,8 @@
 #define SYS_H_
 
 #include <time.h>
+#include <stdint.h>
+#include <sys/epoll.h>
 #include "ndhc-defines.h"
 
 static inline size_t min_size_t(size_t a, size_t b)
@@ -39,8 +41,19 @@ static inline size_t min_size_t(size_t a, size_t b)
 #define curms() IMPL_curms(__func__)
 long long IMPL_curms(const char *parent_function);
 void epoll_add(int epfd, int fd);
+void epoll_add_tag(int epfd, int fd, uint32_t tag);
 void epoll_del(int epfd, int fd);
 
+// Accessors for events registered with epoll_add_tag().
+static inline int epoll_tag_fd(const struct epoll_event ev[static 1])
+{
+    return (int)(uint32_t)ev->data.u64;
+}
+static inline uint32_t epoll_tag(const struct epoll_event ev[static 1])
+{
+    return (uint32_t)(ev->data.u64 >> 32);
+}
+
 int setup_signals_subprocess(void);
 void signal_dispatch_subprocess(int sfd, const char pname[static 1]);
 
@@ -0,0 +1,277 @@
+/* timer.c - per-interface timers driven by a timerfd
+ *
+ * Copyright (c) 2017 Nicholas J. Kain <njkain at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdint.h>
+#include <time.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "nk/log.h"
+#include "nk/io.h"
+#include "timer.h"
+
+// All of the timers of all clients share one binary min-heap that is
+// ordered by deadline, so the next wakeup is always at heap[0].  A timer
+// is in the heap only while it is set and has not yet fired; one that has
+// fired keeps its deadline, so that timer_get() and timer_expired() still
+// see it, until its owner sets it again.
+#define TMR_SLOTS (NDHC_MAX_IFACES * TMR_MAX)
+
+static long long timer_ts[TMR_SLOTS];
+static uint16_t heap[TMR_SLOTS];
+static uint16_t heap_pos[TMR_SLOTS]; // Index in heap[] + 1, or 0.
+static size_t heap_len;
+
+static int timerFd = -1;
+static long long armed_ts = -1; // Deadline that timerFd is set for.
+
+// CLOCK_BOOTTIME keeps counting while the system is suspended and
+// CLOCK_MONOTONIC does not, so the difference between them grows by the
+// length of each suspend.  resumeFd wakes us when the kernel resumes.
+static int resumeFd = -1;
+static long long suspended_ms;
+
+#define RESUME_MIN_MS 1000 // Smallest growth of suspended_ms that counts.
+#define RESUME_ARM_SECS 86400
+
+static size_t timer_id(const struct client_state_t cs[static 1],
+                       enum timer_kind kind)
+{
+    return cs->client_idx * TMR_MAX + (size_t)kind;
+}
+
+static void heap_put(size_t i, uint16_t id)
+{
+    heap[i] = id;
+    heap_pos[id] = (uint16_t)(i + 1);
+}
+
+static void heap_up(size_t i)
+{
+    uint16_t id = heap[i];
+    while (i > 0) {
+        size_t p = (i - 1) / 2;
+        if (timer_ts[heap[p]] <= timer_ts[id])
+            break;
+        heap_put(i, heap[p]);
+        i = p;
+    }
+    heap_put(i, id);
+}
+
+static void heap_down(size_t i)
+{
+    uint16_t id = heap[i];
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= heap_len)
+            break;
+        if (c + 1 < heap_len && timer_ts[heap[c + 1]] < timer_ts[heap[c]])
+            ++c;
+        if (timer_ts[id] <= timer_ts[heap[c]])
+            break;
+        heap_put(i, heap[c]);
+        i = c;
+    }
+    heap_put(i, id);
+}
+
+static void heap_remove(size_t id)
+{
+    size_t i = heap_pos[id];
+    if (!i)
+        return;
+    --i;
+    heap_pos[id] = 0;
+    if (i == --heap_len)
+        return;
+    uint16_t last = heap[heap_len];
+    heap_put(i, last);
+    heap_up(i);
+    heap_down(heap_pos[last] - 1);
+}
+
+void timer_init(void)
+{
+    for (size_t i = 0; i < TMR_SLOTS; ++i)
+        timer_ts[i] = -1;
+}
+
+// Opened by the master alone so that the subprocesses don't inherit it.
+int timer_open(void)
+{
+    timerFd = timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd < 0)
+        suicide("%s: timerfd_create failed: %s", __func__, strerror(errno));
+    armed_ts = -1;
+    return timerFd;
+}
+
+static long long clock_ms(clockid_t clk)
+{
+    struct timespec ts;
+    if (clock_gettime(clk, &ts) < 0)
+        suicide("%s: clock_gettime failed: %s", __func__, strerror(errno));
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000LL;
+}
+
+static long long suspended_now(void)
+{
+    return clock_ms(CLOCK_BOOTTIME) - clock_ms(CLOCK_MONOTONIC);
+}
+
+// A CLOCK_REALTIME timerfd with TFD_TIMER_CANCEL_ON_SET is cancelled when
+// the wall clock is set, which the kernel also does on resume.  It must
+// be absolute, so it is set a day ahead and renewed when it fires.
+static void resume_fd_arm(void)
+{
+    struct itimerspec its = {0};
+    its.it_value.tv_sec = clock_ms(CLOCK_REALTIME) / 1000 + RESUME_ARM_SECS;
+    if (timerfd_settime(resumeFd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+                        &its, NULL) < 0)
+        suicide("%s: timerfd_settime failed: %s", __func__, strerror(errno));
+}
+
+int timer_resume_open(void)
+{
+    resumeFd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (resumeFd < 0)
+        suicide("%s: timerfd_create failed: %s", __func__, strerror(errno));
+    suspended_ms = suspended_now();
+    resume_fd_arm();
+    return resumeFd;
+}
+
+void timer_resume_ack(void)
+{
+    uint64_t exp;
+    ssize_t r = safe_read(resumeFd, (char *)&exp, sizeof exp);
+    if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+        errno != ECANCELED)
+        suicide("%s: read failed: %s", __func__, strerror(errno));
+    if (r >= 0 || errno == ECANCELED)
+        resume_fd_arm();
+}
+
+// Returns true once for each suspend that the system has resumed from.
+// Wall clock changes also wake resumeFd, but don't change suspended_ms.
+bool timer_resumed(void)
+{
+    long long s = suspended_now();
+    if (s - suspended_ms < RESUME_MIN_MS)
+        return false;
+    log_line("System resumed after %lld seconds of suspend.",
+             (s - suspended_ms) / 1000);
+    suspended_ms = s;
+    return true;
+}
+
+void timer_set(struct client_state_t cs[static 1], enum timer_kind kind,
+               long long ts)
+{
+    size_t id = timer_id(cs, kind);
+    timer_ts[id] = ts;
+    if (ts < 0) {
+        heap_remove(id);
+    } else if (heap_pos[id]) {
+        heap_up(heap_pos[id] - 1);
+        heap_down(heap_pos[id] - 1);
+    } else {
+        heap_put(heap_len++, (uint16_t)id);
+        heap_up(heap_len - 1);
+    }
+}
+
+long long timer_get(const struct client_state_t cs[static 1],
+                    enum timer_kind kind)
+{
+    return timer_ts[timer_id(cs, kind)];
+}
+
+void timer_clear(struct client_state_t cs[static 1])
+{
+    for (int i = 0; i < TMR_MAX; ++i)
+        timer_set(cs, (enum timer_kind)i, -1);
+}
+
+// Returns the TMRF_* mask of the timers of cs that are due at nowts,
+// whether or not they have already been popped.
+unsigned int timer_expired(const struct client_state_t cs[static 1],
+                           long long nowts)
+{
+    unsigned int r = 0;
+    size_t base = timer_id(cs, 0);
+    for (int i = 0; i < TMR_MAX; ++i) {
+        long long ts = timer_ts[base + (size_t)i];
+        if (ts >= 0 && ts <= nowts)
+            r |= 1u << i;
+    }
+    return r;
+}
+
+// Removes the earliest timer from the heap if it is due at nowts and
+// stores the index of the client that owns it in idx.
+bool timer_pop(long long nowts, size_t idx[static 1])
+{
+    if (!heap_len || timer_ts[heap[0]] > nowts)
+        return false;
+    size_t id = heap[0];
+    heap_remove(id);
+    *idx = id / TMR_MAX;
+    return true;
+}
+
+// Sets timerFd to fire at the earliest deadline.  It is only touched
+// when that deadline changes.
+void timer_arm(void)
+{
+    long long ts = heap_len ? timer_ts[heap[0]] : -1;
+    if (ts == armed_ts)
+        return;
+    struct itimerspec its = {0};
+    if (ts >= 0) {
+        its.it_value.tv_sec = ts / 1000;
+        its.it_value.tv_nsec = (ts % 1000) * 1000000;
+        // A zero it_value would disarm the timer instead.
+        if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+            its.it_value.tv_nsec = 1;
+    }
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        suicide("%s: timerfd_settime failed: %s", __func__, strerror(errno));
+    armed_ts = ts;
+}
+
+void timer_ack(void)
+{
+    uint64_t exp;
+    ssize_t r = safe_read(timerFd, (char *)&exp, sizeof exp);
+    if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        suicide("%s: read failed: %s", __func__, strerror(errno));
+    // The timer has fired, so it is no longer set for armed_ts.
+    armed_ts = -1;
+}
@@ -0,0 +1,64 @@
+/* timer.h - per-interface timers driven by a timerfd
+ *
+ * Copyright (c) 2017 Nicholas J. Kain <njkain at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef NDHC_TIMER_H_
+#define NDHC_TIMER_H_
+
+#include <stdbool.h>
+#include "ndhc.h"
+#include "arp.h"
+
+// Every client owns one timer of each kind.  A timer holds a curms()
+// deadline, or -1 if it is unset.
+enum timer_kind {
+    TMR_DHCP = 0,   // DHCP state machine timeout
+    TMR_POLL,       // Link poll, or retry after an error
+    TMR_ARP,        // ARP timeouts: TMR_ARP + arp_state_t
+    TMR_MAX = TMR_ARP + AS_MAX,
+};
+
+// Masks of the expired timers that are passed to dhcp_handle().
+#define TMRF_DHCP (1u << TMR_DHCP)
+#define TMRF_ARP (((1u << AS_MAX) - 1) << TMR_ARP)
+
+void timer_init(void);
+int timer_open(void);
+void timer_set(struct client_state_t cs[static 1], enum timer_kind kind,
+               long long ts);
+long long timer_get(const struct client_state_t cs[static 1],
+                    enum timer_kind kind);
+void timer_clear(struct client_state_t cs[static 1]);
+unsigned int timer_expired(const struct client_state_t cs[static 1],
+                           long long nowts);
+bool timer_pop(long long nowts, size_t idx[static 1]);
+void timer_arm(void);
+void timer_ack(void);
+int timer_resume_open(void);
+void timer_resume_ack(void);
+bool timer_resumed(void);
+
+#endif